@@ -0,0 +1,5 @@
+#version 330 core
+
+#define SPRITE_COMPACT
+
+#include "lib/sprite_bullet.vert.glslh"
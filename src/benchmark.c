@@ -0,0 +1,219 @@
+/*
+ * This software is licensed under the terms of the MIT License.
+ * See COPYING for further information.
+ * ---
+ * Copyright (c) 2011-2019, Lukas Weber <laochailan@web.de>.
+ * Copyright (c) 2012-2019, Andrei Alexeyev <akari@taisei-project.org>.
+ */
+
+#include "taisei.h"
+
+#include "benchmark.h"
+#include "global.h"
+#include "coroutine.h"
+#include "stageobjects.h"
+#include "dynarray.h"
+#include "util/io.h"
+#include "version.h"
+
+#define NUM_STAGE_POOLS (sizeof(StageObjectPools) / sizeof(ObjectPool*))
+
+typedef struct BenchmarkStage {
+	StageInfo *info;
+	DYNAMIC_ARRAY(hrtime_t) frame_times;
+	hrtime_t begin_time;
+	hrtime_t end_time;
+	CoStats co_begin;
+	CoStats co_end;
+	struct {
+		char *tag;
+		size_t capacity;
+		size_t peak_usage;
+	} pools[NUM_STAGE_POOLS];
+	bool desynced;
+} BenchmarkStage;
+
+static struct {
+	char *replay_path;
+	char *report_path;
+	DYNAMIC_ARRAY(BenchmarkStage) stages;
+	BenchmarkStage *current;
+} bench;
+
+void benchmark_init(const char *replay_path, const char *report) {
+	stralloc(&bench.replay_path, replay_path);
+	stralloc(&bench.report_path, report);
+}
+
+void benchmark_shutdown(void) {
+	dynarray_foreach_elem(&bench.stages, BenchmarkStage *s, {
+		dynarray_free_data(&s->frame_times);
+
+		for(int i = 0; i < NUM_STAGE_POOLS; ++i) {
+			free(s->pools[i].tag);
+		}
+	});
+
+	dynarray_free_data(&bench.stages);
+	free(bench.replay_path);
+	free(bench.report_path);
+	memset(&bench, 0, sizeof(bench));
+}
+
+void benchmark_stage_begin(StageInfo *stage) {
+	assert(bench.current == NULL);
+
+	bench.current = dynarray_append(&bench.stages);
+	memset(bench.current, 0, sizeof(*bench.current));
+	bench.current->info = stage;
+	bench.current->begin_time = time_get();
+	coroutines_get_stats(&bench.current->co_begin);
+}
+
+void benchmark_stage_end(void) {
+	BenchmarkStage *s = bench.current;
+
+	if(s == NULL) {
+		return;
+	}
+
+	s->end_time = time_get();
+	s->desynced = global.replay_stage && global.replay_stage->desynced;
+	coroutines_get_stats(&s->co_end);
+
+	// must be called before the pools are freed
+	ObjectPool **pools = &stage_object_pools.first;
+
+	for(int i = 0; i < NUM_STAGE_POOLS; ++i) {
+		ObjectPoolStats stats;
+		objpool_get_stats(pools[i], &stats);
+		stralloc(&s->pools[i].tag, stats.tag);
+		s->pools[i].capacity = stats.capacity;
+		s->pools[i].peak_usage = stats.peak_usage;
+	}
+
+	bench.current = NULL;
+}
+
+void benchmark_logic_frame(hrtime_t duration) {
+	if(bench.current) {
+		*dynarray_append(&bench.current->frame_times) = duration;
+	}
+}
+
+static int benchmark_compare_times(const void *a, const void *b) {
+	hrtime_t ta = *(const hrtime_t*)a;
+	hrtime_t tb = *(const hrtime_t*)b;
+	return (ta > tb) - (ta < tb);
+}
+
+static double benchmark_msec(hrtime_t t) {
+	return t / (double)(HRTIME_RESOLUTION / 1000);
+}
+
+// nearest-rank percentile of a sorted array
+static hrtime_t benchmark_percentile(uint num, hrtime_t times[num], double p) {
+	if(num == 0) {
+		return 0;
+	}
+
+	uint rank = ceil(p * num);
+	return times[iclamp(rank, 1, num) - 1];
+}
+
+static void benchmark_write_json_string(SDL_RWops *out, const char *str) {
+	SDL_RWwrite(out, "\"", 1, 1);
+
+	for(const char *c = str; *c; ++c) {
+		if(*c == '"' || *c == '\\') {
+			SDL_RWprintf(out, "\\%c", *c);
+		} else if((uchar)*c < 0x20) {
+			SDL_RWprintf(out, "\\u%04x", *c);
+		} else {
+			SDL_RWwrite(out, c, 1, 1);
+		}
+	}
+
+	SDL_RWwrite(out, "\"", 1, 1);
+}
+
+static void benchmark_write_stage(SDL_RWops *out, BenchmarkStage *s) {
+	uint num = s->frame_times.num_elements;
+	hrtime_t *times = s->frame_times.data;
+	hrtime_t total = 0;
+
+	for(uint i = 0; i < num; ++i) {
+		total += times[i];
+	}
+
+	if(num > 0) {
+		qsort(times, num, sizeof(*times), benchmark_compare_times);
+	}
+
+	SDL_RWprintf(out, "\t\t{\n\t\t\t\"id\": \"%X\",\n\t\t\t\"title\": ", s->info->id);
+	benchmark_write_json_string(out, s->info->title ? s->info->title : "");
+	SDL_RWprintf(out, ",\n\t\t\t\"desynced\": %s,\n", s->desynced ? "true" : "false");
+	SDL_RWprintf(out, "\t\t\t\"wall_time_ms\": %.3f,\n", benchmark_msec(s->end_time - s->begin_time));
+	SDL_RWprintf(out, "\t\t\t\"logic_frames\": %u,\n", num);
+	SDL_RWprintf(out,
+		"\t\t\t\"logic_frame_ms\": { \"mean\": %.4f, \"p50\": %.4f, \"p95\": %.4f, \"p99\": %.4f, \"max\": %.4f },\n",
+		num ? benchmark_msec(total) / num : 0,
+		benchmark_msec(benchmark_percentile(num, times, 0.50)),
+		benchmark_msec(benchmark_percentile(num, times, 0.95)),
+		benchmark_msec(benchmark_percentile(num, times, 0.99)),
+		benchmark_msec(num ? times[num - 1] : 0)
+	);
+	SDL_RWprintf(out,
+		"\t\t\t\"coroutines\": { \"switches\": %zu, \"tasks_created\": %zu, \"tasks_allocated\": %zu },\n",
+		s->co_end.num_switches - s->co_begin.num_switches,
+		s->co_end.num_tasks_created - s->co_begin.num_tasks_created,
+		s->co_end.num_tasks_allocated - s->co_begin.num_tasks_allocated
+	);
+	SDL_RWprintf(out, "\t\t\t\"object_pools\": {\n");
+
+	for(int i = 0; i < NUM_STAGE_POOLS; ++i) {
+		SDL_RWprintf(out, "\t\t\t\t");
+		benchmark_write_json_string(out, s->pools[i].tag ? s->pools[i].tag : "");
+		SDL_RWprintf(out, ": { \"capacity\": %zu, \"peak_usage\": %zu }%s\n",
+			s->pools[i].capacity, s->pools[i].peak_usage, i + 1 < NUM_STAGE_POOLS ? "," : ""
+		);
+	}
+
+	SDL_RWprintf(out, "\t\t\t}\n\t\t}");
+}
+
+bool benchmark_write_report(void) {
+	SDL_RWops *out;
+
+	if(bench.report_path) {
+		if(!(out = SDL_RWFromFile(bench.report_path, "w"))) {
+			log_error("Can't open %s for writing: %s", bench.report_path, SDL_GetError());
+			return false;
+		}
+	} else {
+		out = SDL_RWFromFP(stdout, false);
+	}
+
+	bool ok = bench.stages.num_elements > 0;
+
+	SDL_RWprintf(out, "{\n\t\"replay\": ");
+	benchmark_write_json_string(out, bench.replay_path);
+	SDL_RWprintf(out, ",\n\t\"version\": ");
+	benchmark_write_json_string(out, TAISEI_VERSION_FULL);
+	SDL_RWprintf(out, ",\n\t\"stages\": [\n");
+
+	dynarray_foreach(&bench.stages, int i, BenchmarkStage *s, {
+		benchmark_write_stage(out, s);
+		SDL_RWprintf(out, "%s\n", i + 1 < bench.stages.num_elements ? "," : "");
+
+		if(s->desynced) {
+			log_error("Stage %X desynced, the results are not representative", s->info->id);
+			ok = false;
+		}
+	});
+
+	SDL_RWprintf(out, "\t]\n}\n");
+	SDL_RWclose(out);
+
+	return ok;
+}
@@ -0,0 +1,41 @@
+/*
+ * This software is licensed under the terms of the MIT License.
+ * See COPYING for further information.
+ * ---
+ * Copyright (c) 2011-2019, Lukas Weber <laochailan@web.de>.
+ * Copyright (c) 2012-2019, Andrei Alexeyev <akari@taisei-project.org>.
+ */
+
+#ifndef IGUARD_benchmark_h
+#define IGUARD_benchmark_h
+
+#include "taisei.h"
+
+#include "hirestime.h"
+#include "stageinfo.h"
+
+/*
+ * Replay-driven benchmark (--benchmark).
+ *
+ * The replay is played with the frame limiter disabled. For every stage, the
+ * logic frame times, peak object pool usage, and coroutine counters are
+ * collected, and written out as JSON when the replay is over.
+ *
+ * The hooks below are only called while global.is_benchmark is set.
+ */
+
+// Must be called before vfs_setup. Copies both strings.
+// report may be NULL to write the report to stdout.
+void benchmark_init(const char *replay_path, const char *report)
+	attr_nonnull(1);
+
+void benchmark_shutdown(void);
+
+void benchmark_stage_begin(StageInfo *stage) attr_nonnull(1);
+void benchmark_stage_end(void);
+void benchmark_logic_frame(hrtime_t duration);
+
+// Returns false if the report could not be written, or any stage desynced.
+bool benchmark_write_report(void);
+
+#endif // IGUARD_benchmark_h
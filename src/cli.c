@@ -22,6 +22,11 @@ struct TsOption { struct option opt; const char *help; const char *argname;};
 
 enum {
 	OPT_RENDERER = INT_MIN,
+	OPT_VERIFY_REPLAYS,
+	OPT_VERIFY_REPORT,
+	OPT_VERIFY_JOBS,
+	OPT_BENCHMARK,
+	OPT_BENCHMARK_REPORT,
 };
 
 static void print_help(struct TsOption* opts) {
@@ -70,6 +75,11 @@ int cli_args(int argc, char **argv, CLIAction *a) {
 	struct TsOption taisei_opts[] = {
 		{{"replay",             required_argument,  0, 'r'},            "Play a replay from %s", "FILE"},
 		{{"verify-replay",      required_argument,  0, 'R'},            "Play a replay from %s in headless mode, crash as soon as it desyncs", "FILE"},
+		{{"verify-replays",     required_argument,  0, OPT_VERIFY_REPLAYS}, "Verify all replays in a directory or list file %s, report desyncs", "PATH"},
+		{{"verify-report",      required_argument,  0, OPT_VERIFY_REPORT},  "Write the --verify-replays report to %s instead of stdout", "FILE"},
+		{{"verify-jobs",        required_argument,  0, OPT_VERIFY_JOBS},    "Verify replays in %s worker processes (0: one per CPU)", "N"},
+		{{"benchmark",          required_argument,  0, OPT_BENCHMARK},      "Play a replay from %s without the FPS limiter, report frame times as JSON", "FILE"},
+		{{"benchmark-report",   required_argument,  0, OPT_BENCHMARK_REPORT}, "Write the --benchmark report to %s instead of stdout", "FILE"},
 #ifdef DEBUG
 		{{"play",               no_argument,        0, 'p'},            "Play a specific stage"},
 		{{"sid",                required_argument,  0, 'i'},            "Select stage by %s", "ID"},
@@ -143,6 +153,30 @@ int cli_args(int argc, char **argv, CLIAction *a) {
 			a->type = CLI_VerifyReplay;
 			a->filename = strdup(optarg);
 			break;
+		case OPT_VERIFY_REPLAYS:
+			a->type = CLI_VerifyReplays;
+			a->filename = strdup(optarg);
+			break;
+		case OPT_VERIFY_REPORT:
+		case OPT_BENCHMARK_REPORT:
+			free(a->out_filename);
+			a->out_filename = strdup(optarg);
+			break;
+		case OPT_BENCHMARK:
+			a->type = CLI_Benchmark;
+			a->filename = strdup(optarg);
+			break;
+		case OPT_VERIFY_JOBS:
+			a->jobs = strtol(optarg, &endptr, 10);
+
+			if(!*optarg || endptr == optarg) {
+				log_fatal("Job count '%s' is not a number", optarg);
+			}
+
+			if(a->jobs <= 0) {
+				a->jobs = SDL_GetCPUCount();
+			}
+			break;
 		case 'p':
 			a->type = CLI_SelectStage;
 			break;
@@ -209,6 +243,7 @@ int cli_args(int argc, char **argv, CLIAction *a) {
 		switch(a->type) {
 			case CLI_PlayReplay:
 			case CLI_VerifyReplay:
+			case CLI_Benchmark:
 			case CLI_SelectStage:
 				if(stageinfo_get_by_id(stageid) == NULL) {
 					log_fatal("Invalid stage id: %X", stageid);
@@ -221,6 +256,14 @@ int cli_args(int argc, char **argv, CLIAction *a) {
 		}
 	}
 
+	if(a->out_filename && a->type != CLI_VerifyReplays && a->type != CLI_Benchmark) {
+		log_warn("--verify-report/--benchmark-report was ignored");
+	}
+
+	if(a->jobs && a->type != CLI_VerifyReplays) {
+		log_warn("--verify-jobs was ignored");
+	}
+
 	if(plrmode) {
 		if(a->type == CLI_SelectStage) {
 			a->plrmode = plrmode;
@@ -240,4 +283,6 @@ int cli_args(int argc, char **argv, CLIAction *a) {
 void free_cli_action(CLIAction *a) {
 	free(a->filename);
 	a->filename = NULL;
+	free(a->out_filename);
+	a->out_filename = NULL;
 }
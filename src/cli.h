@@ -17,6 +17,8 @@ typedef enum {
 	CLI_RunNormally = 0,
 	CLI_PlayReplay,
 	CLI_VerifyReplay,
+	CLI_VerifyReplays,
+	CLI_Benchmark,
 	CLI_SelectStage,
 	CLI_DumpStages,
 	CLI_DumpVFSTree,
@@ -28,9 +30,11 @@ typedef struct CLIAction CLIAction;
 struct CLIAction {
 	CLIActionType type;
 	char *filename;
+	char *out_filename;
 	int stageid;
 	int diff;
 	int frameskip;
+	int jobs;
 	PlayerMode *plrmode;
 };
 
@@ -10,6 +10,9 @@
 
 #include "coroutine.h"
 #include "util.h"
+#include "profiler.h"
+#include "dynarray.h"
+#include "hashtable.h"
 
 #ifdef ADDRESS_SANITIZER
 	#include <sanitizer/asan_interface.h>
@@ -17,7 +20,23 @@
 	#define ASAN_UNPOISON_MEMORY_REGION(addr, size) ((void)0)
 #endif
 
-#define CO_STACK_SIZE (64 * 1024)
+static const size_t stack_class_sizes[CO_NUM_STACK_CLASSES] = {
+#ifdef ADDRESS_SANITIZER
+	// ASan frames are several times larger; the classes are tuned for regular builds
+	[CO_STACK_SMALL]  = 64 * 1024,
+	[CO_STACK_MEDIUM] = 64 * 1024,
+#else
+	[CO_STACK_SMALL]  =  8 * 1024,
+	[CO_STACK_MEDIUM] = 16 * 1024,
+#endif
+	[CO_STACK_LARGE]  = 64 * 1024,
+};
+
+static const char *const stack_class_names[CO_NUM_STACK_CLASSES] = {
+	[CO_STACK_SMALL]  = "CO_STACK_SMALL",
+	[CO_STACK_MEDIUM] = "CO_STACK_MEDIUM",
+	[CO_STACK_LARGE]  = "CO_STACK_LARGE",
+};
 
 // #define EVT_DEBUG
 
@@ -44,9 +63,8 @@ enum {
 	COTASK_WAIT_EVENT,
 };
 
-#define MEM_AREA_SIZE (1 << 12)
 #define MEM_ALLOC_ALIGNMENT alignof(max_align_t)
-#define MEM_ALIGN_SIZE(x) (x + (MEM_ALLOC_ALIGNMENT - 1)) & ~(MEM_ALLOC_ALIGNMENT - 1)
+#define MEM_ALIGN_SIZE(x) (((x) + (MEM_ALLOC_ALIGNMENT - 1)) & ~(MEM_ALLOC_ALIGNMENT - 1))
 
 typedef struct CoTaskData CoTaskData;
 
@@ -59,15 +77,41 @@ struct CoTask {
 
 	uint32_t unique_id;
 
+	// Stacks are only ever recycled within the same class
+	CoStackClass stack_class;
+
+	// Index into taskfuncs.entries, or -1 if neither profiled nor accounted
+	int func_index;
+
+	// Scheduler bookkeeping; see the comment above struct CoSched
+	CoSched *sched;
+	CoTaskList *sched_list;  // wheel slot or sleeping list this task is parked in, if any
+	int runqueue_index;      // position in sched->runqueue, or -1
+	uint32_t seq;            // creation index; determines the order within a pass
+	uint32_t first_pass;     // first pass this task may be run in
+	uint32_t park_pass;      // pass it's due in (if in the wheel), or would've been visited in next (if sleeping)
+
 #ifdef CO_TASK_DEBUG
 	char debug_label[256];
 #endif
 };
 
-typedef struct CoTaskHeapMemChunk {
-	struct CoTaskHeapMemChunk *next;
+// Usable sizes of arena pages; anything bigger gets a dedicated page of its own.
+static const size_t arena_page_sizes[COARENA_NUM_CLASSES] = { 1024, 4096, 16384 };
+
+#define COARENA_CLASS_OVERSIZED COARENA_NUM_CLASSES
+
+struct CoArenaPage {
+	CoArenaPage *next;
+	char *head;
+	char *end;
 	alignas(MEM_ALLOC_ALIGNMENT) char data[];
-} CoTaskHeapMemChunk;
+};
+
+typedef struct CoArenaChain {
+	CoArenaPage *first;  // the one currently being allocated from
+	CoArenaPage *last;
+} CoArenaChain;
 
 struct CoTaskData {
 	LIST_INTERFACE(CoTaskData);
@@ -104,23 +148,61 @@ struct CoTaskData {
 	CoTaskEvents events;
 
 	struct {
-		CoTaskHeapMemChunk *onheap_alloc_head;
-		char *onstack_alloc_head;
-		alignas(MEM_ALLOC_ALIGNMENT) char onstack_alloc_area[MEM_AREA_SIZE];
+		CoArena *arena;
+		CoArenaChain pages[COARENA_NUM_CLASSES + 1];  // the last one is for oversized allocations
 	} mem;
 };
 
 typedef struct CoTaskInitData {
 	CoTask *task;
+	CoArena *arena;
 	CoTaskFunc func;
 	void *func_arg;
 	CoTaskData *master_task_data;
 } CoTaskInitData;
 
-static LIST_ANCHOR(CoTask) task_pool;
+static LIST_ANCHOR(CoTask) task_pools[CO_NUM_STACK_CLASSES];
+
+// for tasks not owned by a scheduler (cotask_new)
+static CoArena orphan_arena;
+
+// Everything known about one task entry point; see stack profiling and accounting below
+typedef struct CoTaskFuncInfo {
+	const char *label;
+	CoStackClass stack_class;
+
+	struct {
+		uint num_samples;
+		size_t peak_usage;
+		size_t stack_size;
+	} stack;
+
+	struct {
+		hrtime_t frame_time;
+		uint frame_switches;
+		hrtime_t last_frame_time;
+		uint last_frame_switches;
+		hrtime_t stage_time;
+		hrtime_t stage_peak_frame_time;
+		uint64_t stage_switches;
+		uint stage_frames_active;
+	} acct;
+} CoTaskFuncInfo;
+
+static struct {
+	ht_ptr2int_t index_map;  // task function -> index into entries
+	DYNAMIC_ARRAY(CoTaskFuncInfo) entries;
+	bool profile_stack;
+	bool accounting;
+	char *accounting_path;
+	hrtime_t nested_time;  // time spent in tasks resumed from within the current resume
+} taskfuncs;
 
 CoSched *_cosched_global;
 
+// Always collected; these are cheap enough, and benchmarks need them in release builds
+static CoStats costats;
+
 #ifdef CO_TASK_STATS
 static struct {
 	size_t num_tasks_allocated;
@@ -132,7 +214,7 @@ static struct {
 #define STAT_VAL(name) (cotask_stats.name)
 #define STAT_VAL_SET(name, value) ((cotask_stats.name) = (value))
 
-// enable stack usage tracking (loose)
+// always track stack usage (loose), not just when profiling
 #define CO_TASK_STATS_STACK
 
 #else // CO_TASK_STATS
@@ -152,6 +234,10 @@ static size_t debug_event_id;
 #endif
 
 #ifdef CO_TASK_STATS_STACK
+	#define STACK_TRACKING_ENABLED true
+#else
+	#define STACK_TRACKING_ENABLED (taskfuncs.profile_stack)
+#endif
 
 /*
  * Crude and simple method to estimate stack usage per task: at init time, fill
@@ -242,12 +328,12 @@ static uint32_t *find_first_canary(uint32_t *region, size_t offset, size_t sz, u
 	}
 }
 
-static void estimate_stack_usage(CoTask *task) {
+static size_t estimate_stack_usage(CoTask *task, size_t *out_real_stack_size) {
 	size_t stack_size;
 	void *stack = get_stack(task, &stack_size);
 
 	if(!stack) {
-		return;
+		return 0;
 	}
 
 	uint32_t canary = get_canary(task);
@@ -259,6 +345,9 @@ static void estimate_stack_usage(CoTask *task) {
 
 	size_t real_stack_size = stack_size + STACK_BUFFER_LOWER + STACK_BUFFER_UPPER;
 	size_t usage = (uintptr_t)(first_segment + num_segments - p_canary) * sizeof(canary) + STACK_BUFFER_UPPER;
+	*out_real_stack_size = real_stack_size;
+
+#ifdef CO_TASK_STATS
 	double percentage = usage / (double)real_stack_size;
 
 	if(usage > STAT_VAL(peak_stack_usage)) {
@@ -271,14 +360,191 @@ static void estimate_stack_usage(CoTask *task) {
 		);
 		STAT_VAL_SET(peak_stack_usage, usage);
 	}
+#endif
+
+	return usage;
+}
+
+static CoStackClass stack_class_for_usage(size_t usage) {
+	// same safety margin as the debug-mode recommendation above
+	size_t wanted = topow2_u64(usage) * 2;
+
+	for(CoStackClass c = 0; c < CO_NUM_STACK_CLASSES; ++c) {
+		if(stack_class_sizes[c] >= wanted) {
+			return c;
+		}
+	}
+
+	return CO_NUM_STACK_CLASSES;
+}
+
+static int taskfuncs_get_index(CoTaskFunc func, const char *label, CoStackClass stack_class) {
+	void *key = *(void**)&func;
+	int64_t idx = ht_get(&taskfuncs.index_map, key, -1);
+
+	if(idx < 0) {
+		idx = taskfuncs.entries.num_elements;
+		CoTaskFuncInfo *e = dynarray_append(&taskfuncs.entries);
+		*e = (CoTaskFuncInfo) {
+			.label = label ? label : "<unknown>",
+			.stack_class = stack_class,
+		};
+		ht_set(&taskfuncs.index_map, key, idx);
+	}
+
+	return idx;
+}
+
+INLINE CoTaskFuncInfo *taskfuncs_get(int idx) {
+	return dynarray_get_ptr(&taskfuncs.entries, idx);
+}
+
+// Returns a newly allocated array of all entries, sorted with the given comparator.
+static CoTaskFuncInfo **taskfuncs_sorted(int (*compare)(const void*, const void*)) {
+	uint num = taskfuncs.entries.num_elements;
+	CoTaskFuncInfo **sorted = calloc(num + 1, sizeof(*sorted));
+
+	for(uint i = 0; i < num; ++i) {
+		sorted[i] = taskfuncs_get(i);
+	}
+
+	if(num > 0) {
+		qsort(sorted, num, sizeof(*sorted), compare);
+	}
+
+	return sorted;
+}
+
+static void stack_profile_record(CoTask *task, size_t usage, size_t stack_size) {
+	if(task->func_index < 0 || usage == 0) {
+		return;
+	}
+
+	CoTaskFuncInfo *e = taskfuncs_get(task->func_index);
+	++e->stack.num_samples;
+
+	if(usage > e->stack.peak_usage) {
+		e->stack.peak_usage = usage;
+		e->stack.stack_size = stack_size;
+
+		if(usage >= stack_size) {
+			log_warn("Task %s has likely overflowed its stack (%zu bytes)", e->label, stack_size);
+		}
+	}
+}
+
+static int stack_profile_compare(const void *a, const void *b) {
+	const CoTaskFuncInfo *e1 = *(CoTaskFuncInfo *const *)a, *e2 = *(CoTaskFuncInfo *const *)b;
+	return (e1->stack.peak_usage < e2->stack.peak_usage) - (e1->stack.peak_usage > e2->stack.peak_usage);
+}
+
+static void stack_profile_report(void) {
+	uint num = taskfuncs.entries.num_elements;
+	CoTaskFuncInfo **sorted = taskfuncs_sorted(stack_profile_compare);
+
+	log_info("Coroutine stack profile (%u task functions, by peak usage):", num);
+
+	for(uint i = 0; i < num; ++i) {
+		CoTaskFuncInfo *e = sorted[i];
+
+		if(e->stack.num_samples == 0) {
+			continue;
+		}
+
+		CoStackClass rec = stack_class_for_usage(e->stack.peak_usage);
+
+		log_info("  %-40s %6zu / %6zu bytes, %6u runs; declared %s, recommended %s",
+			e->label, e->stack.peak_usage, e->stack.stack_size, e->stack.num_samples,
+			stack_class_names[e->stack_class],
+			rec < CO_NUM_STACK_CLASSES ? stack_class_names[rec] : "(none fits!)"
+		);
+	}
+
+	free(sorted);
+}
+
+/*
+ * Per-task-function accounting (TAISEI_COROUTINE_ACCOUNTING).
+ *
+ * Every resume is timed and attributed to the entry point of the task. Time
+ * spent in tasks that are resumed from within another task (e.g. by signaling
+ * an event) is subtracted from the outer one, so the numbers are exclusive.
+ * Counters are collected per logic frame (a cosched_run_tasks call), rolled up
+ * into per-stage totals, and appended to a file at the end of each stage.
+ */
+
+static int acct_compare_last_frame(const void *a, const void *b) {
+	const CoTaskFuncInfo *e1 = *(CoTaskFuncInfo *const *)a, *e2 = *(CoTaskFuncInfo *const *)b;
+	return (e1->acct.last_frame_time < e2->acct.last_frame_time) - (e1->acct.last_frame_time > e2->acct.last_frame_time);
+}
+
+static int acct_compare_stage(const void *a, const void *b) {
+	const CoTaskFuncInfo *e1 = *(CoTaskFuncInfo *const *)a, *e2 = *(CoTaskFuncInfo *const *)b;
+	return (e1->acct.stage_time < e2->acct.stage_time) - (e1->acct.stage_time > e2->acct.stage_time);
+}
+
+static void acct_end_frame(void) {
+	// only called between frames, where nothing can be nested
+	taskfuncs.nested_time = 0;
+
+	dynarray_foreach_elem(&taskfuncs.entries, CoTaskFuncInfo *e, {
+		e->acct.last_frame_time = e->acct.frame_time;
+		e->acct.last_frame_switches = e->acct.frame_switches;
+
+		if(e->acct.frame_switches) {
+			e->acct.stage_time += e->acct.frame_time;
+			e->acct.stage_switches += e->acct.frame_switches;
+			e->acct.stage_peak_frame_time = umax(e->acct.stage_peak_frame_time, e->acct.frame_time);
+			++e->acct.stage_frames_active;
+		}
+
+		e->acct.frame_time = 0;
+		e->acct.frame_switches = 0;
+	});
+}
+
+static double acct_msec(hrtime_t t) {
+	return t / (double)(HRTIME_RESOLUTION / 1000);
 }
 
-#else // CO_TASK_STATS_STACK
+void coroutines_accounting_stage_end(const char *stage_name) {
+	if(!taskfuncs.accounting) {
+		return;
+	}
+
+	acct_end_frame();
+
+	SDL_RWops *out = SDL_RWFromFile(taskfuncs.accounting_path, "a");
+
+	if(!out) {
+		log_error("Can't open %s for writing: %s", taskfuncs.accounting_path, SDL_GetError());
+	} else {
+		uint num = taskfuncs.entries.num_elements;
+		CoTaskFuncInfo **sorted = taskfuncs_sorted(acct_compare_stage);
+
+		SDL_RWprintf(out, "# %s\n", stage_name);
+		SDL_RWprintf(out, "task\ttotal_ms\tswitches\tframes_active\tpeak_frame_ms\n");
+
+		for(uint i = 0; i < num && sorted[i]->acct.stage_switches; ++i) {
+			CoTaskFuncInfo *e = sorted[i];
+			SDL_RWprintf(out, "%s\t%.3f\t%"PRIu64"\t%u\t%.4f\n",
+				e->label,
+				acct_msec(e->acct.stage_time),
+				e->acct.stage_switches,
+				e->acct.stage_frames_active,
+				acct_msec(e->acct.stage_peak_frame_time)
+			);
+		}
 
-static void setup_stack(CoTask *task) { }
-static void estimate_stack_usage(CoTask *task) { }
+		SDL_RWprintf(out, "\n");
+		SDL_RWclose(out);
+		free(sorted);
+	}
 
-#endif // CO_TASK_STATS_STACK
+	dynarray_foreach_elem(&taskfuncs.entries, CoTaskFuncInfo *e, {
+		memset(&e->acct, 0, sizeof(e->acct));
+	});
+}
 
 BoxedTask cotask_box(CoTask *task) {
 	return (BoxedTask) {
@@ -297,11 +563,17 @@ CoTask *cotask_unbox(BoxedTask box) {
 	return NULL;
 }
 
-static CoTask *cotask_new_internal(CoTaskFunc entry_point) {
+static void cosched_reschedule(CoTask *task);
+static void cosched_unpark(CoTask *task);
+
+static CoTask *cotask_new_internal(CoTaskFunc entry_point, CoStackClass stack_class) {
 	CoTask *task;
 	STAT_VAL_ADD(num_tasks_in_use, 1);
+	++costats.num_tasks_created;
+
+	assert((uint)stack_class < CO_NUM_STACK_CLASSES);
 
-	if((task = alist_pop(&task_pool))) {
+	if((task = alist_pop(&task_pools[stack_class]))) {
 		koishi_recycle(&task->ko, entry_point);
 		TASK_DEBUG(
 			"Recycled task %p, entry=%p (%zu tasks allocated / %zu in use)",
@@ -310,8 +582,10 @@ static CoTask *cotask_new_internal(CoTaskFunc entry_point) {
 		);
 	} else {
 		task = calloc(1, sizeof(*task));
-		koishi_init(&task->ko, CO_STACK_SIZE, entry_point);
+		task->stack_class = stack_class;
+		koishi_init(&task->ko, stack_class_sizes[stack_class], entry_point);
 		STAT_VAL_ADD(num_tasks_allocated, 1);
+		++costats.num_tasks_allocated;
 		TASK_DEBUG(
 			"Created new task %p, entry=%p (%zu tasks allocated / %zu in use)",
 			(void*)task, *(void**)&entry_point,
@@ -321,10 +595,17 @@ static CoTask *cotask_new_internal(CoTaskFunc entry_point) {
 
 	static uint32_t unique_counter = 0;
 	task->unique_id = ++unique_counter;
-	setup_stack(task);
 	assert(unique_counter != 0);
 
+	if(STACK_TRACKING_ENABLED) {
+		setup_stack(task);
+	}
+
 	task->data = NULL;
+	task->func_index = -1;
+	task->sched = NULL;
+	task->sched_list = NULL;
+	task->runqueue_index = -1;
 
 #ifdef CO_TASK_DEBUG
 	snprintf(task->debug_label, sizeof(task->debug_label), "<unknown at %p; entry=%p>", (void*)task, *(void**)&entry_point);
@@ -337,7 +618,24 @@ static void *cotask_resume_internal(CoTask *task, void *arg) {
 	TASK_DEBUG_EVENT(ev);
 	// TASK_DEBUG("[%zu] Resuming task %s", ev, task->debug_label);
 	STAT_VAL_ADD(num_switches_this_frame, 1);
-	arg = koishi_resume(&task->ko, arg);
+	++costats.num_switches;
+
+	if(UNLIKELY(taskfuncs.accounting) && task->func_index >= 0) {
+		hrtime_t outer_nested_time = taskfuncs.nested_time;
+		taskfuncs.nested_time = 0;
+		hrtime_t begin = time_get();
+
+		arg = koishi_resume(&task->ko, arg);
+
+		hrtime_t total = time_get() - begin;
+		CoTaskFuncInfo *e = taskfuncs_get(task->func_index);
+		e->acct.frame_time += total - taskfuncs.nested_time;
+		e->acct.frame_switches++;
+		taskfuncs.nested_time = outer_nested_time + total;
+	} else {
+		arg = koishi_resume(&task->ko, arg);
+	}
+
 	// TASK_DEBUG("[%zu] koishi_resume returned (%s)", ev, task->debug_label);
 	return arg;
 }
@@ -363,6 +661,86 @@ static void cancel_task_events(CoTaskData *task_data) {
 
 static void coevent_cleanup_subscribers(CoEvent *evt);
 
+static int coarena_size_class(size_t size) {
+	for(int c = 0; c < COARENA_NUM_CLASSES; ++c) {
+		if(size <= arena_page_sizes[c]) {
+			return c;
+		}
+	}
+
+	return COARENA_CLASS_OVERSIZED;
+}
+
+static CoArenaPage *coarena_get_page(CoArena *arena, int size_class, size_t size) {
+	CoArenaPage *page;
+
+	if(size_class == COARENA_CLASS_OVERSIZED) {
+		page = malloc(sizeof(*page) + size);
+	} else if((page = arena->free_pages[size_class])) {
+		arena->free_pages[size_class] = page->next;
+		size = arena_page_sizes[size_class];
+	} else {
+		size = arena_page_sizes[size_class];
+		page = malloc(sizeof(*page) + size);
+	}
+
+	page->next = NULL;
+	page->head = page->data;
+	page->end = page->data + size;
+	return page;
+}
+
+static void *coarena_alloc(CoArena *arena, CoArenaChain pages[COARENA_NUM_CLASSES + 1], size_t size) {
+	size = MEM_ALIGN_SIZE(size);
+	int size_class = coarena_size_class(size);
+	CoArenaChain *chain = pages + size_class;
+	CoArenaPage *page = chain->first;
+
+	if(!page || page->end - page->head < (ptrdiff_t)size) {
+		page = coarena_get_page(arena, size_class, size);
+		page->next = chain->first;
+		chain->first = page;
+
+		if(!chain->last) {
+			chain->last = page;
+		}
+	}
+
+	void *mem = page->head;
+	page->head += size;
+	return mem;
+}
+
+// Hand all pages of a task back to the arena; one splice per size class.
+static void coarena_release(CoArena *arena, CoArenaChain pages[COARENA_NUM_CLASSES + 1]) {
+	for(int c = 0; c < COARENA_NUM_CLASSES; ++c) {
+		CoArenaChain *chain = pages + c;
+
+		if(chain->first) {
+			chain->last->next = arena->free_pages[c];
+			arena->free_pages[c] = chain->first;
+		}
+	}
+
+	for(CoArenaPage *p = pages[COARENA_CLASS_OVERSIZED].first, *next; p; p = next) {
+		next = p->next;
+		free(p);
+	}
+
+	memset(pages, 0, sizeof(*pages) * (COARENA_NUM_CLASSES + 1));
+}
+
+static void coarena_free(CoArena *arena) {
+	for(int c = 0; c < COARENA_NUM_CLASSES; ++c) {
+		for(CoArenaPage *p = arena->free_pages[c], *next; p; p = next) {
+			next = p->next;
+			free(p);
+		}
+	}
+
+	memset(arena, 0, sizeof(*arena));
+}
+
 static void cotask_finalize(CoTask *task) {
 	CoTaskData *task_data = get_task_data(task);
 	TASK_DEBUG("Finalizing task %s", task->debug_label);
@@ -423,12 +801,7 @@ static void cotask_finalize(CoTask *task) {
 		TASK_DEBUG("DONE canceling slave tasks for %s", task->debug_label);
 	}
 
-	CoTaskHeapMemChunk *heap_alloc = task_data->mem.onheap_alloc_head;
-	while(heap_alloc) {
-		CoTaskHeapMemChunk *next = heap_alloc->next;
-		free(heap_alloc);
-		heap_alloc = next;
-	}
+	coarena_release(task_data->mem.arena, task_data->mem.pages);
 
 	task->data = NULL;
 	TASK_DEBUG("DONE finalizing task %s", task->debug_label);
@@ -453,7 +826,7 @@ static void cotask_entry_setup(CoTask *task, CoTaskData *data, CoTaskInitData *i
 	task->data = data;
 	data->task = task;
 
-	data->mem.onstack_alloc_head = data->mem.onstack_alloc_area;
+	data->mem.arena = init_data->arena;
 
 	CoTaskData *master_data = init_data->master_task_data;
 	if(master_data) {
@@ -499,9 +872,10 @@ static void *cotask_entry_noyield(void *varg) {
 }
 
 CoTask *cotask_new(CoTaskFunc func) {
-	CoTask *task = cotask_new_internal(cotask_entry);
+	CoTask *task = cotask_new_internal(cotask_entry, CO_STACK_DEFAULT);
 	CoTaskInitData init_data = { 0 };
 	init_data.task = task;
+	init_data.arena = &orphan_arena;
 	init_data.func = func;
 	cotask_resume_internal(task, &init_data);
 	assert(task->data != NULL);
@@ -515,11 +889,19 @@ void cotask_free(CoTask *task) {
 	);
 
 	assert(task->data == NULL);
+	assert(task->sched_list == NULL);
+	assert(task->runqueue_index < 0);
 
-	estimate_stack_usage(task);
+	task->sched = NULL;
+
+	if(STACK_TRACKING_ENABLED) {
+		size_t stack_size = 0;
+		size_t usage = estimate_stack_usage(task, &stack_size);
+		stack_profile_record(task, usage, stack_size);
+	}
 
 	task->unique_id = 0;
-	alist_push(&task_pool, task);
+	alist_push(&task_pools[task->stack_class], task);
 
 	STAT_VAL_ADD(num_tasks_in_use, -1);
 
@@ -544,6 +926,8 @@ static void cotask_force_cancel(CoTask *task) {
 	koishi_kill(&task->ko, NULL);
 	TASK_DEBUG("[%zu] koishi_kill returned (%s)", ev, task->debug_label);
 	assert(cotask_status(task) == CO_STATUS_DEAD);
+	// Only reached if task wasn't the active task; the resumer takes care of that case
+	cosched_reschedule(task);
 }
 
 bool cotask_cancel(CoTask *task) {
@@ -636,6 +1020,7 @@ static bool cotask_do_wait(CoTaskData *task_data) {
 
 void *cotask_resume(CoTask *task, void *arg) {
 	CoTaskData *task_data = get_task_data(task);
+	cosched_unpark(task);
 
 	if(task_data->bound_ent.ent && !ENT_UNBOX(task_data->bound_ent)) {
 		cotask_force_cancel(task);
@@ -643,10 +1028,13 @@ void *cotask_resume(CoTask *task, void *arg) {
 	}
 
 	if(!cotask_do_wait(task_data)) {
-		return cotask_wake_and_resume(task, arg);
+		arg = cotask_wake_and_resume(task, arg);
+		cosched_reschedule(task);
+		return arg;
 	}
 
 	assert(task_data->wait.wait_type != COTASK_WAIT_NONE);
+	cosched_reschedule(task);
 	return NULL;
 }
 
@@ -657,6 +1045,7 @@ void *cotask_yield(void *arg) {
 	TASK_DEBUG_EVENT(ev);
 	// TASK_DEBUG("[%zu] Yielding from task %s", ev, task->debug_label);
 	STAT_VAL_ADD(num_switches_this_frame, 1);
+	++costats.num_switches;
 	arg = koishi_yield(arg);
 	// TASK_DEBUG("[%zu] koishi_yield returned (%s)", ev, task->debug_label);
 	return arg;
@@ -689,41 +1078,24 @@ int cotask_wait(int delay) {
 	return cotask_wait_init(task_data, COTASK_WAIT_NONE).frames;
 }
 
-static void *_cotask_malloc(CoTaskData *task_data, size_t size, bool allow_heap_fallback) {
+static void *_cotask_malloc(CoTaskData *task_data, size_t size) {
 	assert(size > 0);
 	assert(size < PTRDIFF_MAX);
 
-	void *mem = NULL;
-	ptrdiff_t available_on_stack = (task_data->mem.onstack_alloc_area + sizeof(task_data->mem.onstack_alloc_area)) - task_data->mem.onstack_alloc_head;
-
-	if(available_on_stack >= (ptrdiff_t)size) {
-		log_debug("Requested size=%zu, available=%zi, serving from the stack", size, (ssize_t)available_on_stack);
-		mem = task_data->mem.onstack_alloc_head;
-		task_data->mem.onstack_alloc_head += MEM_ALIGN_SIZE(size);
-	} else {
-		if(!allow_heap_fallback) {
-			UNREACHABLE;
-		}
-
-		log_warn("Requested size=%zu, available=%zi, serving from the heap", size, (ssize_t)available_on_stack);
-		CoTaskHeapMemChunk *chunk = calloc(1, sizeof(*chunk) + size);
-		chunk->next = task_data->mem.onheap_alloc_head;
-		task_data->mem.onheap_alloc_head = chunk;
-		mem = chunk->data;
-	}
-
+	void *mem = coarena_alloc(task_data->mem.arena, task_data->mem.pages, size);
+	memset(mem, 0, size);
 	return ASSUME_ALIGNED(mem, MEM_ALLOC_ALIGNMENT);
 }
 
 void *cotask_malloc(CoTask *task, size_t size) {
 	CoTaskData *task_data = get_task_data(task);
-	return _cotask_malloc(task_data, size, true);
+	return _cotask_malloc(task_data, size);
 }
 
 EntityInterface *cotask_host_entity(CoTask *task, size_t ent_size, EntityType ent_type) {
 	CoTaskData *task_data = get_task_data(task);
 	assume(task_data->hosted.ent == NULL);
-	EntityInterface *ent = _cotask_malloc(task_data, ent_size, false);
+	EntityInterface *ent = _cotask_malloc(task_data, ent_size);
 	ent_register(ent, ent_type);
 	task_data->hosted.ent = ent;
 	return ent;
@@ -739,26 +1111,154 @@ void cotask_host_events(CoTask *task, uint num_events, CoEvent events[num_events
 	_coevent_array_action(num_events, events, coevent_init);
 }
 
-static bool subscribers_array_predicate(const void *pelem, void *userdata) {
-	return cotask_unbox(*(const BoxedTask*)pelem);
+/*
+ * Subscriber arrays that outgrow the inline storage of a CoEvent are carved
+ * from slab chunks, in power-of-two size classes. Freed arrays go onto a per-
+ * class free list and are only given back on coroutines_shutdown. The biggest
+ * arrays bypass the slab entirely.
+ */
+
+#define SUBSLAB_MIN_CAPACITY 4
+#define SUBSLAB_NUM_CLASSES 5  // up to 64 subscribers
+#define SUBSLAB_CHUNK_SIZE 4096
+
+typedef union SubSlabBlock {
+	union SubSlabBlock *next_free;
+	BoxedTask subscribers[SUBSLAB_MIN_CAPACITY];
+} SubSlabBlock;
+
+static struct {
+	SubSlabBlock *free_blocks[SUBSLAB_NUM_CLASSES];
+	DYNAMIC_ARRAY(char*) chunks;
+	char *chunk_pos;
+	char *chunk_end;
+} subscriber_slab;
+
+static int subslab_class(uint capacity) {
+	assert(capacity >= SUBSLAB_MIN_CAPACITY);
+	assert(capacity == topow2_u32(capacity));
+
+	int c = 0;
+
+	for(uint cap = SUBSLAB_MIN_CAPACITY; cap < capacity; cap <<= 1) {
+		++c;
+	}
+
+	return c;
+}
+
+static BoxedTask *subslab_alloc(uint capacity) {
+	int c = subslab_class(capacity);
+
+	if(c >= SUBSLAB_NUM_CLASSES) {
+		return calloc(capacity, sizeof(BoxedTask));
+	}
+
+	SubSlabBlock *block = subscriber_slab.free_blocks[c];
+
+	if(block) {
+		subscriber_slab.free_blocks[c] = block->next_free;
+		return block->subscribers;
+	}
+
+	size_t size = capacity * sizeof(BoxedTask);
+	assert(subscriber_slab.chunk_end >= subscriber_slab.chunk_pos);
+
+	if((size_t)(subscriber_slab.chunk_end - subscriber_slab.chunk_pos) < size) {
+		// the tail of the old chunk is wasted, but it's less than a block
+		char *chunk = calloc(1, SUBSLAB_CHUNK_SIZE);
+		*dynarray_append(&subscriber_slab.chunks) = chunk;
+		subscriber_slab.chunk_pos = chunk;
+		subscriber_slab.chunk_end = chunk + SUBSLAB_CHUNK_SIZE;
+	}
+
+	block = CASTPTR_ASSUME_ALIGNED(subscriber_slab.chunk_pos, SubSlabBlock);
+	subscriber_slab.chunk_pos += size;
+	return block->subscribers;
+}
+
+static void subslab_free(BoxedTask *subscribers, uint capacity) {
+	int c = subslab_class(capacity);
+
+	if(c >= SUBSLAB_NUM_CLASSES) {
+		free(subscribers);
+		return;
+	}
+
+	SubSlabBlock *block = CASTPTR_ASSUME_ALIGNED(subscribers, SubSlabBlock);
+	block->next_free = subscriber_slab.free_blocks[c];
+	subscriber_slab.free_blocks[c] = block;
+}
+
+static void subslab_shutdown(void) {
+	dynarray_foreach_elem(&subscriber_slab.chunks, char **chunk, {
+		free(*chunk);
+	});
+
+	dynarray_free_data(&subscriber_slab.chunks);
+	memset(&subscriber_slab, 0, sizeof(subscriber_slab));
+}
+
+INLINE BoxedTask *coevent_subscribers(CoEvent *evt) {
+	if(evt->num_subscribers_allocated <= COEVENT_INLINE_SUBSCRIBERS) {
+		return evt->inline_subscribers;
+	}
+
+	return evt->subscribers;
+}
+
+static void coevent_free_subscribers(CoEvent *evt) {
+	if(evt->num_subscribers_allocated > COEVENT_INLINE_SUBSCRIBERS) {
+		subslab_free(evt->subscribers, evt->num_subscribers_allocated);
+	}
+
+	evt->num_subscribers = 0;
+	evt->num_subscribers_allocated = 0;
 }
 
 static void coevent_cleanup_subscribers(CoEvent *evt) {
-	if(evt->subscribers.num_elements == 0) {
+	if(evt->num_subscribers == 0) {
 		return;
 	}
 
-	attr_unused uint prev_num_subs = evt->subscribers.num_elements;
-	dynarray_filter(&evt->subscribers, subscribers_array_predicate, NULL);
-	attr_unused uint new_num_subs = evt->subscribers.num_elements;
-	EVT_DEBUG("Event %p num subscribers %u -> %u", (void*)evt, prev_num_subs, new_num_subs);
+	BoxedTask *subs = coevent_subscribers(evt);
+	attr_unused uint prev_num_subs = evt->num_subscribers;
+	uint num_subs = 0;
+
+	for(uint i = 0; i < prev_num_subs; ++i) {
+		if(cotask_unbox(subs[i])) {
+			subs[num_subs++] = subs[i];
+		}
+	}
+
+	evt->num_subscribers = num_subs;
+	EVT_DEBUG("Event %p num subscribers %u -> %u", (void*)evt, prev_num_subs, num_subs);
 }
 
 static void coevent_add_subscriber(CoEvent *evt, CoTask *task) {
 	EVT_DEBUG("Event %p (num_subscribers=%u; num_subscribers_allocated=%u)", (void*)evt, evt->num_subscribers, evt->num_subscribers_allocated);
 	EVT_DEBUG("Subscriber: %s", task->debug_label);
 
-	*dynarray_append_with_min_capacity(&evt->subscribers, 4) = cotask_box(task);
+	if(evt->num_subscribers == evt->num_subscribers_allocated) {
+		uint old_capacity = evt->num_subscribers_allocated;
+
+		if(old_capacity < COEVENT_INLINE_SUBSCRIBERS) {
+			evt->num_subscribers_allocated = COEVENT_INLINE_SUBSCRIBERS;
+		} else {
+			uint new_capacity = umax(SUBSLAB_MIN_CAPACITY, old_capacity * 2);
+			BoxedTask *new_subs = subslab_alloc(new_capacity);
+			memcpy(new_subs, coevent_subscribers(evt), sizeof(*new_subs) * evt->num_subscribers);
+
+			if(old_capacity > COEVENT_INLINE_SUBSCRIBERS) {
+				subslab_free(evt->subscribers, old_capacity);
+			}
+
+			evt->subscribers = new_subs;
+			evt->num_subscribers_allocated = new_capacity;
+		}
+	}
+
+	coevent_subscribers(evt)[evt->num_subscribers++] = cotask_box(task);
 }
 
 static CoWaitResult cotask_wait_event_internal(CoEvent *evt) {
@@ -855,10 +1355,10 @@ void coevent_signal(CoEvent *evt) {
 	EVT_DEBUG("Signal event %p (uid = %u; num_signaled = %u)", (void*)evt, evt->unique_id, evt->num_signaled);
 	assert(evt->num_signaled != 0);
 
-	if(evt->subscribers.num_elements) {
-		BoxedTask subs_snapshot[evt->subscribers.num_elements];
-		memcpy(subs_snapshot, evt->subscribers.data, sizeof(subs_snapshot));
-		evt->subscribers.num_elements = 0;
+	if(evt->num_subscribers) {
+		BoxedTask subs_snapshot[evt->num_subscribers];
+		memcpy(subs_snapshot, coevent_subscribers(evt), sizeof(subs_snapshot));
+		evt->num_subscribers = 0;
 		coevent_wake_subscribers(evt, ARRAY_SIZE(subs_snapshot), subs_snapshot);
 	}
 }
@@ -878,18 +1378,18 @@ void coevent_cancel(CoEvent *evt) {
 	}
 
 	EVT_DEBUG("[%lu] BEGIN Cancel event %p (uid = %u; num_signaled = %u)", ev,  (void*)evt, evt->unique_id, evt->num_signaled);
-	EVT_DEBUG("[%lu] SUBS = %p", ev,  (void*)evt->subscribers);
+	EVT_DEBUG("[%lu] SUBS = %p", ev,  (void*)coevent_subscribers(evt));
 	evt->num_signaled = 0;
 	evt->unique_id = 0;
 
-	if(evt->subscribers.num_elements) {
-		BoxedTask subs_snapshot[evt->subscribers.num_elements];
-		memcpy(subs_snapshot, evt->subscribers.data, sizeof(subs_snapshot));
-		dynarray_free_data(&evt->subscribers);
+	if(evt->num_subscribers) {
+		BoxedTask subs_snapshot[evt->num_subscribers];
+		memcpy(subs_snapshot, coevent_subscribers(evt), sizeof(subs_snapshot));
+		coevent_free_subscribers(evt);
 		coevent_wake_subscribers(evt, ARRAY_SIZE(subs_snapshot), subs_snapshot);
 		// CAUTION: no modifying evt after this point, it may be invalidated
 	} else {
-		dynarray_free_data(&evt->subscribers);
+		coevent_free_subscribers(evt);
 	}
 
 	EVT_DEBUG("[%lu] END Cancel event %p", ev, (void*)evt);
@@ -905,8 +1405,222 @@ void cosched_init(CoSched *sched) {
 	memset(sched, 0, sizeof(*sched));
 }
 
-CoTask *_cosched_new_task(CoSched *sched, CoTaskFunc func, void *arg, bool is_subtask, CoTaskDebugInfo debug) {
-	CoTask *task = cotask_new_internal(cotask_entry_noyield);
+static inline bool cosched_runs_before(CoTask *a, CoTask *b) {
+	return a->seq < b->seq;
+}
+
+static void cosched_runqueue_place(CoSched *sched, int idx, CoTask *task) {
+	sched->runqueue.data[idx] = task;
+	task->runqueue_index = idx;
+}
+
+static void cosched_runqueue_sift_up(CoSched *sched, int idx) {
+	CoTask *task = sched->runqueue.data[idx];
+
+	while(idx > 0) {
+		int parent = (idx - 1) / 2;
+		CoTask *p = sched->runqueue.data[parent];
+
+		if(!cosched_runs_before(task, p)) {
+			break;
+		}
+
+		cosched_runqueue_place(sched, idx, p);
+		idx = parent;
+	}
+
+	cosched_runqueue_place(sched, idx, task);
+}
+
+static void cosched_runqueue_sift_down(CoSched *sched, int idx) {
+	int num = sched->runqueue.num_elements;
+	CoTask *task = sched->runqueue.data[idx];
+
+	for(;;) {
+		int child = idx * 2 + 1;
+
+		if(child >= num) {
+			break;
+		}
+
+		if(child + 1 < num && cosched_runs_before(sched->runqueue.data[child + 1], sched->runqueue.data[child])) {
+			++child;
+		}
+
+		if(!cosched_runs_before(sched->runqueue.data[child], task)) {
+			break;
+		}
+
+		cosched_runqueue_place(sched, idx, sched->runqueue.data[child]);
+		idx = child;
+	}
+
+	cosched_runqueue_place(sched, idx, task);
+}
+
+static void cosched_runqueue_push(CoSched *sched, CoTask *task) {
+	assert(task->runqueue_index < 0);
+	*dynarray_append(&sched->runqueue) = task;
+	cosched_runqueue_sift_up(sched, sched->runqueue.num_elements - 1);
+}
+
+static void cosched_runqueue_remove(CoSched *sched, CoTask *task) {
+	int idx = task->runqueue_index;
+	assert(idx >= 0 && idx < sched->runqueue.num_elements);
+	assert(sched->runqueue.data[idx] == task);
+
+	task->runqueue_index = -1;
+	CoTask *last = sched->runqueue.data[--sched->runqueue.num_elements];
+
+	if(last != task) {
+		cosched_runqueue_place(sched, idx, last);
+		cosched_runqueue_sift_down(sched, idx);
+		cosched_runqueue_sift_up(sched, last->runqueue_index);
+	}
+}
+
+static CoTask *cosched_runqueue_pop(CoSched *sched) {
+	if(sched->runqueue.num_elements == 0) {
+		return NULL;
+	}
+
+	CoTask *task = sched->runqueue.data[0];
+	cosched_runqueue_remove(sched, task);
+	return task;
+}
+
+static void cosched_park(CoSched *sched, CoTask *task, CoTaskList *list) {
+	alist_append(list, task);
+	task->sched_list = list;
+}
+
+static void cosched_unlink(CoSched *sched, CoTask *task) {
+	if(task->sched_list) {
+		alist_unlink(task->sched_list, task);
+		task->sched_list = NULL;
+	} else if(task->runqueue_index >= 0) {
+		cosched_runqueue_remove(sched, task);
+	}
+}
+
+// Make the task run in the given pass, in its creation order.
+static void cosched_schedule(CoSched *sched, CoTask *task, uint32_t pass) {
+	uint32_t delta = pass - sched->pass;
+
+	if(delta == 0) {
+		assert(sched->in_pass);
+		cosched_runqueue_push(sched, task);
+	} else if(delta < COSCHED_WHEEL_SIZE) {
+		cosched_park(sched, task, &sched->wheel[pass & (COSCHED_WHEEL_SIZE - 1)]);
+	} else if(delta < COSCHED_WHEEL_SIZE * COSCHED_WHEEL_L1_SIZE) {
+		cosched_park(sched, task, &sched->wheel_l1[(pass >> COSCHED_WHEEL_BITS) & (COSCHED_WHEEL_L1_SIZE - 1)]);
+	} else {
+		cosched_park(sched, task, &sched->wheel_overflow);
+	}
+
+	// only needed to re-slot the task when the wheel cascades
+	task->park_pass = pass;
+}
+
+static void cosched_cascade(CoSched *sched, CoTaskList *list) {
+	CoTaskList tasks = *list;
+	memset(list, 0, sizeof(*list));
+
+	for(CoTask *task; (task = alist_pop(&tasks));) {
+		task->sched_list = NULL;
+		cosched_schedule(sched, task, task->park_pass);
+	}
+}
+
+/*
+ * The pass in which the scheduler would next look at this task, if it were
+ * visiting every task: later in the current pass if it hasn't got to it yet,
+ * otherwise in the next one.
+ */
+static uint32_t cosched_next_visit(CoSched *sched, CoTask *task) {
+	if(sched->in_pass && task->seq > sched->cursor && task->first_pass <= sched->pass) {
+		return sched->pass;
+	}
+
+	return sched->pass + 1;
+}
+
+/*
+ * Called whenever a task returns control to whoever resumed it, or gets killed.
+ * Decides where the task waits until it needs to be looked at again.
+ */
+static void cosched_reschedule(CoTask *task) {
+	CoSched *sched = task->sched;
+
+	if(!sched) {
+		return;
+	}
+
+	cosched_unlink(sched, task);
+	uint32_t visit = cosched_next_visit(sched, task);
+
+	if(cotask_status(task) == CO_STATUS_DEAD) {
+		// will be freed then
+		cosched_schedule(sched, task, visit);
+		return;
+	}
+
+	CoTaskData *task_data = get_task_data(task);
+
+	if(task_data->bound_ent.ent) {
+		// the entity may die at any time, so this has to be checked on every visit
+		cosched_schedule(sched, task, visit);
+		return;
+	}
+
+	switch(task_data->wait.wait_type) {
+		case COTASK_WAIT_DELAY: {
+			// Account for the visits that are skipped up front; the task can't observe them.
+			int remaining = task_data->wait.delay.remaining;
+			assert(remaining >= 0);
+			task_data->wait.result.frames += remaining;
+			task_data->wait.delay.remaining = 0;
+			cosched_schedule(sched, task, visit + remaining);
+			break;
+		}
+
+		case COTASK_WAIT_EVENT: {
+			task->park_pass = visit;
+			cosched_park(sched, task, &sched->sleeping);
+			break;
+		}
+
+		default: {
+			cosched_schedule(sched, task, visit);
+			break;
+		}
+	}
+}
+
+// Called before an event subscriber is resumed.
+static void cosched_unpark(CoTask *task) {
+	CoSched *sched = task->sched;
+
+	if(!sched || task->sched_list != &sched->sleeping) {
+		return;
+	}
+
+	alist_unlink(&sched->sleeping, task);
+	task->sched_list = NULL;
+
+	// count the visits this task would have received while it was asleep
+	get_task_data(task)->wait.result.frames += cosched_next_visit(sched, task) - task->park_pass;
+}
+
+CoTask *_cosched_new_task(CoSched *sched, CoTaskFunc func, void *arg, bool is_subtask, CoStackClass stack_class, CoTaskDebugInfo debug) {
+	CoTask *task = cotask_new_internal(cotask_entry_noyield, stack_class);
+	task->seq = ++sched->num_created;
+	task->first_pass = sched->pass + 1;
+	assert(sched->num_created != 0);
+
+	if(taskfuncs.profile_stack || taskfuncs.accounting) {
+		task->func_index = taskfuncs_get_index(func, debug.label, stack_class);
+	}
 
 #ifdef CO_TASK_DEBUG
 	snprintf(task->debug_label, sizeof(task->debug_label), "#%i <%p> %s (%s:%i:%s)", task->unique_id, (void*)task, debug.label, debug.debug_info.file, debug.debug_info.line, debug.debug_info.func);
@@ -914,6 +1628,7 @@ CoTask *_cosched_new_task(CoSched *sched, CoTaskFunc func, void *arg, bool is_su
 
 	CoTaskInitData init_data = { 0 };
 	init_data.task = task;
+	init_data.arena = &sched->arena;
 	init_data.func = func;
 	init_data.func_arg = arg;
 
@@ -922,26 +1637,46 @@ CoTask *_cosched_new_task(CoSched *sched, CoTaskFunc func, void *arg, bool is_su
 		assert(init_data.master_task_data != NULL);
 	}
 
-	alist_append(&sched->pending_tasks, task);
 	cotask_resume_internal(task, &init_data);
 
 	assert(cotask_status(task) == CO_STATUS_SUSPENDED || cotask_status(task) == CO_STATUS_DEAD);
 
+	// not set earlier, so that a cancellation during the first run doesn't schedule it prematurely
+	task->sched = sched;
+	cosched_reschedule(task);
+
 	return task;
 }
 
 uint cosched_run_tasks(CoSched *sched) {
-	alist_merge_tail(&sched->tasks, &sched->pending_tasks);
+	PROFILE_ZONE_BEGIN(z, "cosched_run_tasks");
+
+	if(taskfuncs.accounting) {
+		acct_end_frame();
+	}
+
+	uint32_t pass = ++sched->pass;
+	sched->in_pass = true;
+	sched->cursor = 0;
+
+	if(!(pass & (COSCHED_WHEEL_SIZE - 1))) {
+		if(!(pass & (COSCHED_WHEEL_SIZE * COSCHED_WHEEL_L1_SIZE - 1))) {
+			cosched_cascade(sched, &sched->wheel_overflow);
+		}
+
+		cosched_cascade(sched, &sched->wheel_l1[(pass >> COSCHED_WHEEL_BITS) & (COSCHED_WHEEL_L1_SIZE - 1)]);
+	}
+
+	cosched_cascade(sched, &sched->wheel[pass & (COSCHED_WHEEL_SIZE - 1)]);
 
 	uint ran = 0;
 
 	TASK_DEBUG("---------------------------------------------------------------");
-	for(CoTask *t = sched->tasks.first, *next; t; t = next) {
-		next = t->next;
+	for(CoTask *t; (t = cosched_runqueue_pop(sched));) {
+		sched->cursor = t->seq;
 
 		if(cotask_status(t) == CO_STATUS_DEAD) {
 			TASK_DEBUG("<!> %s", t->debug_label);
-			alist_unlink(&sched->tasks, t);
 			cotask_free(t);
 		} else {
 			TASK_DEBUG(">>> %s", t->debug_label);
@@ -952,6 +1687,9 @@ uint cosched_run_tasks(CoSched *sched) {
 	}
 	TASK_DEBUG("---------------------------------------------------------------");
 
+	sched->in_pass = false;
+
+	PROFILE_ZONE_END(z);
 	return ran;
 }
 
@@ -968,49 +1706,147 @@ static void force_finish_task(CoTask *task) {
 	cotask_free(task);
 }
 
-static void pre_finish_task_list(CoTaskList *tasks) {
-	for(CoTask *t = tasks->first; t; t = t->next) {
-		if(t->data) {
-			cancel_task_events(t->data);
-		}
+typedef DYNAMIC_ARRAY(CoTask*) CoTaskArray;
+
+static void collect_task_list(CoTaskArray *out, CoTaskList *tasks) {
+	for(CoTask *t; (t = alist_pop(tasks));) {
+		t->sched_list = NULL;
+		*dynarray_append(out) = t;
 	}
 }
 
-static void finish_task_list(CoTaskList *tasks) {
-	for(CoTask *t; (t = alist_pop(tasks));) {
-		force_finish_task(t);
+static int compare_tasks_by_seq(const void *a, const void *b) {
+	const CoTask *t1 = *(CoTask *const *)a;
+	const CoTask *t2 = *(CoTask *const *)b;
+	return (t1->seq > t2->seq) - (t1->seq < t2->seq);
+}
+
+// Take all tasks out of the scheduler, in creation order.
+static void collect_tasks(CoSched *sched, CoTaskArray *out) {
+	out->num_elements = 0;
+
+	for(CoTask *t; (t = cosched_runqueue_pop(sched));) {
+		*dynarray_append(out) = t;
+	}
+
+	for(int i = 0; i < COSCHED_WHEEL_SIZE; ++i) {
+		collect_task_list(out, &sched->wheel[i]);
+	}
+
+	for(int i = 0; i < COSCHED_WHEEL_L1_SIZE; ++i) {
+		collect_task_list(out, &sched->wheel_l1[i]);
+	}
+
+	collect_task_list(out, &sched->wheel_overflow);
+	collect_task_list(out, &sched->sleeping);
+
+	if(out->num_elements > 1) {
+		qsort(out->data, out->num_elements, sizeof(*out->data), compare_tasks_by_seq);
 	}
 }
 
 void cosched_finish(CoSched *sched) {
-	pre_finish_task_list(&sched->tasks);
-	pre_finish_task_list(&sched->pending_tasks);
-	finish_task_list(&sched->tasks);
-	finish_task_list(&sched->pending_tasks);
-	assert(!sched->tasks.first);
-	assert(!sched->pending_tasks.first);
+	CoTaskArray tasks = { 0 };
+	collect_tasks(sched, &tasks);
+
+	dynarray_foreach_elem(&tasks, CoTask **t, {
+		if((*t)->data) {
+			cancel_task_events((*t)->data);
+		}
+	});
+
+	// Tasks woken up above may have been rescheduled, and may have spawned new ones.
+	while(tasks.num_elements > 0) {
+		dynarray_foreach_elem(&tasks, CoTask **t, {
+			cosched_unlink(sched, *t);
+			force_finish_task(*t);
+		});
+
+		collect_tasks(sched, &tasks);
+	}
+
+	dynarray_free_data(&tasks);
+	dynarray_free_data(&sched->runqueue);
+	coarena_free(&sched->arena);
 	memset(sched, 0, sizeof(*sched));
 }
 
 void coroutines_init(void) {
+	ht_create(&taskfuncs.index_map);
+
+	if(env_get("TAISEI_COROUTINE_STACK_PROFILE", false)) {
+		taskfuncs.profile_stack = true;
+		log_info("Coroutine stack profiling enabled");
+	}
+
+	const char *acct_path = env_get("TAISEI_COROUTINE_ACCOUNTING", NULL);
 
+	if(acct_path && *acct_path) {
+		taskfuncs.accounting = true;
+		taskfuncs.accounting_path = strdup(acct_path);
+		log_info("Coroutine accounting enabled, stage reports will be appended to %s", acct_path);
+	}
+}
+
+void coroutines_get_stats(CoStats *stats) {
+	*stats = costats;
 }
 
 void coroutines_shutdown(void) {
-	for(CoTask *task; (task = alist_pop(&task_pool));) {
-		koishi_deinit(&task->ko);
-		free(task);
+	for(CoStackClass c = 0; c < CO_NUM_STACK_CLASSES; ++c) {
+		for(CoTask *task; (task = alist_pop(&task_pools[c]));) {
+			koishi_deinit(&task->ko);
+			free(task);
+		}
+	}
+
+	coarena_free(&orphan_arena);
+	subslab_shutdown();
+
+	if(taskfuncs.profile_stack) {
+		stack_profile_report();
 	}
+
+	ht_destroy(&taskfuncs.index_map);
+	dynarray_free_data(&taskfuncs.entries);
+	free(taskfuncs.accounting_path);
+	memset(&taskfuncs, 0, sizeof(taskfuncs));
 }
 
-#ifdef CO_TASK_STATS
 #include "video.h"
 #include "resource/font.h"
-#endif
+
+static void acct_draw_overlay(TextParams *tp, float ls) {
+	enum { MAX_ROWS = 16 };
+
+	CoTaskFuncInfo **sorted = taskfuncs_sorted(acct_compare_last_frame);
+	hrtime_t total = 0;
+	char buf[128];
+
+	dynarray_foreach_elem(&taskfuncs.entries, CoTaskFuncInfo *e, {
+		total += e->acct.last_frame_time;
+	});
+
+	tp->pos.y += ls;
+	snprintf(buf, sizeof(buf), "Tasks this frame: %.3fms ", acct_msec(total));
+	text_draw(buf, tp);
+
+	for(uint i = 0; i < MAX_ROWS && sorted[i] && sorted[i]->acct.last_frame_switches; ++i) {
+		CoTaskFuncInfo *e = sorted[i];
+		tp->pos.y += ls;
+		snprintf(buf, sizeof(buf), "%s %7.3fms %4u ", e->label, acct_msec(e->acct.last_frame_time), e->acct.last_frame_switches);
+		text_draw(buf, tp);
+	}
+
+	free(sorted);
+}
 
 void coroutines_draw_stats(void) {
-#ifdef CO_TASK_STATS
-	static char buf[128];
+#ifndef CO_TASK_STATS
+	if(!taskfuncs.accounting) {
+		return;
+	}
+#endif
 
 	TextParams tp = {
 		.pos = { SCREEN_W },
@@ -1022,6 +1858,9 @@ void coroutines_draw_stats(void) {
 
 	float ls = font_get_lineskip(tp.font_ptr);
 
+#ifdef CO_TASK_STATS
+	static char buf[128];
+
 	tp.pos.y += ls;
 	snprintf(buf, sizeof(buf), "Peak stack: %zukb    Tasks: %4zu / %4zu ",
 		STAT_VAL(peak_stack_usage) / 1024,
@@ -1036,6 +1875,10 @@ void coroutines_draw_stats(void) {
 
 	STAT_VAL_SET(num_switches_this_frame, 0);
 #endif
+
+	if(taskfuncs.accounting) {
+		acct_draw_overlay(&tp, ls);
+	}
 }
 
 DEFINE_EXTERN_TASK(_cancel_task_helper) {
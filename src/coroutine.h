@@ -43,11 +43,17 @@ typedef struct BoxedTask {
 	uint32_t unique_id;
 } BoxedTask;
 
+#define COEVENT_INLINE_SUBSCRIBERS 1
+
 typedef struct CoEvent {
-	// ListAnchor subscribers;
-	// FIXME: Is there a better way than a dynamic array?
-	// An intrusive linked list just isn't robust enough.
-	DYNAMIC_ARRAY(BoxedTask) subscribers;
+	// Most events have at most one waiter, which is stored inline. Larger
+	// subscriber arrays are carved from a shared slab (see coroutine.c).
+	union {
+		BoxedTask inline_subscribers[COEVENT_INLINE_SUBSCRIBERS];
+		BoxedTask *subscribers;
+	};
+	uint32_t num_subscribers;
+	uint32_t num_subscribers_allocated;
 	uint32_t unique_id;
 	uint32_t num_signaled;
 } CoEvent;
@@ -69,8 +75,54 @@ typedef COEVENTS_ARRAY(
 
 typedef LIST_ANCHOR(CoTask) CoTaskList;
 
+/*
+ * Memory handed out by TASK_MALLOC, TASK_HOST_ENT and TASK_HOST_EVENTS comes
+ * from pages owned by the scheduler. A task bump-allocates from its own pages,
+ * one chain per size class, and hands them all back to the scheduler's free
+ * lists at once when it finishes. Pages are only returned to the system by
+ * cosched_finish.
+ */
+#define COARENA_NUM_CLASSES 3
+
+typedef struct CoArenaPage CoArenaPage;
+
+typedef struct CoArena {
+	CoArenaPage *free_pages[COARENA_NUM_CLASSES];
+} CoArena;
+
+#define COSCHED_WHEEL_BITS 8
+#define COSCHED_WHEEL_SIZE (1 << COSCHED_WHEEL_BITS)        // level 0: one slot per pass
+#define COSCHED_WHEEL_L1_BITS 6
+#define COSCHED_WHEEL_L1_SIZE (1 << COSCHED_WHEEL_L1_BITS)  // level 1: one slot per COSCHED_WHEEL_SIZE passes
+
+/*
+ * The scheduler only visits tasks that have something to do in the current
+ * pass (one cosched_run_tasks call): tasks that just yielded, tasks whose WAIT
+ * delay runs out, tasks bound to an entity (which have to notice its death),
+ * and dead tasks waiting to be freed. Tasks sleeping in WAIT are parked in a
+ * hierarchical timer wheel until they're due; tasks waiting for an event are
+ * parked until the event wakes them up through its subscriber list.
+ *
+ * Within a pass, tasks are run in the order they were created, exactly as if
+ * every task were visited. Replays depend on this.
+ */
 struct CoSched {
-	CoTaskList tasks, pending_tasks;
+	uint32_t pass;       // number of passes started so far
+	uint32_t cursor;     // creation index of the task the current pass is at
+	uint32_t num_created;
+	bool in_pass;
+
+	// tasks still to be run in the current pass; a binary min-heap ordered by creation index
+	DYNAMIC_ARRAY(CoTask*) runqueue;
+
+	CoTaskList wheel[COSCHED_WHEEL_SIZE];
+	CoTaskList wheel_l1[COSCHED_WHEEL_L1_SIZE];
+	CoTaskList wheel_overflow;
+
+	// tasks waiting for an event
+	CoTaskList sleeping;
+
+	CoArena arena;
 };
 
 typedef struct CoWaitResult {
@@ -86,13 +138,46 @@ typedef struct CoTaskDebugInfo {
 
 #define COTASK_DEBUG_INFO(label) ((CoTaskDebugInfo) { (label), _DEBUG_INFO_INITIALIZER_ })
 #else
-typedef char CoTaskDebugInfo;
-#define COTASK_DEBUG_INFO(label) (0)
+typedef struct CoTaskDebugInfo {
+	const char *label;
+} CoTaskDebugInfo;
+
+#define COTASK_DEBUG_INFO(label) ((CoTaskDebugInfo) { (label) })
 #endif
 
+/*
+ * Coroutine stack sizes. A task picks its class when it's declared (see
+ * TASK_WITH_STACK); everything else gets CO_STACK_DEFAULT. Stacks of each class
+ * are recycled separately, so a small task never pins a large stack.
+ *
+ * To find out which class a task actually needs, run the game with
+ * TAISEI_COROUTINE_STACK_PROFILE=1. Peak stack usage will then be measured for
+ * every task function, and logged on exit together with the smallest class that
+ * fits it with a safety margin.
+ */
+typedef enum CoStackClass {
+	CO_STACK_SMALL,   //  8 KiB
+	CO_STACK_MEDIUM,  // 16 KiB
+	CO_STACK_LARGE,   // 64 KiB
+
+	CO_NUM_STACK_CLASSES,
+	CO_STACK_DEFAULT = CO_STACK_LARGE,
+} CoStackClass;
+
+typedef struct CoStats {
+	size_t num_switches;        // resumes + yields
+	size_t num_tasks_created;
+	size_t num_tasks_allocated; // tasks that couldn't be recycled and needed a new stack
+} CoStats;
+
 void coroutines_init(void);
 void coroutines_shutdown(void);
 void coroutines_draw_stats(void);
+void coroutines_get_stats(CoStats *stats) attr_nonnull(1);
+
+// Appends this stage's per-task-function accounting to the file named by
+// TAISEI_COROUTINE_ACCOUNTING, if set, and resets the counters.
+void coroutines_accounting_stage_end(const char *stage_name) attr_nonnull(1);
 
 CoTask *cotask_new(CoTaskFunc func);
 void cotask_free(CoTask *task);
@@ -114,6 +199,7 @@ void cotask_host_events(CoTask *task, uint num_events, CoEvent events[num_events
 BoxedTask cotask_box(CoTask *task);
 CoTask *cotask_unbox(BoxedTask box);
 
+// Waiters are only woken by coevent_signal/coevent_cancel; cancel an event before re-initializing it.
 void coevent_init(CoEvent *evt);
 void coevent_signal(CoEvent *evt);
 void coevent_signal_once(CoEvent *evt);
@@ -128,9 +214,9 @@ void _coevent_array_action(uint num, CoEvent *events, void (*func)(CoEvent*));
 #define COEVENT_CANCEL_ARRAY(array) COEVENT_ARRAY_ACTION(coevent_cancel, array)
 
 void cosched_init(CoSched *sched);
-CoTask *_cosched_new_task(CoSched *sched, CoTaskFunc func, void *arg, bool is_subtask, CoTaskDebugInfo debug);  // creates and runs the task, schedules it for resume on cosched_run_tasks if it's still alive
-#define cosched_new_task(sched, func, arg, debug_label) _cosched_new_task(sched, func, arg, false, COTASK_DEBUG_INFO(debug_label))
-#define cosched_new_subtask(sched, func, arg, debug_label) _cosched_new_task(sched, func, arg, true, COTASK_DEBUG_INFO(debug_label))
+CoTask *_cosched_new_task(CoSched *sched, CoTaskFunc func, void *arg, bool is_subtask, CoStackClass stack_class, CoTaskDebugInfo debug);  // creates and runs the task, schedules it for resume on cosched_run_tasks if it's still alive
+#define cosched_new_task(sched, func, arg, stack_class, debug_label) _cosched_new_task(sched, func, arg, false, stack_class, COTASK_DEBUG_INFO(debug_label))
+#define cosched_new_subtask(sched, func, arg, stack_class, debug_label) _cosched_new_task(sched, func, arg, true, stack_class, COTASK_DEBUG_INFO(debug_label))
 uint cosched_run_tasks(CoSched *sched);  // returns number of tasks ran
 void cosched_finish(CoSched *sched);
 
@@ -165,9 +251,11 @@ INLINE void cosched_set_invoke_target(CoSched *sched) { _cosched_global = sched;
 	/* called from the entry points before task body (inlined, hopefully) */ \
 	INLINE void COTASKPROLOGUE_##name(TASK_ARGS_TYPE(name) *_cotask_args) /* require semicolon */ \
 
-#define TASK_COMMON_DECLARATIONS(name, argstype, handletype, linkage) \
+#define TASK_COMMON_DECLARATIONS(name, argstype, handletype, stack_class, linkage) \
 	/* produce warning if the task is never used */ \
 	linkage char COTASK_UNUSED_CHECK_##name; \
+	/* stack size class used by the INVOKE_ macros */ \
+	enum { COTASKSTACK_##name = (stack_class) }; \
 	/* type of indirect handle to a compatible task */ \
 	typedef handletype TASK_INDIRECT_TYPE_ALIAS(name); \
 	/* user-defined type of args struct */ \
@@ -229,8 +317,8 @@ INLINE void cosched_set_invoke_target(CoSched *sched) { _cosched_global = sched;
 	linkage void COTASK_##name(TASK_ARGS_TYPE(name) *_cotask_args)
 
 
-#define DECLARE_TASK_EXPLICIT(name, argstype, handletype, linkage) \
-	TASK_COMMON_DECLARATIONS(name, argstype, handletype, linkage) /* require semicolon */
+#define DECLARE_TASK_EXPLICIT(name, argstype, handletype, stack_class, linkage) \
+	TASK_COMMON_DECLARATIONS(name, argstype, handletype, stack_class, linkage) /* require semicolon */
 
 #define DEFINE_TASK_EXPLICIT(name, linkage) \
 	TASK_COMMON_PRIVATE_DECLARATIONS(name); \
@@ -243,11 +331,15 @@ INLINE void cosched_set_invoke_target(CoSched *sched) { _cosched_global = sched;
 
 /* declare a task with static linkage (needs to be defined later) */
 #define DECLARE_TASK(name, argstruct) \
-	DECLARE_TASK_EXPLICIT(name, TASK_ARGS_STRUCT(argstruct), void, static) /* require semicolon */
+	DECLARE_TASK_EXPLICIT(name, TASK_ARGS_STRUCT(argstruct), void, CO_STACK_DEFAULT, static) /* require semicolon */
+
+/* declare a task with static linkage and a non-default stack size class (needs to be defined later) */
+#define DECLARE_TASK_WITH_STACK(name, stack_class, argstruct) \
+	DECLARE_TASK_EXPLICIT(name, TASK_ARGS_STRUCT(argstruct), void, stack_class, static) /* require semicolon */
 
 /* declare a task with static linkage that conforms to a common interface (needs to be defined later) */
 #define DECLARE_TASK_WITH_INTERFACE(name, iface) \
-	DECLARE_TASK_EXPLICIT(name, TASK_IFACE_ARGS_TYPE(iface), TASK_INDIRECT_TYPE(iface), static) /* require semicolon */
+	DECLARE_TASK_EXPLICIT(name, TASK_IFACE_ARGS_TYPE(iface), TASK_INDIRECT_TYPE(iface), CO_STACK_DEFAULT, static) /* require semicolon */
 
 /* define a task with static linkage (needs to be declared first) */
 #define DEFINE_TASK(name) \
@@ -258,6 +350,11 @@ INLINE void cosched_set_invoke_target(CoSched *sched) { _cosched_global = sched;
 	DECLARE_TASK(name, argstruct); \
 	DEFINE_TASK(name)
 
+/* declare and define a task with static linkage and a non-default stack size class */
+#define TASK_WITH_STACK(name, stack_class, argstruct) \
+	DECLARE_TASK_WITH_STACK(name, stack_class, argstruct); \
+	DEFINE_TASK(name)
+
 /* declare and define a task with static linkage that conforms to a common interface */
 #define TASK_WITH_INTERFACE(name, iface) \
 	DECLARE_TASK_WITH_INTERFACE(name, iface); \
@@ -266,11 +363,15 @@ INLINE void cosched_set_invoke_target(CoSched *sched) { _cosched_global = sched;
 
 /* declare a task with extern linkage (needs to be defined later) */
 #define DECLARE_EXTERN_TASK(name, argstruct) \
-	DECLARE_TASK_EXPLICIT(name, TASK_ARGS_STRUCT(argstruct), void, extern) /* require semicolon */
+	DECLARE_TASK_EXPLICIT(name, TASK_ARGS_STRUCT(argstruct), void, CO_STACK_DEFAULT, extern) /* require semicolon */
+
+/* declare a task with extern linkage and a non-default stack size class (needs to be defined later) */
+#define DECLARE_EXTERN_TASK_WITH_STACK(name, stack_class, argstruct) \
+	DECLARE_TASK_EXPLICIT(name, TASK_ARGS_STRUCT(argstruct), void, stack_class, extern) /* require semicolon */
 
 /* declare a task with extern linkage that conforms to a common interface (needs to be defined later) */
 #define DECLARE_EXTERN_TASK_WITH_INTERFACE(name, iface) \
-	DECLARE_TASK_EXPLICIT(name, TASK_IFACE_ARGS_TYPE(iface), TASK_INDIRECT_TYPE(iface), extern) /* require semicolon */
+	DECLARE_TASK_EXPLICIT(name, TASK_IFACE_ARGS_TYPE(iface), TASK_INDIRECT_TYPE(iface), CO_STACK_DEFAULT, extern) /* require semicolon */
 
 /* define a task with extern linkage (needs to be declared first) */
 #define DEFINE_EXTERN_TASK(name) \
@@ -303,7 +404,7 @@ INLINE void cosched_set_invoke_target(CoSched *sched) { _cosched_global = sched;
 #define _internal_INVOKE_TASK(task_constructor, name, ...) ( \
 	(void)COTASK_UNUSED_CHECK_##name, \
 	task_constructor(_cosched_global, COTASKTHUNK_##name, \
-		(&(TASK_ARGS_TYPE(name)) { __VA_ARGS__ }), #name \
+		(&(TASK_ARGS_TYPE(name)) { __VA_ARGS__ }), COTASKSTACK_##name, #name \
 	) \
 )
 
@@ -326,7 +427,7 @@ INLINE void cosched_set_invoke_target(CoSched *sched) { _cosched_global = sched;
 #define _internal_INVOKE_TASK_DELAYED(task_constructor, _delay, name, ...) ( \
 	(void)COTASK_UNUSED_CHECK_##name, \
 	task_constructor(_cosched_global, COTASKTHUNKDELAY_##name, \
-		(&(TASK_ARGSDELAY(name)) { .real_args = { __VA_ARGS__ }, .delay = (_delay) }), #name \
+		(&(TASK_ARGSDELAY(name)) { .real_args = { __VA_ARGS__ }, .delay = (_delay) }), COTASKSTACK_##name, #name " (delayed)" \
 	) \
 )
 
@@ -353,7 +454,7 @@ INLINE void cosched_set_invoke_target(CoSched *sched) { _cosched_global = sched;
 #define _internal_INVOKE_TASK_ON_EVENT(task_constructor, is_unconditional, _event, name, ...) ( \
 	(void)COTASK_UNUSED_CHECK_##name, \
 	task_constructor(_cosched_global, COTASKTHUNKCOND_##name, \
-		(&(TASK_ARGSCOND(name)) { .real_args = { __VA_ARGS__ }, .event = (_event), .unconditional = is_unconditional }), #name \
+		(&(TASK_ARGSCOND(name)) { .real_args = { __VA_ARGS__ }, .event = (_event), .unconditional = is_unconditional }), COTASKSTACK_##name, #name " (on event)" \
 	) \
 )
 
@@ -386,9 +487,10 @@ DECLARE_EXTERN_TASK(_cancel_task_helper, { BoxedTask task; });
 #define TASK_INDIRECT_INIT(iface, task) \
 	{ ._cotask_##iface##_thunk = COTASKTHUNK_##task } \
 
+// Indirect handles don't know the stack class of the task behind them, so these always use the default one.
 #define INVOKE_TASK_INDIRECT_(task_constructor, iface, taskhandle, ...) ( \
 	task_constructor(_cosched_global, taskhandle._cotask_##iface##_thunk, \
-		(&(TASK_IFACE_ARGS_TYPE(iface)) { __VA_ARGS__ }), "<indirect>" \
+		(&(TASK_IFACE_ARGS_TYPE(iface)) { __VA_ARGS__ }), CO_STACK_DEFAULT, "<indirect>" \
 	) \
 )
 
@@ -58,6 +58,8 @@ static void fix_pos0_visual(Enemy *e) {
 }
 
 static inline int enemy_call_logic_rule(Enemy *e, int t) {
+	ent_grid_invalidate();
+
 	if(t == EVENT_KILLED) {
 		coevent_signal(&e->events.killed);
 	}
@@ -82,6 +84,7 @@ Enemy *create_enemy_p(EnemyList *enemies, cmplx pos, float hp, EnemyVisualRule v
 
 	// FIXME: some code relies on the insertion logic (which?)
 	Enemy *e = alist_insert(enemies, enemies->first, (Enemy*)objpool_acquire(stage_object_pools.enemies));
+	ent_grid_invalidate();
 	// Enemy *e = alist_append(enemies, (Enemy*)objpool_acquire(stage_object_pools.enemies));
 	e->moving = false;
 	e->dir = 0;
@@ -171,6 +174,7 @@ static void* _delete_enemy(ListAnchor *enemies, List* enemy, void *arg) {
 	coevent_cancel(&e->events.killed);
 	ent_unregister(&e->ent);
 	objpool_release(stage_object_pools.enemies, alist_unlink(enemies, enemy));
+	ent_grid_invalidate();
 
 	return NULL;
 }
@@ -13,6 +13,12 @@
 #include "renderer/api.h"
 #include "global.h"
 #include "dynarray.h"
+#include "util/spatialgrid.h"
+#include "profiler.h"
+
+// Enemies farther than this from the viewport are all lumped into the border cells.
+#define ENEMY_GRID_MARGIN 128
+#define ENEMY_GRID_CELL_SIZE 64
 
 typedef struct EntityDrawHook EntityDrawHook;
 typedef LIST_ANCHOR(EntityDrawHook) EntityDrawHookList;
@@ -23,14 +29,43 @@ struct EntityDrawHook {
 	void *arg;
 };
 
+typedef struct EntitySortItem {
+	uint64_t key;
+	EntityInterface *ent;
+} EntitySortItem;
+
+#define ENT_NO_FREE_SLOT UINT32_MAX
+
+EntitySlotArray _ent_slots;
+
 static struct {
 	DYNAMIC_ARRAY(EntityInterface*) registered;
 	uint32_t total_spawns;
 
+	uint32_t first_free_slot;
+
+	struct {
+		EntityPtrArray ents;
+		uint num_holes;
+	} by_type[_ENT_TYPE_ENUM_END];
+
+	struct {
+		DYNAMIC_ARRAY(EntitySortItem) items;
+		DYNAMIC_ARRAY(EntitySortItem) scratch;
+	} draw_order;
+
 	struct {
 		EntityDrawHookList pre_draw;
 		EntityDrawHookList post_draw;
 	} hooks;
+
+	struct {
+		SpatialGrid grid;
+		DYNAMIC_ARRAY(SpatialGridEntry*) results;
+		uint epoch;
+		uint built_epoch;
+		bool active;
+	} enemy_grid;
 } entities;
 
 static void add_hook(EntityDrawHookList *list, EntityDrawHookCallback cb, void *arg) {
@@ -62,6 +97,13 @@ static void call_hooks(EntityDrawHookList *list, EntityInterface *ent) {
 void ent_init(void) {
 	memset(&entities, 0, sizeof(entities));
 	dynarray_ensure_capacity(&entities.registered, 1024);
+	dynarray_ensure_capacity(&_ent_slots, 1024);
+	entities.first_free_slot = ENT_NO_FREE_SLOT;
+
+	spatialgrid_init(&entities.enemy_grid.grid, (Rect) {
+		.top_left = CMPLX(-ENEMY_GRID_MARGIN, -ENEMY_GRID_MARGIN),
+		.bottom_right = CMPLX(VIEWPORT_W + ENEMY_GRID_MARGIN, VIEWPORT_H + ENEMY_GRID_MARGIN),
+	}, ENEMY_GRID_CELL_SIZE);
 }
 
 void ent_shutdown(void) {
@@ -70,22 +112,105 @@ void ent_shutdown(void) {
 	}
 
 	dynarray_free_data(&entities.registered);
+	dynarray_free_data(&_ent_slots);
+
+	for(EntityType t = 0; t < _ENT_TYPE_ENUM_END; ++t) {
+		dynarray_free_data(&entities.by_type[t].ents);
+	}
+
+	dynarray_free_data(&entities.draw_order.items);
+	dynarray_free_data(&entities.draw_order.scratch);
+	spatialgrid_free(&entities.enemy_grid.grid);
+	dynarray_free_data(&entities.enemy_grid.results);
 
 	assert(entities.hooks.post_draw.first == NULL);
 	assert(entities.hooks.pre_draw.first == NULL);
 }
 
+static EntityID ent_alloc_slot(EntityInterface *ent) {
+	EntitySlot *slot;
+	uint32_t idx = entities.first_free_slot;
+
+	if(idx != ENT_NO_FREE_SLOT) {
+		slot = dynarray_get_ptr(&_ent_slots, idx);
+		entities.first_free_slot = slot->next_free;
+	} else {
+		idx = _ent_slots.num_elements;
+		slot = dynarray_append(&_ent_slots);
+		slot->generation = 1;
+	}
+
+	slot->ent = ent;
+	slot->next_free = ENT_NO_FREE_SLOT;
+	return (EntityID) { .index = idx, .generation = slot->generation };
+}
+
+static void ent_free_slot(EntityID id) {
+	EntitySlot *slot = dynarray_get_ptr(&_ent_slots, id.index);
+	assert(slot->generation == id.generation);
+
+	// Invalidates all boxes referring to this slot.
+	if(UNLIKELY(++slot->generation == 0)) {
+		slot->generation = 1;
+	}
+
+	slot->ent = NULL;
+	slot->next_free = entities.first_free_slot;
+	entities.first_free_slot = id.index;
+}
+
+EntityPtrArray *_ent_type_registry(EntityType type) {
+	assert(type > _ENT_TYPE_ENUM_BEGIN && type < _ENT_TYPE_ENUM_END);
+	return &entities.by_type[type].ents;
+}
+
+void ent_compact_registry(void) {
+	for(EntityType t = _ENT_TYPE_ENUM_BEGIN + 1; t < _ENT_TYPE_ENUM_END; ++t) {
+		if(!entities.by_type[t].num_holes) {
+			continue;
+		}
+
+		EntityPtrArray *reg = &entities.by_type[t].ents;
+		uint n = 0;
+
+		// Order-preserving, so that ENT_FOREACH keeps visiting entities in spawn order.
+		dynarray_foreach_elem(reg, EntityInterface **pent, {
+			if(*pent) {
+				(*pent)->type_index = n;
+				reg->data[n++] = *pent;
+			}
+		});
+
+		reg->num_elements = n;
+		entities.by_type[t].num_holes = 0;
+	}
+}
+
 void ent_register(EntityInterface *ent, EntityType type) {
 	assert(type > _ENT_TYPE_ENUM_BEGIN && type < _ENT_TYPE_ENUM_END);
 	ent->type = type;
 	ent->spawn_id = ++entities.total_spawns;
 	ent->index = entities.registered.num_elements;
+	ent->id = ent_alloc_slot(ent);
 	assume(ent->spawn_id > 0);
 	*dynarray_append(&entities.registered) = ent;
+
+	EntityPtrArray *reg = &entities.by_type[type].ents;
+	ent->type_index = reg->num_elements;
+	*dynarray_append(reg) = ent;
 }
 
 void ent_unregister(EntityInterface *ent) {
 	ent->spawn_id = 0;
+	ent_free_slot(ent->id);
+	ent->id = (EntityID) { 0 };
+
+	EntityPtrArray *reg = &entities.by_type[ent->type].ents;
+	assert(dynarray_get(reg, ent->type_index) == ent);
+
+	// Never shrink here, an ENT_FOREACH may be in progress.
+	reg->data[ent->type_index] = NULL;
+	++entities.by_type[ent->type].num_holes;
 
 	// Fast non-order-preserving removal by moving the last element into the removed element's position.
 
@@ -96,27 +221,126 @@ void ent_unregister(EntityInterface *ent) {
 	del_ref(ent);
 }
 
-static int ent_cmp(const void *ptr1, const void *ptr2) {
-	const EntityInterface *ent1 = *(const EntityInterface**)ptr1;
-	const EntityInterface *ent2 = *(const EntityInterface**)ptr2;
+static inline uint64_t ent_draw_key(EntityInterface *ent) {
+	// Same layer? Put whatever spawned later on top, then.
+	return ((uint64_t)ent->draw_layer << 32) | ent->spawn_id;
+}
+
+#define SORT_RADIX_BITS 8
+#define SORT_RADIX_SIZE (1 << SORT_RADIX_BITS)
+#define SORT_RADIX_PASSES (sizeof(uint64_t) * CHAR_BIT / SORT_RADIX_BITS)
+
+static void ent_sort_draw_order(void) {
+	uint n = entities.registered.num_elements;
+
+	if(n < 2) {
+		return;
+	}
+
+	dynarray_ensure_capacity(&entities.draw_order.items, n);
+	dynarray_ensure_capacity(&entities.draw_order.scratch, n);
+
+	EntitySortItem *src = entities.draw_order.items.data;
+	EntitySortItem *dst = entities.draw_order.scratch.data;
+	uint32_t hist[SORT_RADIX_PASSES][SORT_RADIX_SIZE] = { 0 };
+	bool sorted = true;
+
+	for(uint i = 0; i < n; ++i) {
+		EntityInterface *ent = entities.registered.data[i];
+		uint64_t key = ent_draw_key(ent);
+
+		src[i].key = key;
+		src[i].ent = ent;
+
+		if(i > 0 && src[i - 1].key > key) {
+			sorted = false;
+		}
+
+		for(uint p = 0; p < SORT_RADIX_PASSES; ++p) {
+			++hist[p][(key >> (p * SORT_RADIX_BITS)) & (SORT_RADIX_SIZE - 1)];
+		}
+	}
+
+	// Most frames only append new entities, which are already in order.
+	if(sorted) {
+		return;
+	}
+
+	// LSD radix sort. The keys are unique, so this yields the same order a comparison sort would.
+
+	for(uint p = 0; p < SORT_RADIX_PASSES; ++p) {
+		uint shift = p * SORT_RADIX_BITS;
+		uint32_t *h = hist[p];
+
+		if(h[(src[0].key >> shift) & (SORT_RADIX_SIZE - 1)] == n) {
+			// This digit is the same for all keys
+			continue;
+		}
+
+		uint32_t ofs = 0;
+
+		for(uint d = 0; d < SORT_RADIX_SIZE; ++d) {
+			uint32_t cnt = h[d];
+			h[d] = ofs;
+			ofs += cnt;
+		}
 
-	int r = (ent1->draw_layer > ent2->draw_layer) - (ent1->draw_layer < ent2->draw_layer);
+		for(uint i = 0; i < n; ++i) {
+			dst[h[(src[i].key >> shift) & (SORT_RADIX_SIZE - 1)]++] = src[i];
+		}
 
-	if(r == 0) {
-		// Same layer? Put whatever spawned later on top, then.
-		r = (ent1->spawn_id > ent2->spawn_id) - (ent1->spawn_id < ent2->spawn_id);
+		EntitySortItem *tmp = src;
+		src = dst;
+		dst = tmp;
 	}
 
-	return r;
+	for(uint i = 0; i < n; ++i) {
+		entities.registered.data[i] = src[i].ent;
+	}
 }
 
 static inline bool ent_is_drawable(EntityInterface *ent) {
 	return (ent->draw_layer & ~LAYER_LOW_MASK) > LAYER_NODRAW && ent->draw_func;
 }
 
+static inline drawlayer_t ent_unordered_layer(drawlayer_t layer) {
+	// Layers whose sprites may be drawn in any order relative to each other.
+	// The sprite batch groups them by state to reduce flushes; see r_sprite_batch_begin_unordered.
+	// Sublayers are kept apart, since they are used to order things explicitly.
+	switch(layer & ~LAYER_LOW_MASK) {
+		case LAYER_PLAYER_SHOT:
+		case LAYER_PARTICLE_BULLET_CLEAR:
+			return layer;
+
+		default:
+			return 0;
+	}
+}
+
+static void ent_draw_update_segment(drawlayer_t *segment, drawlayer_t layer) {
+	if(layer == *segment) {
+		return;
+	}
+
+	if(*segment) {
+		r_sprite_batch_end_unordered();
+	}
+
+	if(layer) {
+		r_sprite_batch_begin_unordered(layer);
+	}
+
+	*segment = layer;
+}
+
 void ent_draw(EntityPredicate predicate) {
+	PROFILE_ZONE_BEGIN(z, "ent_draw");
 	call_hooks(&entities.hooks.pre_draw, NULL);
-	dynarray_qsort(&entities.registered, ent_cmp);
+	ent_sort_draw_order();
+
+	// Per-entity hooks may rely on the exact draw order
+	bool allow_unordered = !entities.hooks.pre_draw.first && !entities.hooks.post_draw.first;
+	drawlayer_t segment = 0;
 
 	if(predicate) {
 		dynarray_foreach(&entities.registered, int i, EntityInterface **pent, {
@@ -124,6 +348,10 @@ void ent_draw(EntityPredicate predicate) {
 			ent->index = i;
 
 			if(ent_is_drawable(ent) && predicate(ent)) {
+				if(allow_unordered) {
+					ent_draw_update_segment(&segment, ent_unordered_layer(ent->draw_layer));
+				}
+
 				call_hooks(&entities.hooks.pre_draw, ent);
 				r_state_push();
 				ent->draw_func(ent);
@@ -137,6 +365,10 @@ void ent_draw(EntityPredicate predicate) {
 			ent->index = i;
 
 			if(ent_is_drawable(ent)) {
+				if(allow_unordered) {
+					ent_draw_update_segment(&segment, ent_unordered_layer(ent->draw_layer));
+				}
+
 				call_hooks(&entities.hooks.pre_draw, ent);
 				r_state_push();
 				ent->draw_func(ent);
@@ -146,7 +378,9 @@ void ent_draw(EntityPredicate predicate) {
 		});
 	}
 
+	ent_draw_update_segment(&segment, 0);
 	call_hooks(&entities.hooks.post_draw, NULL);
+	PROFILE_ZONE_END(z);
 }
 
 DamageResult ent_damage(EntityInterface *ent, const DamageInfo *damage) {
@@ -171,17 +405,160 @@ DamageResult ent_damage(EntityInterface *ent, const DamageInfo *damage) {
 	return res;
 }
 
-void ent_area_damage(cmplx origin, float radius, const DamageInfo *damage, EntityAreaDamageCallback callback, void *callback_arg) {
+void ent_grid_invalidate(void) {
+	++entities.enemy_grid.epoch;
+}
+
+void ent_grid_begin(void) {
+	assert(!entities.enemy_grid.active);
+	entities.enemy_grid.active = true;
+	// enemies have most likely moved since the last pass
+	ent_grid_invalidate();
+}
+
+void ent_grid_end(void) {
+	assert(entities.enemy_grid.active);
+	entities.enemy_grid.active = false;
+
+#ifdef DEBUG
+	if(entities.enemy_grid.built_epoch == entities.enemy_grid.epoch) {
+		SpatialGrid *grid = &entities.enemy_grid.grid;
+
+		for(uint i = 0; i < spatialgrid_size(grid); ++i) {
+			SpatialGridEntry *entry = grid->entries.data + i;
+			Enemy *e = entry->object;
+
+			if(e->pos != entry->pos) {
+				log_warn("Enemy %p moved while the enemy grid was in use; call ent_grid_invalidate() after moving it", (void*)e);
+			}
+		}
+	}
+#endif
+}
+
+static void ent_grid_update(void) {
+	if(entities.enemy_grid.built_epoch == entities.enemy_grid.epoch) {
+		return;
+	}
+
+	SpatialGrid *grid = &entities.enemy_grid.grid;
+	spatialgrid_reset(grid);
+
 	for(Enemy *e = global.enemies.first; e; e = e->next) {
-		if(
-			cabs(origin - e->pos) < radius &&
-			ent_damage(&e->ent, damage) == DMG_RESULT_OK &&
-			callback != NULL
-		) {
-			callback(&e->entity_interface, e->pos, callback_arg);
+		spatialgrid_add(grid, e, e->pos);
+	}
+
+	spatialgrid_build(grid);
+	dynarray_ensure_capacity(&entities.enemy_grid.results, imax(1, spatialgrid_size(grid)));
+	entities.enemy_grid.built_epoch = entities.enemy_grid.epoch;
+}
+
+static uint ent_grid_query(Rect area, SpatialGridEntry ***results) {
+	assert(entities.enemy_grid.active);
+	ent_grid_update();
+	*results = entities.enemy_grid.results.data;
+	return spatialgrid_query_rect(&entities.enemy_grid.grid, area, *results);
+}
+
+static inline Rect rect_around(cmplx center, double radius) {
+	// NOTE: padded a bit, so that rounding in the exact tests can never reach outside of the queried cells
+	radius += 1;
+
+	return (Rect) {
+		.top_left = center - CMPLX(radius, radius),
+		.bottom_right = center + CMPLX(radius, radius),
+	};
+}
+
+Enemy *ent_find_enemy_in_radius(cmplx origin, double radius, bool (*predicate)(Enemy *e)) {
+	if(!entities.enemy_grid.active) {
+		for(Enemy *e = global.enemies.first; e; e = e->next) {
+			if(cabs(e->pos - origin) < radius && (predicate == NULL || predicate(e))) {
+				return e;
+			}
 		}
+
+		return NULL;
 	}
 
+	SpatialGridEntry **candidates;
+	uint num_candidates = ent_grid_query(rect_around(origin, radius), &candidates);
+
+	// Candidates are in list order, so the first match is the same one a linear scan would find.
+	for(uint i = 0; i < num_candidates; ++i) {
+		Enemy *e = candidates[i]->object;
+
+		if(cabs(e->pos - origin) < radius && (predicate == NULL || predicate(e))) {
+			return e;
+		}
+	}
+
+	return NULL;
+}
+
+typedef bool (*AreaTestFunc)(Enemy *e, const void *area);
+
+static bool area_test_circle(Enemy *e, const void *area) {
+	const Circle *c = area;
+	return cabs(c->origin - e->pos) < c->radius;
+}
+
+static bool area_test_ellipse(Enemy *e, const void *area) {
+	return point_in_ellipse(e->pos, *(const Ellipse*)area);
+}
+
+static void area_damage_enemy(Enemy *e, const DamageInfo *damage, EntityAreaDamageCallback callback, void *callback_arg) {
+	if(ent_damage(&e->ent, damage) == DMG_RESULT_OK && callback != NULL) {
+		callback(&e->entity_interface, e->pos, callback_arg);
+	}
+}
+
+static void area_damage_enemies_linear(
+	Enemy *e, AreaTestFunc test, const void *area,
+	const DamageInfo *damage, EntityAreaDamageCallback callback, void *callback_arg
+) {
+	for(; e; e = e->next) {
+		if(test(e, area)) {
+			area_damage_enemy(e, damage, callback, callback_arg);
+		}
+	}
+}
+
+static void area_damage_enemies(
+	Rect bbox, AreaTestFunc test, const void *area,
+	const DamageInfo *damage, EntityAreaDamageCallback callback, void *callback_arg
+) {
+	if(!entities.enemy_grid.active) {
+		area_damage_enemies_linear(global.enemies.first, test, area, damage, callback, callback_arg);
+		return;
+	}
+
+	SpatialGridEntry **candidates;
+	uint num_candidates = ent_grid_query(bbox, &candidates);
+	uint epoch = entities.enemy_grid.epoch;
+
+	for(uint i = 0; i < num_candidates; ++i) {
+		Enemy *e = candidates[i]->object;
+
+		if(!test(e, area)) {
+			continue;
+		}
+
+		area_damage_enemy(e, damage, callback, callback_arg);
+
+		if(epoch != entities.enemy_grid.epoch) {
+			// The callback has changed the enemy list or moved things around.
+			// Candidates are no longer trustworthy; continue the way a plain list walk would.
+			area_damage_enemies_linear(e->next, test, area, damage, callback, callback_arg);
+			return;
+		}
+	}
+}
+
+void ent_area_damage(cmplx origin, float radius, const DamageInfo *damage, EntityAreaDamageCallback callback, void *callback_arg) {
+	Circle c = { .origin = origin, .radius = radius };
+	area_damage_enemies(rect_around(origin, radius), area_test_circle, &c, damage, callback, callback_arg);
+
 	if(
 		global.boss != NULL &&
 		cabs(origin - global.boss->pos) < radius &&
@@ -193,15 +570,9 @@ void ent_area_damage(cmplx origin, float radius, const DamageInfo *damage, Entit
 }
 
 void ent_area_damage_ellipse(Ellipse ellipse, const DamageInfo *damage, EntityAreaDamageCallback callback, void *callback_arg) {
-	for(Enemy *e = global.enemies.first; e; e = e->next) {
-		if(
-			point_in_ellipse(e->pos, ellipse) &&
-			ent_damage(&e->ent, damage) == DMG_RESULT_OK &&
-			callback != NULL
-		) {
-			callback(&e->entity_interface, e->pos, callback_arg);
-		}
-	}
+	// Axes are full lengths; the larger one bounds the ellipse regardless of rotation.
+	double r = 0.5 * fmax(creal(ellipse.axes), cimag(ellipse.axes));
+	area_damage_enemies(rect_around(ellipse.origin, r), area_test_ellipse, &ellipse, damage, callback, callback_arg);
 
 	if(
 		global.boss != NULL &&
@@ -12,6 +12,7 @@
 #include "taisei.h"
 
 #include "objectpool.h"
+#include "dynarray.h"
 #include "util/geometry.h"
 #include "util/macrohax.h"
 #include "known_entities.h"
@@ -85,6 +86,13 @@ typedef DamageResult (*EntityDamageFunc)(EntityInterface *target, const DamageIn
 typedef void (*EntityDrawHookCallback)(EntityInterface *ent, void *arg);
 typedef void (*EntityAreaDamageCallback)(EntityInterface *ent, cmplx ent_origin, void *arg);
 
+// Generational handle of a registered entity. The generation is never 0 for a
+// live entity, so a zeroed ID never resolves.
+typedef struct EntityID {
+	uint32_t index;
+	uint32_t generation;
+} EntityID;
+
 #define ENTITY_INTERFACE_BASE(typename) struct { \
 	LIST_INTERFACE(typename); \
 	EntityDrawFunc draw_func; \
@@ -92,6 +100,8 @@ typedef void (*EntityAreaDamageCallback)(EntityInterface *ent, cmplx ent_origin,
 	drawlayer_t draw_layer; \
 	uint32_t spawn_id; \
 	uint index; \
+	uint type_index; \
+	EntityID id; \
 	EntityType type; \
 }
 
@@ -144,26 +154,84 @@ DamageResult ent_damage(EntityInterface *ent, const DamageInfo *damage) attr_non
 void ent_area_damage(cmplx origin, float radius, const DamageInfo *damage, EntityAreaDamageCallback callback, void *callback_arg) attr_nonnull(3);
 void ent_area_damage_ellipse(Ellipse ellipse, const DamageInfo *damage, EntityAreaDamageCallback callback, void *callback_arg) attr_nonnull(2);
 
+// Finds the first enemy (in global.enemies order) closer than radius to origin that satisfies the predicate (if any).
+// Between ent_grid_begin() and ent_grid_end(), this and the area damage functions are backed by a spatial grid;
+// otherwise they scan the enemy list.
+Enemy *ent_find_enemy_in_radius(cmplx origin, double radius, bool (*predicate)(Enemy *e));
+
+// Brackets the collision pass. The grid is built on the first query after ent_grid_begin(), and enemies
+// are assumed to stay in place until ent_grid_end(). Debug builds warn if one has moved anyway.
+void ent_grid_begin(void);
+void ent_grid_end(void);
+
+// Must be called if enemies are spawned, removed, or moved while the grid is in use.
+// Spawning and removal through the enemy API already take care of this.
+void ent_grid_invalidate(void);
+
+/*
+ * Every registered entity is also listed in a dense array for its type, in
+ * spawn order. ENT_FOREACH walks it without touching the per-type intrusive
+ * lists. Entities may be spawned and removed inside the loop: removed ones
+ * leave holes, which are skipped, and entities spawned during the loop are not
+ * visited. The holes are squeezed out by ent_compact_registry, which the stage
+ * calls once per logic frame, outside of any ENT_FOREACH.
+ */
+
+typedef DYNAMIC_ARRAY(EntityInterface*) EntityPtrArray;
+
+EntityPtrArray *_ent_type_registry(EntityType type) attr_returns_nonnull;
+void ent_compact_registry(void);
+
+#define _ent_foreach_reg MACROHAX_ADDLINENUM(_ent_foreach_reg)
+#define _ent_foreach_num MACROHAX_ADDLINENUM(_ent_foreach_num)
+#define _ent_foreach_iter MACROHAX_ADDLINENUM(_ent_foreach_iter)
+
+#define ENT_FOREACH(typename, _var, ...) do { \
+	EntityPtrArray *_ent_foreach_reg = _ent_type_registry(ENT_TYPE_ID(typename)); \
+	uint _ent_foreach_num = _ent_foreach_reg->num_elements; \
+	for(uint _ent_foreach_iter = 0; _ent_foreach_iter < _ent_foreach_num; ++_ent_foreach_iter) { \
+		EntityInterface *_ent_foreach_temp = _ent_foreach_reg->data[_ent_foreach_iter]; \
+		if(_ent_foreach_temp != NULL) { \
+			_var = UNION_CAST(EntityInterface*, typename*, _ent_foreach_temp); \
+			__VA_ARGS__ \
+		} \
+	} \
+} while(0)
+
 void ent_hook_pre_draw(EntityDrawHookCallback callback, void *arg);
 void ent_unhook_pre_draw(EntityDrawHookCallback callback);
 void ent_hook_post_draw(EntityDrawHookCallback callback, void *arg);
 void ent_unhook_post_draw(EntityDrawHookCallback callback);
 
+typedef struct EntitySlot {
+	EntityInterface *ent;
+	uint32_t generation;
+	uint32_t next_free;
+} EntitySlot;
+
+typedef DYNAMIC_ARRAY(EntitySlot) EntitySlotArray;
+extern EntitySlotArray _ent_slots;
+
+// Boxes only resolve through the slot table, so a stale box never dereferences
+// the (possibly freed) entity it was made from. The ent pointer is only kept
+// so that a box can be checked for emptiness.
 struct BoxedEntity {
 	EntityInterface *ent;
-	uint_fast32_t spawn_id;
+	EntityID id;
 };
 
 attr_nonnull_all
 INLINE BoxedEntity _ent_box_Entity(EntityInterface *ent) {
-	return (BoxedEntity) { .ent = ent, .spawn_id = ent->spawn_id } ;
+	return (BoxedEntity) { .ent = ent, .id = ent->id } ;
 }
 
 INLINE EntityInterface *_ent_unbox_Entity(BoxedEntity box) {
-	EntityInterface *e = box.ent;
+	if(box.id.index < _ent_slots.num_elements) {
+		EntitySlot *slot = _ent_slots.data + box.id.index;
 
-	if(e && e->spawn_id == box.spawn_id) {
-		return e;
+		if(slot->generation == box.id.generation) {
+			return slot->ent;
+		}
 	}
 
 	return NULL;
@@ -174,7 +242,7 @@ INLINE EntityInterface *_ent_unbox_Entity(BoxedEntity box) {
 		BoxedEntity as_generic; \
 		struct { \
 			typename *ent; \
-			uint_fast32_t spawn_id; \
+			EntityID id; \
 		}; \
 	} Boxed##typename; \
 	attr_nonnull_all INLINE Boxed##typename _ent_box_##typename(typename *ent) { \
@@ -12,6 +12,8 @@
 #include "util.h"
 #include "global.h"
 #include "video.h"
+#include "profiler.h"
+#include "benchmark.h"
 
 struct evloop_s evloop;
 
@@ -63,7 +65,14 @@ LogicFrameAction run_logic_frame(LoopFrame *frame) {
 		return LFRAME_STOP;
 	}
 
+	PROFILE_ZONE_BEGIN(z, "logic_frame");
+	hrtime_t begin_time = global.is_benchmark ? time_get() : 0;
 	LogicFrameAction a = frame->logic(frame->context);
+	PROFILE_ZONE_END(z);
+
+	if(global.is_benchmark) {
+		benchmark_logic_frame(time_get() - begin_time);
+	}
 	fpscounter_update(&global.fps.logic);
 
 	if(taisei_quit_requested()) {
@@ -113,6 +122,7 @@ RenderFrameAction run_render_frame(LoopFrame *frame) {
 	}
 
 	attr_unused LoopFrame *stack_prev = evloop.stack_ptr;
+	PROFILE_ZONE_BEGIN(z, "render_frame");
 	r_framebuffer_clear(NULL, CLEAR_ALL, RGBA(0, 0, 0, 1), 1);
 	RenderFrameAction a = frame->render(frame->context);
 	assert(evloop.stack_ptr == stack_prev);
@@ -121,6 +131,8 @@ RenderFrameAction run_render_frame(LoopFrame *frame) {
 		video_swap_buffers();
 	}
 
+	PROFILE_ZONE_END(z);
+
 	fpscounter_update(&global.fps.render);
 	return a;
 }
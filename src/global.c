@@ -24,10 +24,14 @@ void init_global(CLIAction *cli) {
 	global.replaymode = REPLAY_RECORD;
 	global.frameskip = cli->frameskip;
 
-	if(cli->type == CLI_VerifyReplay) {
+	if(cli->type == CLI_VerifyReplay || cli->type == CLI_VerifyReplays) {
 		global.is_headless = true;
 		global.is_replay_verification = true;
 		global.frameskip = 1;
+	} else if(cli->type == CLI_Benchmark) {
+		// no frame limiter; frameskip may still be raised from the command line
+		global.is_benchmark = true;
+		global.frameskip = imax(1, global.frameskip);
 	} else if(global.frameskip) {
 		log_warn("FPS limiter disabled. Gotta go fast! (frameskip = %i)", global.frameskip);
 	}
@@ -26,12 +26,15 @@
 #include "credits.h"
 #include "taskmanager.h"
 #include "coroutine.h"
+#include "replayverify.h"
+#include "profiler.h"
+#include "benchmark.h"
 
 attr_unused
 static void taisei_shutdown(void) {
 	log_info("Shutting down");
 
-	if(!global.is_replay_verification) {
+	if(!global.is_replay_verification && !global.is_benchmark) {
 		config_save();
 		progress_save();
 	}
@@ -41,6 +44,7 @@ static void taisei_shutdown(void) {
 	free_all_refs();
 	free_resources(true);
 	taskmgr_global_shutdown();
+	profiler_shutdown();
 	audio_shutdown();
 	video_shutdown();
 	gamepad_shutdown();
@@ -186,11 +190,15 @@ typedef struct MainContext {
 static void main_post_vfsinit(CallChainResult ccr);
 static void main_singlestg(MainContext *mctx) attr_unused;
 static void main_replay(MainContext *mctx);
+static void main_verify_replays(MainContext *mctx);
+static void main_benchmark(MainContext *mctx);
 static noreturn void main_vfstree(CallChainResult ccr);
 
 static noreturn void main_quit(MainContext *ctx, int status) {
 	free_cli_action(&ctx->cli);
 	replay_destroy(&ctx->replay);
+	replayverify_shutdown();
+	benchmark_shutdown();
 	free(ctx);
 	exit(status);
 }
@@ -231,7 +239,7 @@ int main(int argc, char **argv) {
 		main_quit(ctx, 0);
 	}
 
-	if(ctx->cli.type == CLI_PlayReplay || ctx->cli.type == CLI_VerifyReplay) {
+	if(ctx->cli.type == CLI_PlayReplay || ctx->cli.type == CLI_VerifyReplay || ctx->cli.type == CLI_Benchmark) {
 		if(!replay_load_syspath(&ctx->replay, ctx->cli.filename, REPLAY_READ_ALL)) {
 			main_quit(ctx, 1);
 		}
@@ -244,7 +252,12 @@ int main(int argc, char **argv) {
 
 		if(ctx->cli.type == CLI_VerifyReplay) {
 			ctx->headless = true;
+		} else if(ctx->cli.type == CLI_Benchmark) {
+			benchmark_init(ctx->cli.filename, ctx->cli.out_filename);
 		}
+	} else if(ctx->cli.type == CLI_VerifyReplays) {
+		replayverify_init(ctx->cli.filename, ctx->cli.out_filename, ctx->cli.jobs);
+		ctx->headless = true;
 	} else if(ctx->cli.type == CLI_DumpVFSTree) {
 		vfs_setup(CALLCHAIN(main_vfstree, ctx));
 		return 0; // NO main_quit here! vfs_setup may be asynchronous.
@@ -263,6 +276,13 @@ static void main_post_vfsinit(CallChainResult ccr) {
 	MainContext *ctx = ccr.ctx;
 
 	if(ctx->headless) {
+		if(ctx->cli.type == CLI_VerifyReplays && ctx->cli.jobs > 1) {
+			// load everything up front and synchronously, so that it's in place
+			// before the verification workers are forked
+			env_set("TAISEI_NOPRELOAD", false, false);
+			env_set("TAISEI_NOASYNC", true, false);
+		}
+
 		env_set("SDL_AUDIODRIVER", "dummy", true);
 		env_set("SDL_VIDEODRIVER", "dummy", true);
 		env_set("TAISEI_AUDIO_BACKEND", "null", true);
@@ -273,6 +293,12 @@ static void main_post_vfsinit(CallChainResult ccr) {
 		init_log_file();
 	}
 
+	if(ctx->cli.type == CLI_Benchmark) {
+		// audio timing should not affect the measurements
+		env_set("SDL_AUDIODRIVER", "dummy", false);
+		env_set("TAISEI_AUDIO_BACKEND", "null", false);
+	}
+
 	log_version();
 	log_system_specs();
 	log_lib_versions();
@@ -282,6 +308,7 @@ static void main_post_vfsinit(CallChainResult ccr) {
 	init_sdl();
 	taskmgr_global_init();
 	time_init();
+	profiler_init();
 	init_global(&ctx->cli);
 	events_init();
 	video_init();
@@ -308,6 +335,16 @@ static void main_post_vfsinit(CallChainResult ccr) {
 		return;
 	}
 
+	if(ctx->cli.type == CLI_VerifyReplays) {
+		main_verify_replays(ctx);
+		return;
+	}
+
+	if(ctx->cli.type == CLI_Benchmark) {
+		main_benchmark(ctx);
+		return;
+	}
+
 	if(ctx->cli.type == CLI_Credits) {
 		credits_enter(CALLCHAIN(main_cleanup, ctx));
 		eventloop_run();
@@ -404,6 +441,25 @@ static void main_replay(MainContext *mctx) {
 	eventloop_run();
 }
 
+static void main_verify_replays_done(CallChainResult ccr) {
+	main_quit(ccr.ctx, (intptr_t)ccr.result);
+}
+
+static void main_verify_replays(MainContext *mctx) {
+	replayverify_run(CALLCHAIN(main_verify_replays_done, mctx));
+	eventloop_run();
+}
+
+static void main_benchmark_done(CallChainResult ccr) {
+	main_quit(ccr.ctx, benchmark_write_report() ? 0 : 1);
+}
+
+static void main_benchmark(MainContext *mctx) {
+	replay_play(&mctx->replay, mctx->replay_idx, CALLCHAIN(main_benchmark_done, mctx));
+	replay_destroy(&mctx->replay); // replay_play makes a copy
+	eventloop_run();
+}
+
 static void main_vfstree(CallChainResult ccr) {
 	MainContext *mctx = ccr.ctx;
 	SDL_RWops *rwops = SDL_RWFromFP(stdout, false);
@@ -11,7 +11,7 @@
 #include "move.h"
 #include "util/miscmath.h"
 
-cmplx move_update(cmplx *restrict pos, MoveParams *restrict p) {
+INLINE cmplx move_update_inline(cmplx *restrict pos, MoveParams *restrict p) {
 	cmplx v = p->velocity;
 
 	*pos += v;
@@ -30,12 +30,174 @@ cmplx move_update(cmplx *restrict pos, MoveParams *restrict p) {
 	return v;
 }
 
+cmplx move_update(cmplx *restrict pos, MoveParams *restrict p) {
+	return move_update_inline(pos, p);
+}
+
 cmplx move_update_multiple(uint times, cmplx *restrict pos, MoveParams *restrict p) {
 	cmplx v = p->velocity;
 
 	while(times--) {
-		move_update(pos, p);
+		move_update_inline(pos, p);
 	}
 
 	return v;
 }
+
+void move_update_batch(uint count, cmplx *restrict pos, MoveParams *restrict params) {
+	// NOTE: must produce exactly the same results as calling move_update() on
+	// each element in turn, since replays depend on it. That's why this stays a
+	// plain loop over the same code: spelling out the complex arithmetic on split
+	// components for vectorization would let the compiler round (or fuse) it
+	// differently than the scalar path.
+	for(uint i = 0; i < count; ++i) {
+		move_update_inline(pos + i, params + i);
+	}
+}
+
+// Elements per pass of the float kernel; bounds the scratch arrays on the stack.
+#define MOVE_FLOAT_CHUNK 256
+
+/*
+ * Pass 1: pos += vel; vel = acc + ret * vel; attraction vector = point - pos.
+ * Complex products are spelled out on the split components.
+ */
+static inline void move_float_step(uint i, const MoveBatchFloat *b, float *restrict av_x, float *restrict av_y) {
+	float vx = b->vel_x[i], vy = b->vel_y[i];
+	float px = b->pos_x[i] + vx, py = b->pos_y[i] + vy;
+	b->pos_x[i] = px;
+	b->pos_y[i] = py;
+	b->vel_x[i] = b->acc_x[i] + b->ret_x[i] * vx - b->ret_y[i] * vy;
+	b->vel_y[i] = b->acc_y[i] + b->ret_x[i] * vy + b->ret_y[i] * vx;
+	av_x[i] = b->attr_px[i] - px;
+	av_y[i] = b->attr_py[i] - py;
+}
+
+// Pass 3: vel += attraction * attraction vector. A no-op where attraction is 0.
+static inline void move_float_attract(uint i, const MoveBatchFloat *b, const float *restrict av_x, const float *restrict av_y) {
+	b->vel_x[i] += b->attr_x[i] * av_x[i] - b->attr_y[i] * av_y[i];
+	b->vel_y[i] += b->attr_x[i] * av_y[i] + b->attr_y[i] * av_x[i];
+}
+
+#ifdef USE_GNU_EXTENSIONS
+
+// NOTE: Generic vectors, so that the compiler can pick whatever the target has (SSE, AVX, NEON…)
+#define MOVE_FLOAT_WIDTH 8
+typedef float movef_vec_t __attribute__((vector_size(MOVE_FLOAT_WIDTH * sizeof(float))));
+
+#define MOVEF_LOAD(v, ptr) movef_vec_t v; memcpy(&v, (ptr), sizeof(v))
+#define MOVEF_STORE(ptr, v) memcpy((ptr), &(v), sizeof(v))
+
+static uint move_float_step_vec(uint count, const MoveBatchFloat *b, float *restrict av_x, float *restrict av_y) {
+	uint i = 0;
+
+	for(; i + MOVE_FLOAT_WIDTH <= count; i += MOVE_FLOAT_WIDTH) {
+		MOVEF_LOAD(vx, b->vel_x + i);
+		MOVEF_LOAD(vy, b->vel_y + i);
+		MOVEF_LOAD(px, b->pos_x + i);
+		MOVEF_LOAD(py, b->pos_y + i);
+		MOVEF_LOAD(ax, b->acc_x + i);
+		MOVEF_LOAD(ay, b->acc_y + i);
+		MOVEF_LOAD(rx, b->ret_x + i);
+		MOVEF_LOAD(ry, b->ret_y + i);
+		MOVEF_LOAD(tx, b->attr_px + i);
+		MOVEF_LOAD(ty, b->attr_py + i);
+
+		px += vx;
+		py += vy;
+		movef_vec_t nvx = ax + rx * vx - ry * vy;
+		movef_vec_t nvy = ay + rx * vy + ry * vx;
+		movef_vec_t avx = tx - px;
+		movef_vec_t avy = ty - py;
+
+		MOVEF_STORE(b->pos_x + i, px);
+		MOVEF_STORE(b->pos_y + i, py);
+		MOVEF_STORE(b->vel_x + i, nvx);
+		MOVEF_STORE(b->vel_y + i, nvy);
+		MOVEF_STORE(av_x + i, avx);
+		MOVEF_STORE(av_y + i, avy);
+	}
+
+	return i;
+}
+
+static uint move_float_attract_vec(uint count, const MoveBatchFloat *b, const float *restrict av_x, const float *restrict av_y) {
+	uint i = 0;
+
+	for(; i + MOVE_FLOAT_WIDTH <= count; i += MOVE_FLOAT_WIDTH) {
+		MOVEF_LOAD(vx, b->vel_x + i);
+		MOVEF_LOAD(vy, b->vel_y + i);
+		MOVEF_LOAD(atx, b->attr_x + i);
+		MOVEF_LOAD(aty, b->attr_y + i);
+		MOVEF_LOAD(avx, av_x + i);
+		MOVEF_LOAD(avy, av_y + i);
+
+		vx += atx * avx - aty * avy;
+		vy += atx * avy + aty * avx;
+
+		MOVEF_STORE(b->vel_x + i, vx);
+		MOVEF_STORE(b->vel_y + i, vy);
+	}
+
+	return i;
+}
+
+#undef MOVEF_LOAD
+#undef MOVEF_STORE
+
+#endif
+
+static void move_update_batch_float_chunk(uint count, const MoveBatchFloat *b) {
+	float av_x[MOVE_FLOAT_CHUNK];
+	float av_y[MOVE_FLOAT_CHUNK];
+	uint i = 0;
+
+#ifdef USE_GNU_EXTENSIONS
+	i = move_float_step_vec(count, b, av_x, av_y);
+#endif
+
+	for(; i < count; ++i) {
+		move_float_step(i, b, av_x, av_y);
+	}
+
+	// Pass 2: speed limit on the attraction, as in cclampabs(). Rarely used, so not vectorized.
+	for(i = 0; i < count; ++i) {
+		float max_speed = b->attr_max_speed[i];
+
+		if(max_speed) {
+			float a = hypotf(av_x[i], av_y[i]);
+
+			if(a > max_speed) {
+				float scale = max_speed / a;
+				av_x[i] *= scale;
+				av_y[i] *= scale;
+			}
+		}
+	}
+
+	i = 0;
+
+#ifdef USE_GNU_EXTENSIONS
+	i = move_float_attract_vec(count, b, av_x, av_y);
+#endif
+
+	for(; i < count; ++i) {
+		move_float_attract(i, b, av_x, av_y);
+	}
+}
+
+void move_update_batch_float(uint count, const MoveBatchFloat *batch) {
+	for(uint ofs = 0; ofs < count; ofs += MOVE_FLOAT_CHUNK) {
+		MoveBatchFloat chunk = {
+			.pos_x = batch->pos_x + ofs, .pos_y = batch->pos_y + ofs,
+			.vel_x = batch->vel_x + ofs, .vel_y = batch->vel_y + ofs,
+			.acc_x = batch->acc_x + ofs, .acc_y = batch->acc_y + ofs,
+			.ret_x = batch->ret_x + ofs, .ret_y = batch->ret_y + ofs,
+			.attr_x = batch->attr_x + ofs, .attr_y = batch->attr_y + ofs,
+			.attr_px = batch->attr_px + ofs, .attr_py = batch->attr_py + ofs,
+			.attr_max_speed = batch->attr_max_speed + ofs,
+		};
+
+		move_update_batch_float_chunk(umin(MOVE_FLOAT_CHUNK, count - ofs), &chunk);
+	}
+}
@@ -24,6 +24,26 @@ typedef struct MoveParams {
 
 cmplx move_update(cmplx *restrict pos, MoveParams *restrict params);
 cmplx move_update_multiple(uint times, cmplx *restrict pos, MoveParams *restrict params);
+void move_update_batch(uint count, cmplx *restrict pos, MoveParams *restrict params);
+
+/*
+ * Single precision variant of move_update_batch() for purely visual objects,
+ * with the parameters split into separate arrays (element i of each belongs to
+ * object i). Vectorized where possible. The results are close to, but not the
+ * same as those of move_update(), so nothing that affects the game state may
+ * be moved this way. Only pos and vel are updated.
+ */
+typedef struct MoveBatchFloat {
+	float *restrict pos_x, *restrict pos_y;
+	float *restrict vel_x, *restrict vel_y;
+	float *restrict acc_x, *restrict acc_y;
+	float *restrict ret_x, *restrict ret_y;
+	float *restrict attr_x, *restrict attr_y;
+	float *restrict attr_px, *restrict attr_py;
+	float *restrict attr_max_speed;
+} MoveBatchFloat;
+
+void move_update_batch_float(uint count, const MoveBatchFloat *batch) attr_nonnull(2);
 
 INLINE MoveParams move_linear(cmplx vel) {
 	return (MoveParams) { vel, 0, 1 };
@@ -27,7 +27,11 @@ struct ObjectPool {
 	size_t num_extents;
 	char **extents;
 	ObjHeader *free_objects;
-	char objects[];
+	// objects released out of address order since the free list was last ordered
+	size_t num_unordered_frees;
+	ObjectPoolFlags flags;
+	SDL_SpinLock lock;
+	alignas(alignof(max_align_t)) char objects[];
 };
 
 INLINE attr_returns_max_aligned
@@ -35,20 +39,45 @@ ObjHeader *obj_ptr(ObjectPool *pool, char *objects, size_t idx) {
 	return CASTPTR_ASSUME_ALIGNED(objects + idx * pool->size_of_object, ObjHeader);
 }
 
+INLINE void objpool_lock(ObjectPool *pool) {
+	if(pool->flags & OBJPOOL_CONCURRENT) {
+		SDL_AtomicLock(&pool->lock);
+	}
+}
+
+INLINE void objpool_unlock(ObjectPool *pool) {
+	if(pool->flags & OBJPOOL_CONCURRENT) {
+		SDL_AtomicUnlock(&pool->lock);
+	}
+}
+
 static void objpool_register_objects(ObjectPool *pool, char *objects) {
-	for(size_t i = 0; i < pool->max_objects; ++i) {
+	// pushed in reverse, so that they are handed out in address order
+	for(size_t i = pool->max_objects; i--;) {
 		ObjHeader *o = obj_ptr(pool, objects, i);
 		o->next = pool->free_objects;
 		pool->free_objects = o;
 	}
 }
 
-ObjectPool *objpool_alloc(size_t obj_size, size_t max_objects, const char *tag) {
+static void objpool_reset_free_list(ObjectPool *pool) {
+	pool->free_objects = NULL;
+
+	for(size_t i = pool->num_extents; i--;) {
+		objpool_register_objects(pool, pool->extents[i]);
+	}
+
+	objpool_register_objects(pool, pool->objects);
+	pool->num_unordered_frees = 0;
+}
+
+ObjectPool *objpool_alloc(size_t obj_size, size_t max_objects, const char *tag, ObjectPoolFlags flags) {
 	// TODO: overflow handling
 
 	ObjectPool *pool = calloc(1, sizeof(ObjectPool) + (obj_size * max_objects));
 	pool->size_of_object = obj_size;
 	pool->max_objects = max_objects;
+	pool->flags = flags;
 	pool->tag = strdup(tag);
 
 	objpool_register_objects(pool, pool->objects);
@@ -92,44 +121,166 @@ static char* objpool_fmt_size(ObjectPool *pool) {
 	}
 }
 
-void *objpool_acquire(ObjectPool *pool) {
+// must be called with the lock held
+static ObjHeader *objpool_pop(ObjectPool *pool) {
 	ObjHeader *obj = pool->free_objects;
 
-	if(obj) {
-acquired:
-		pool->free_objects = obj->next;
-		memset(obj, 0, pool->size_of_object);
+	if(UNLIKELY(obj == NULL)) {
+		char *tmp = objpool_fmt_size(pool);
+		log_debug("[%s] Object pool exhausted (%s), extending",
+			pool->tag,
+			tmp
+		);
+		free(tmp);
 
+		objpool_add_extent(pool);
+		obj = pool->free_objects;
+		assert(obj != NULL);
+	}
 #ifdef OBJPOOL_TRACK_STATS
-		if(++pool->usage > pool->peak_usage) {
-			pool->peak_usage = pool->usage;
-		}
+	else if(pool->usage == 0 && pool->num_unordered_frees > 0) {
+		// Nothing is alive, so we can restore the address order without sorting.
+		objpool_reset_free_list(pool);
+		obj = pool->free_objects;
+	}
+#endif
+
+	pool->free_objects = obj->next;
+
+#ifdef OBJPOOL_TRACK_STATS
+	if(++pool->usage > pool->peak_usage) {
+		pool->peak_usage = pool->usage;
+	}
 #endif
 
-		return obj;
+	return obj;
+}
+
+// must be called with the lock held
+static void objpool_push_chain(ObjectPool *pool, ObjHeader *first, ObjHeader *last, size_t num_objects) {
+	// Releasing objects in reverse acquisition order keeps the free list in order.
+	if(first != last || (pool->free_objects && (uintptr_t)first > (uintptr_t)pool->free_objects)) {
+		pool->num_unordered_frees += num_objects;
 	}
 
-	char *tmp = objpool_fmt_size(pool);
-	log_debug("[%s] Object pool exhausted (%s), extending",
-		pool->tag,
-		tmp
-	);
-	free(tmp);
+	last->next = pool->free_objects;
+	pool->free_objects = first;
 
-	objpool_add_extent(pool);
-	obj = pool->free_objects;
-	assert(obj != NULL);
-	goto acquired;
+#ifdef OBJPOOL_TRACK_STATS
+	assert(pool->usage >= num_objects);
+	pool->usage -= num_objects;
+#endif
+}
+
+void *objpool_acquire(ObjectPool *pool) {
+	objpool_lock(pool);
+	ObjHeader *obj = objpool_pop(pool);
+	objpool_unlock(pool);
+
+	memset(obj, 0, pool->size_of_object);
+	return obj;
+}
+
+void objpool_acquire_many(ObjectPool *pool, size_t num_objects, void *objects[num_objects]) {
+	objpool_lock(pool);
+
+	for(size_t i = 0; i < num_objects; ++i) {
+		objects[i] = objpool_pop(pool);
+	}
+
+	objpool_unlock(pool);
+
+	for(size_t i = 0; i < num_objects; ++i) {
+		memset(objects[i], 0, pool->size_of_object);
+	}
 }
 
 void objpool_release(ObjectPool *pool, void *object) {
 	objpool_memtest(pool, object);
 	ObjHeader *obj = object;
-	obj->next = pool->free_objects;
-	pool->free_objects = obj;
-#ifdef OBJPOOL_TRACK_STATS
-	pool->usage--;
+
+	objpool_lock(pool);
+	objpool_push_chain(pool, obj, obj, 1);
+	objpool_unlock(pool);
+}
+
+void objpool_release_list(ObjectPool *pool, ListAnchor *list, size_t num_objects) {
+	if(list->first == NULL) {
+		assert(num_objects == 0);
+		return;
+	}
+
+	// The list links double as free list links.
+	static_assert(offsetof(List, next) == offsetof(ObjHeader, next), "List and ObjHeader layouts differ");
+
+#ifdef OBJPOOL_DEBUG
+	size_t count = 0;
+
+	for(List *o = list->first; o; o = o->next) {
+		objpool_memtest(pool, o);
+		++count;
+	}
+
+	if(count != num_objects) {
+		log_fatal("[%s] Released list has %zu objects, expected %zu",
+			pool->tag,
+			count,
+			num_objects
+		);
+	}
 #endif
+
+	ObjHeader *first = CASTPTR_ASSUME_ALIGNED(list->first, ObjHeader);
+	ObjHeader *last = CASTPTR_ASSUME_ALIGNED(list->last, ObjHeader);
+
+	objpool_lock(pool);
+	objpool_push_chain(pool, first, last, num_objects);
+	objpool_unlock(pool);
+
+	list->first = list->last = NULL;
+}
+
+static int objpool_compare_addresses(const void *a, const void *b) {
+	uintptr_t pa = (uintptr_t)*(ObjHeader**)a;
+	uintptr_t pb = (uintptr_t)*(ObjHeader**)b;
+	return (pa > pb) - (pa < pb);
+}
+
+void objpool_sort_free_list(ObjectPool *pool) {
+	objpool_lock(pool);
+
+	if(pool->num_unordered_frees == 0) {
+		objpool_unlock(pool);
+		return;
+	}
+
+	pool->num_unordered_frees = 0;
+	size_t num_free = 0;
+
+	for(ObjHeader *o = pool->free_objects; o; o = o->next) {
+		++num_free;
+	}
+
+	if(num_free > 1) {
+		ObjHeader **sorted = calloc(num_free, sizeof(*sorted));
+		size_t i = 0;
+
+		for(ObjHeader *o = pool->free_objects; o; o = o->next) {
+			sorted[i++] = o;
+		}
+
+		qsort(sorted, num_free, sizeof(*sorted), objpool_compare_addresses);
+
+		for(i = 0; i < num_free - 1; ++i) {
+			sorted[i]->next = sorted[i + 1];
+		}
+
+		sorted[num_free - 1]->next = NULL;
+		pool->free_objects = sorted[0];
+		free(sorted);
+	}
+
+	objpool_unlock(pool);
 }
 
 void objpool_free(ObjectPool *pool) {
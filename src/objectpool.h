@@ -17,8 +17,10 @@
 	#define OBJPOOL_DEBUG
 #endif
 
+// Usage tracking is cheap, and benchmarks rely on it in release builds.
+#define OBJPOOL_TRACK_STATS
+
 #ifdef OBJPOOL_DEBUG
-	#define OBJPOOL_TRACK_STATS
 	#define IF_OBJPOOL_DEBUG(code) code
 #else
 	#define IF_OBJPOOL_DEBUG(code)
@@ -34,16 +36,38 @@ struct ObjectPoolStats {
 	size_t peak_usage;
 };
 
-#define OBJPOOL_ALLOC(typename,max_objects) objpool_alloc(sizeof(typename), max_objects, #typename)
+typedef enum ObjectPoolFlags {
+	// Guard the pool with a spinlock, so that objects may be acquired and
+	// released from any thread. Worker threads should prefer the bulk
+	// functions, which take the lock once per call.
+	OBJPOOL_CONCURRENT = (1 << 0),
+} ObjectPoolFlags;
+
+#define OBJPOOL_ALLOC(typename,max_objects) objpool_alloc(sizeof(typename), max_objects, #typename, 0)
+#define OBJPOOL_ALLOC_CONCURRENT(typename,max_objects) objpool_alloc(sizeof(typename), max_objects, #typename, OBJPOOL_CONCURRENT)
 #define OBJPOOL_ACQUIRE(pool, type) CASTPTR_ASSUME_ALIGNED(objpool_acquire(pool), type)
 
-ObjectPool *objpool_alloc(size_t obj_size, size_t max_objects, const char *tag) attr_returns_allocated attr_nonnull(3);
+ObjectPool *objpool_alloc(size_t obj_size, size_t max_objects, const char *tag, ObjectPoolFlags flags) attr_returns_allocated attr_nonnull(3);
 void objpool_free(ObjectPool *pool) attr_nonnull(1);
 void *objpool_acquire(ObjectPool *pool) attr_returns_allocated attr_hot attr_nonnull(1);
 void objpool_release(ObjectPool *pool, void *object) attr_hot attr_nonnull(1, 2);
 void objpool_get_stats(ObjectPool *pool, ObjectPoolStats *stats) attr_nonnull(1, 2);
 size_t objpool_object_size(ObjectPool *pool) attr_nonnull(1);
 
+// Acquire num_objects zeroed objects at once.
+void objpool_acquire_many(ObjectPool *pool, size_t num_objects, void *objects[num_objects]) attr_nonnull(1, 3);
+
+// Release every object in list at once, and empty the list. The objects must
+// begin with their LIST_INTERFACE, and num_objects must match the list length.
+// The list is not walked (except in debug builds), so this is O(1).
+void objpool_release_list(ObjectPool *pool, ListAnchor *list, size_t num_objects) attr_nonnull(1, 2);
+
+// Reorder the free objects by address, so that subsequently acquired objects
+// are laid out in memory roughly in acquisition order. Does nothing if no object
+// was released out of order since the last time. A pool that became empty is
+// also put back in order, without sorting, when it's next acquired from.
+void objpool_sort_free_list(ObjectPool *pool) attr_nonnull(1);
+
 #ifdef OBJPOOL_DEBUG
 void objpool_memtest(ObjectPool *pool, void *object) attr_nonnull(1, 2);
 #else
@@ -15,7 +15,7 @@ struct ObjectPool {
 	size_t size_of_object;
 };
 
-ObjectPool *objpool_alloc(size_t obj_size, size_t max_objects, const char *tag) {
+ObjectPool *objpool_alloc(size_t obj_size, size_t max_objects, const char *tag, ObjectPoolFlags flags) {
 	ObjectPool *pool = malloc(sizeof(ObjectPool));
 	pool->size_of_object = obj_size;
 	return pool;
@@ -29,6 +29,24 @@ void objpool_release(ObjectPool *pool, void *object) {
 	free(object);
 }
 
+void objpool_acquire_many(ObjectPool *pool, size_t num_objects, void *objects[num_objects]) {
+	for(size_t i = 0; i < num_objects; ++i) {
+		objects[i] = objpool_acquire(pool);
+	}
+}
+
+void objpool_release_list(ObjectPool *pool, ListAnchor *list, size_t num_objects) {
+	for(List *o = list->first, *next; o; o = next) {
+		next = o->next;
+		free(o);
+	}
+
+	list->first = list->last = NULL;
+}
+
+void objpool_sort_free_list(ObjectPool *pool) {
+}
+
 void objpool_free(ObjectPool *pool) {
 	free(pool);
 }
@@ -0,0 +1,152 @@
+/*
+ * This software is licensed under the terms of the MIT License.
+ * See COPYING for further information.
+ * ---
+ * Copyright (c) 2011-2019, Lukas Weber <laochailan@web.de>.
+ * Copyright (c) 2012-2019, Andrei Alexeyev <akari@taisei-project.org>.
+ */
+
+#include "taisei.h"
+
+#include "profiler.h"
+#include "util.h"
+
+typedef struct ProfEvent {
+	const char *name;
+	hrtime_t begin;
+	hrtime_t end;
+} ProfEvent;
+
+typedef struct ProfRing {
+	struct ProfRing *next;
+	SDL_threadID thread;
+	bool is_main_thread;
+	uint64_t num_recorded;
+	ProfEvent events[PROFILER_RING_SIZE];
+} ProfRing;
+
+static struct {
+	SDL_TLSID tls;
+	SDL_SpinLock lock;
+	ProfRing *rings;
+	char *output_path;
+	hrtime_t epoch;
+} profiler;
+
+bool _profiler_active;
+
+void profiler_init(void) {
+	const char *path = env_get("TAISEI_PROFILE_TRACE", NULL);
+
+	if(!path || !*path) {
+		return;
+	}
+
+	if(!(profiler.tls = SDL_TLSCreate())) {
+		log_sdl_error(LOG_WARN, "SDL_TLSCreate");
+		return;
+	}
+
+	profiler.output_path = strdup(path);
+	profiler.epoch = time_get();
+	_profiler_active = true;
+
+	log_info("Profiling enabled, trace will be written to %s", path);
+}
+
+void profiler_shutdown(void) {
+	if(!profiler.output_path) {
+		return;
+	}
+
+	_profiler_active = false;
+
+	if(profiler_export(profiler.output_path)) {
+		log_info("Profiler trace written to %s", profiler.output_path);
+	}
+
+	for(ProfRing *r = profiler.rings, *next; r; r = next) {
+		next = r->next;
+		free(r);
+	}
+
+	free(profiler.output_path);
+	memset(&profiler, 0, sizeof(profiler));
+}
+
+static ProfRing *profiler_get_ring(void) {
+	ProfRing *ring = SDL_TLSGet(profiler.tls);
+
+	if(UNLIKELY(ring == NULL)) {
+		// never freed with the thread, so that its zones can still be exported
+		ring = calloc(1, sizeof(*ring));
+		ring->thread = SDL_ThreadID();
+		ring->is_main_thread = is_main_thread();
+		SDL_TLSSet(profiler.tls, ring, NULL);
+
+		SDL_AtomicLock(&profiler.lock);
+		ring->next = profiler.rings;
+		profiler.rings = ring;
+		SDL_AtomicUnlock(&profiler.lock);
+	}
+
+	return ring;
+}
+
+void _profiler_record(const char *name, hrtime_t begin, hrtime_t end) {
+	ProfRing *ring = profiler_get_ring();
+	ProfEvent *e = ring->events + (ring->num_recorded++ % PROFILER_RING_SIZE);
+	e->name = name;
+	e->begin = begin;
+	e->end = end;
+}
+
+static double profiler_usec(hrtime_t t) {
+	return t / (double)(HRTIME_RESOLUTION / 1000000);
+}
+
+bool profiler_export(const char *path) {
+	SDL_RWops *out = SDL_RWFromFile(path, "w");
+
+	if(!out) {
+		log_error("Can't open %s for writing: %s", path, SDL_GetError());
+		return false;
+	}
+
+	SDL_AtomicLock(&profiler.lock);
+	ProfRing *rings = profiler.rings;
+	SDL_AtomicUnlock(&profiler.lock);
+
+	const char *sep = "";
+	SDL_RWprintf(out, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	for(ProfRing *r = rings; r; r = r->next) {
+		ulong tid = r->thread;
+
+		SDL_RWprintf(out,
+			"%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%lu,\"args\":{\"name\":\"%s\"}}",
+			sep, tid, r->is_main_thread ? "main" : "worker"
+		);
+		sep = ",\n";
+
+		uint64_t num = r->num_recorded;
+		uint64_t first = num > PROFILER_RING_SIZE ? num - PROFILER_RING_SIZE : 0;
+
+		for(uint64_t i = first; i < num; ++i) {
+			ProfEvent *e = r->events + (i % PROFILER_RING_SIZE);
+
+			if(e->begin < profiler.epoch) {
+				continue;
+			}
+
+			SDL_RWprintf(out,
+				"%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%lu,\"ts\":%.3f,\"dur\":%.3f}",
+				sep, e->name, tid, profiler_usec(e->begin - profiler.epoch), profiler_usec(e->end - e->begin)
+			);
+		}
+	}
+
+	SDL_RWprintf(out, "\n]}\n");
+	SDL_RWclose(out);
+	return true;
+}
@@ -0,0 +1,86 @@
+/*
+ * This software is licensed under the terms of the MIT License.
+ * See COPYING for further information.
+ * ---
+ * Copyright (c) 2011-2019, Lukas Weber <laochailan@web.de>.
+ * Copyright (c) 2012-2019, Andrei Alexeyev <akari@taisei-project.org>.
+ */
+
+#ifndef IGUARD_profiler_h
+#define IGUARD_profiler_h
+
+#include "taisei.h"
+
+#include "hirestime.h"
+
+/*
+ * Frame profiler.
+ *
+ * Code is instrumented with zones:
+ *
+ *     PROFILE_ZONE_BEGIN(z, "projectiles");
+ *     process_projectiles(&global.projs, true);
+ *     PROFILE_ZONE_END(z);
+ *
+ * Zone names must be string literals (or otherwise live forever); only the
+ * pointer is recorded. Zones may nest, and may be used from any thread.
+ *
+ * Recording is off unless the TAISEI_PROFILE_TRACE environment variable names
+ * an output file. While it's off, a zone costs one predictable branch. While
+ * it's on, every closed zone is appended to a per-thread ring buffer, which
+ * keeps the most recent PROFILER_RING_SIZE zones; no locks are taken. On
+ * shutdown the buffers are written out in Chrome's trace_event JSON format,
+ * which can be opened in chrome://tracing or ui.perfetto.dev.
+ *
+ * Configuring with -Dprofiler=false removes all of this at compile time.
+ */
+
+#ifdef TAISEI_BUILDCONF_PROFILER
+
+#define PROFILER_RING_SIZE (1 << 15)
+
+typedef struct ProfZone {
+	const char *name;
+	hrtime_t begin;
+} ProfZone;
+
+extern bool _profiler_active;
+
+void profiler_init(void);
+void profiler_shutdown(void);
+
+// Write everything recorded so far to path. Returns false on failure.
+// Other threads must not be recording zones while this runs.
+bool profiler_export(const char *path) attr_nonnull(1);
+
+void _profiler_record(const char *name, hrtime_t begin, hrtime_t end);
+
+INLINE ProfZone profiler_zone_begin(const char *name) {
+	if(LIKELY(!_profiler_active)) {
+		return (ProfZone) { 0 };
+	}
+
+	return (ProfZone) { name, time_get() };
+}
+
+INLINE void profiler_zone_end(ProfZone *zone) {
+	if(zone->name) {
+		_profiler_record(zone->name, zone->begin, time_get());
+	}
+}
+
+#define PROFILE_ZONE_BEGIN(var, name) ProfZone var = profiler_zone_begin(name)
+#define PROFILE_ZONE_END(var) profiler_zone_end(&(var))
+
+#else
+
+INLINE void profiler_init(void) { }
+INLINE void profiler_shutdown(void) { }
+INLINE bool profiler_export(const char *path) { return false; }
+
+#define PROFILE_ZONE_BEGIN(var, name) ((void)0)
+#define PROFILE_ZONE_END(var) ((void)0)
+
+#endif // TAISEI_BUILDCONF_PROFILER
+
+#endif // IGUARD_profiler_h
@@ -14,9 +14,97 @@
 #include "list.h"
 #include "stageobjects.h"
 #include "util/glm.h"
+#include "taskmanager.h"
+
+// Particles per parallel chunk of the batched motion pass.
+#define MOTION_BATCH_GRAIN 1024
 
 static ht_ptr2int_t shader_sublayer_map;
 
+/*
+ * Hot/cold split storage for the default motion of rule-less projectiles.
+ *
+ * The fields touched by move_update() and the automatic angle update are gathered
+ * into packed parallel arrays, advanced in one tight pass, and written back.
+ * Projectiles handled this way are tagged with PFLAG_INTERNAL_PREMOVED, so that
+ * proj_call_rule() doesn't move them a second time.
+ */
+static struct {
+	DYNAMIC_ARRAY(Projectile*) projs;
+	DYNAMIC_ARRAY(cmplx) pos;
+	DYNAMIC_ARRAY(cmplx) prevpos;
+	DYNAMIC_ARRAY(MoveParams) move;
+	DYNAMIC_ARRAY(ProjFlags) flags;
+	DYNAMIC_ARRAY(float) angle;
+	DYNAMIC_ARRAY(float) angle_delta;
+	uint num_projs;
+} motion_batch;
+
+/*
+ * Rule-less particles take a cheaper path through the same pass: their motion
+ * is purely visual, so it's done in single precision with move_update_batch_float().
+ */
+#define PARTICLE_BATCH_FLOATS(X) \
+	X(pos_x) X(pos_y) X(prev_x) X(prev_y) \
+	X(vel_x) X(vel_y) X(acc_x) X(acc_y) X(ret_x) X(ret_y) \
+	X(attr_x) X(attr_y) X(attr_px) X(attr_py) X(attr_max_speed) \
+	X(angle) X(angle_delta)
+
+static struct {
+	DYNAMIC_ARRAY(Projectile*) projs;
+	DYNAMIC_ARRAY(ProjFlags) flags;
+	#define PARTICLE_BATCH_DECLARE(field) DYNAMIC_ARRAY(float) field;
+	PARTICLE_BATCH_FLOATS(PARTICLE_BATCH_DECLARE)
+	#undef PARTICLE_BATCH_DECLARE
+	uint num_projs;
+} particle_batch;
+
+/*
+ * Default motion of rule-less projectiles in lists that collide with things.
+ *
+ * Those have to be moved in list order, interleaved with collision handling, since a
+ * collision may wake up tasks that touch other projectiles. move_update() depends on
+ * nothing but the position and MoveParams though, so the results are computed up front
+ * in one batch. When a projectile's turn comes, it takes its precomputed result only if
+ * both inputs are still bit-identical to the snapshot, otherwise it's moved as usual.
+ * Either way the outcome is exactly what move_update() would have produced.
+ */
+static struct {
+	DYNAMIC_ARRAY(uint32_t) spawn_ids;
+	DYNAMIC_ARRAY(cmplx) pos0;
+	DYNAMIC_ARRAY(MoveParams) move0;
+	DYNAMIC_ARRAY(cmplx) pos;
+	DYNAMIC_ARRAY(MoveParams) move;
+	uint num_projs;
+	uint cursor;
+} hazard_motion;
+
+/*
+ * Speculative broadphase for enemy projectile vs. player collision.
+ *
+ * Before the hazards are processed, the post-motion positions of rule-less enemy
+ * projectiles are taken from hazard_motion and culled against the player's swept
+ * segment in one batch. Projectiles are still processed strictly in order; a cached "miss" is only
+ * trusted if the projectile and the player ended up exactly where the prediction
+ * said they would, otherwise the full test is done as usual.
+ */
+static struct {
+	DYNAMIC_ARRAY(uint32_t) spawn_ids;
+	DYNAMIC_ARRAY(cmplx) pos;
+	DYNAMIC_ARRAY(cmplx) prevpos;
+	DYNAMIC_ARRAY(cmplx) size;
+	DYNAMIC_ARRAY(cmplx) collision_size;
+	DYNAMIC_ARRAY(double) ax;
+	DYNAMIC_ARRAY(double) ay;
+	DYNAMIC_ARRAY(double) bx;
+	DYNAMIC_ARRAY(double) by;
+	DYNAMIC_ARRAY(double) radius;
+	DYNAMIC_ARRAY(bool) miss;
+	LineSegment plr_seg;
+	uint num_projs;
+	uint cursor;
+} collision_batch;
+
 static ProjArgs defaults_proj = {
 	.sprite = "proj/",
 	.dest = &global.projs,
@@ -137,10 +225,28 @@ static inline char* event_name(int ev) {
 
 static Projectile* spawn_bullet_spawning_effect(Projectile *p);
 
+static inline bool proj_timed_out(Projectile *p, int t) {
+	return p->timeout > 0 && t >= p->timeout;
+}
+
+static inline void proj_update_auto_angle(Projectile *p) {
+	if(p->flags & PFLAG_MANUALANGLE) {
+		p->angle += p->angle_delta;
+	} else {
+		cmplx delta_pos = p->pos - p->prevpos;
+
+		if(delta_pos) {
+			p->angle = carg(delta_pos) + p->angle_delta;
+		}
+	}
+}
+
 static inline int proj_call_rule(Projectile *p, int t) {
 	int result = ACTION_NONE;
+	bool premoved = p->flags & PFLAG_INTERNAL_PREMOVED;
+	p->flags &= ~PFLAG_INTERNAL_PREMOVED;
 
-	if(p->timeout > 0 && t >= p->timeout) {
+	if(proj_timed_out(p, t)) {
 		result = ACTION_DESTROY;
 	} else if(p->rule != NULL) {
 		result = p->rule(p, t);
@@ -154,20 +260,12 @@ static inline int proj_call_rule(Projectile *p, int t) {
 				ACTION_ACK
 			);
 		}
-	} else if(t >= 0) {
+	} else if(t >= 0 && !premoved) {
 		if(!(p->flags & PFLAG_NOMOVE)) {
 			move_update(&p->pos, &p->move);
 		}
 
-		if(p->flags & PFLAG_MANUALANGLE) {
-			p->angle += p->angle_delta;
-		} else {
-			cmplx delta_pos = p->pos - p->prevpos;
-
-			if(delta_pos) {
-				p->angle = carg(delta_pos) + p->angle_delta;
-			}
-		}
+		proj_update_auto_angle(p);
 	}
 
 	if(/*t == 0 ||*/ t == EVENT_BIRTH) {
@@ -270,7 +368,7 @@ static Projectile* _create_projectile(ProjArgs *args) {
 	p->max_viewport_dist = args->max_viewport_dist;
 	p->size = args->size;
 	p->collision_size = args->collision_size;
-	p->flags = args->flags;
+	p->flags = args->flags & ~PFLAG_INTERNAL_PREMOVED;
 	p->timeout = args->timeout;
 	p->damage = args->damage;
 	p->damage_type = args->damage_type;
@@ -324,12 +422,15 @@ Projectile* _proj_attach_dbginfo(Projectile *p, DebugInfo *dbg, const char *call
 }
 #endif
 
-static void *_delete_projectile(ListAnchor *projlist, List *proj, void *arg) {
-	Projectile *p = (Projectile*)proj;
+static void finalize_projectile(Projectile *p) {
 	proj_call_rule(p, EVENT_DEATH);
 	coevent_signal_once(&p->events.killed);
 	COEVENT_CANCEL_ARRAY(p->events);
 	ent_unregister(&p->ent);
+}
+
+static void *_delete_projectile(ListAnchor *projlist, List *proj, void *arg) {
+	finalize_projectile((Projectile*)proj);
 	objpool_release(stage_object_pools.projectiles, alist_unlink(projlist, proj));
 	return NULL;
 }
@@ -339,10 +440,24 @@ static void delete_projectile(ProjectileList *projlist, Projectile *proj) {
 }
 
 void delete_projectiles(ProjectileList *projlist) {
-	alist_foreach(projlist, _delete_projectile, NULL);
+	size_t num_projs = 0;
+
+	// Everything stays linked until the end, then goes back to the pool in one go.
+	// The next pointer is read late, so that projectiles spawned by death rules
+	// are finalized as well.
+	for(Projectile *p = projlist->first; p; p = p->next) {
+		finalize_projectile(p);
+		++num_projs;
+	}
+
+	objpool_release_list(stage_object_pools.projectiles, (ListAnchor*)projlist, num_projs);
 }
 
-void calc_projectile_collision(Projectile *p, ProjCollisionResult *out_col) {
+static bool enemy_is_hittable(Enemy *e) {
+	return e->hp != ENEMY_IMMUNE;
+}
+
+static void calc_projectile_collision_internal(Projectile *p, ProjCollisionResult *out_col, bool known_player_miss) {
 	assert(out_col != NULL);
 
 	out_col->type = PCOL_NONE;
@@ -357,6 +472,10 @@ void calc_projectile_collision(Projectile *p, ProjCollisionResult *out_col) {
 	}
 
 	if(p->type == PROJ_ENEMY) {
+		if(known_player_miss) {
+			goto skip_collision;
+		}
+
 		Ellipse e_proj = {
 			.axes = p->collision_size,
 			.angle = p->angle + M_PI/2,
@@ -397,14 +516,14 @@ void calc_projectile_collision(Projectile *p, ProjCollisionResult *out_col) {
 			}
 		}
 	} else if(p->type == PROJ_PLAYER) {
-		for(Enemy *e = global.enemies.first; e; e = e->next) {
-			if(e->hp != ENEMY_IMMUNE && cabs(e->pos - p->pos) < 30) {
-				out_col->type = PCOL_ENTITY;
-				out_col->entity = &e->ent;
-				out_col->fatal = !(p->flags & PFLAG_INDESTRUCTIBLE);
+		Enemy *e = ent_find_enemy_in_radius(p->pos, 30, enemy_is_hittable);
 
-				return;
-			}
+		if(e != NULL) {
+			out_col->type = PCOL_ENTITY;
+			out_col->entity = &e->ent;
+			out_col->fatal = !(p->flags & PFLAG_INDESTRUCTIBLE);
+
+			return;
 		}
 
 		if(global.boss && cabs(global.boss->pos - p->pos) < 42) {
@@ -424,6 +543,10 @@ skip_collision:
 	}
 }
 
+void calc_projectile_collision(Projectile *p, ProjCollisionResult *out_col) {
+	calc_projectile_collision_internal(p, out_col, false);
+}
+
 void apply_projectile_collision(ProjectileList *projlist, Projectile *p, ProjCollisionResult *col) {
 	switch(col->type) {
 		case PCOL_NONE:
@@ -547,15 +670,414 @@ void kill_projectile(Projectile* proj) {
 	coevent_signal_once(&proj->events.killed);
 }
 
+static inline bool proj_uses_batched_motion(Projectile *p) {
+	return
+		p->rule == NULL &&
+		!(p->flags & (PFLAG_NOMOVE | PFLAG_INTERNAL_DEAD)) &&
+		!proj_timed_out(p, global.frames - p->birthtime);
+}
+
+static void motion_batch_reserve(uint capacity) {
+	dynarray_ensure_capacity(&motion_batch.projs, capacity);
+	dynarray_ensure_capacity(&motion_batch.pos, capacity);
+	dynarray_ensure_capacity(&motion_batch.prevpos, capacity);
+	dynarray_ensure_capacity(&motion_batch.move, capacity);
+	dynarray_ensure_capacity(&motion_batch.flags, capacity);
+	dynarray_ensure_capacity(&motion_batch.angle, capacity);
+	dynarray_ensure_capacity(&motion_batch.angle_delta, capacity);
+}
+
+static void particle_batch_reserve(uint capacity) {
+	dynarray_ensure_capacity(&particle_batch.projs, capacity);
+	dynarray_ensure_capacity(&particle_batch.flags, capacity);
+	#define PARTICLE_BATCH_RESERVE(field) dynarray_ensure_capacity(&particle_batch.field, capacity);
+	PARTICLE_BATCH_FLOATS(PARTICLE_BATCH_RESERVE)
+	#undef PARTICLE_BATCH_RESERVE
+}
+
+static void particle_batch_add(Projectile *p) {
+	uint n = particle_batch.num_projs++;
+
+	if(n == particle_batch.projs.capacity) {
+		particle_batch_reserve(imax(64, n * 2));
+	}
+
+	particle_batch.projs.data[n] = p;
+	particle_batch.flags.data[n] = p->flags;
+	particle_batch.pos_x.data[n] = particle_batch.prev_x.data[n] = creal(p->pos);
+	particle_batch.pos_y.data[n] = particle_batch.prev_y.data[n] = cimag(p->pos);
+	particle_batch.vel_x.data[n] = creal(p->move.velocity);
+	particle_batch.vel_y.data[n] = cimag(p->move.velocity);
+	particle_batch.acc_x.data[n] = creal(p->move.acceleration);
+	particle_batch.acc_y.data[n] = cimag(p->move.acceleration);
+	particle_batch.ret_x.data[n] = creal(p->move.retention);
+	particle_batch.ret_y.data[n] = cimag(p->move.retention);
+	particle_batch.attr_x.data[n] = creal(p->move.attraction);
+	particle_batch.attr_y.data[n] = cimag(p->move.attraction);
+	particle_batch.attr_px.data[n] = creal(p->move.attraction_point);
+	particle_batch.attr_py.data[n] = cimag(p->move.attraction_point);
+	particle_batch.attr_max_speed.data[n] = p->move.attraction_max_speed;
+	particle_batch.angle.data[n] = p->angle;
+	particle_batch.angle_delta.data[n] = p->angle_delta;
+}
+
+static void particle_batch_update_range(uint begin, uint end, void *arg) {
+	uint n = end - begin;
+
+	MoveBatchFloat b = {
+		#define PARTICLE_BATCH_SLICE(field) .field = particle_batch.field.data + begin,
+		PARTICLE_BATCH_SLICE(pos_x) PARTICLE_BATCH_SLICE(pos_y)
+		PARTICLE_BATCH_SLICE(vel_x) PARTICLE_BATCH_SLICE(vel_y)
+		PARTICLE_BATCH_SLICE(acc_x) PARTICLE_BATCH_SLICE(acc_y)
+		PARTICLE_BATCH_SLICE(ret_x) PARTICLE_BATCH_SLICE(ret_y)
+		PARTICLE_BATCH_SLICE(attr_x) PARTICLE_BATCH_SLICE(attr_y)
+		PARTICLE_BATCH_SLICE(attr_px) PARTICLE_BATCH_SLICE(attr_py)
+		PARTICLE_BATCH_SLICE(attr_max_speed)
+		#undef PARTICLE_BATCH_SLICE
+	};
+
+	move_update_batch_float(n, &b);
+
+	ProjFlags *restrict flags = particle_batch.flags.data + begin;
+	float *restrict prev_x = particle_batch.prev_x.data + begin;
+	float *restrict prev_y = particle_batch.prev_y.data + begin;
+	float *restrict angle = particle_batch.angle.data + begin;
+	float *restrict angle_delta = particle_batch.angle_delta.data + begin;
+
+	// Same as the rule-less branch of proj_call_rule()
+	for(uint i = 0; i < n; ++i) {
+		if(flags[i] & PFLAG_MANUALANGLE) {
+			angle[i] += angle_delta[i];
+		} else {
+			float dx = b.pos_x[i] - prev_x[i];
+			float dy = b.pos_y[i] - prev_y[i];
+
+			if(dx || dy) {
+				angle[i] = atan2f(dy, dx) + angle_delta[i];
+			}
+		}
+	}
+}
+
+static void particle_batch_scatter(void) {
+	for(uint i = 0; i < particle_batch.num_projs; ++i) {
+		Projectile *p = particle_batch.projs.data[i];
+		p->prevpos = p->pos;
+		p->pos = CMPLX(particle_batch.pos_x.data[i], particle_batch.pos_y.data[i]);
+		p->move.velocity = CMPLX(particle_batch.vel_x.data[i], particle_batch.vel_y.data[i]);
+		p->angle = particle_batch.angle.data[i];
+		p->flags |= PFLAG_INTERNAL_PREMOVED;
+	}
+
+	particle_batch.num_projs = 0;
+}
+
+static void motion_batch_gather(ProjectileList *projlist) {
+	uint n = 0;
+
+	for(Projectile *p = projlist->first; p; p = p->next) {
+		if(!proj_uses_batched_motion(p)) {
+			continue;
+		}
+
+		if(p->type == PROJ_PARTICLE) {
+			particle_batch_add(p);
+			continue;
+		}
+
+		if(n == motion_batch.projs.capacity) {
+			motion_batch_reserve(imax(64, n * 2));
+		}
+
+		motion_batch.projs.data[n] = p;
+		motion_batch.pos.data[n] = p->pos;
+		motion_batch.prevpos.data[n] = p->pos;
+		motion_batch.move.data[n] = p->move;
+		motion_batch.flags.data[n] = p->flags;
+		motion_batch.angle.data[n] = p->angle;
+		motion_batch.angle_delta.data[n] = p->angle_delta;
+		++n;
+	}
+
+	motion_batch.num_projs = n;
+}
+
+static void motion_batch_update_range(uint begin, uint end, void *arg) {
+	uint n = end - begin;
+	cmplx *restrict pos = motion_batch.pos.data + begin;
+	cmplx *restrict prevpos = motion_batch.prevpos.data + begin;
+	ProjFlags *restrict flags = motion_batch.flags.data + begin;
+	float *restrict angle = motion_batch.angle.data + begin;
+	float *restrict angle_delta = motion_batch.angle_delta.data + begin;
+
+	move_update_batch(n, pos, motion_batch.move.data + begin);
+
+	// Same as the rule-less branch of proj_call_rule()
+	for(uint i = 0; i < n; ++i) {
+		if(flags[i] & PFLAG_MANUALANGLE) {
+			angle[i] += angle_delta[i];
+		} else {
+			cmplx delta_pos = pos[i] - prevpos[i];
+
+			if(delta_pos) {
+				angle[i] = carg(delta_pos) + angle_delta[i];
+			}
+		}
+	}
+}
+
+static void motion_batch_update(void) {
+	// Every element is independent of the others, so splitting this up doesn't change the result.
+	taskmgr_global_parallel_for(motion_batch.num_projs, MOTION_BATCH_GRAIN, motion_batch_update_range, NULL);
+	taskmgr_global_parallel_for(particle_batch.num_projs, MOTION_BATCH_GRAIN, particle_batch_update_range, NULL);
+}
+
+static void motion_batch_scatter(void) {
+	for(uint i = 0; i < motion_batch.num_projs; ++i) {
+		Projectile *p = motion_batch.projs.data[i];
+		p->prevpos = motion_batch.prevpos.data[i];
+		p->pos = motion_batch.pos.data[i];
+		p->move = motion_batch.move.data[i];
+		p->angle = motion_batch.angle.data[i];
+		p->flags |= PFLAG_INTERNAL_PREMOVED;
+	}
+
+	motion_batch.num_projs = 0;
+	particle_batch_scatter();
+}
+
+static void process_projectiles_batched_motion(ProjectileList *projlist) {
+	motion_batch_gather(projlist);
+	motion_batch_update();
+	motion_batch_scatter();
+}
+
+static void hazard_motion_reserve(uint capacity) {
+	dynarray_ensure_capacity(&hazard_motion.spawn_ids, capacity);
+	dynarray_ensure_capacity(&hazard_motion.pos0, capacity);
+	dynarray_ensure_capacity(&hazard_motion.move0, capacity);
+	dynarray_ensure_capacity(&hazard_motion.pos, capacity);
+	dynarray_ensure_capacity(&hazard_motion.move, capacity);
+}
+
+static void hazard_motion_update_range(uint begin, uint end, void *arg) {
+	move_update_batch(end - begin, hazard_motion.pos.data + begin, hazard_motion.move.data + begin);
+}
+
+static void hazard_motion_prepare(ProjectileList *projlist) {
+	uint n = 0;
+
+	for(Projectile *p = projlist->first; p; p = p->next) {
+		if(!proj_uses_batched_motion(p)) {
+			continue;
+		}
+
+		if(n == hazard_motion.spawn_ids.capacity) {
+			hazard_motion_reserve(imax(64, n * 2));
+		}
+
+		hazard_motion.spawn_ids.data[n] = p->ent.spawn_id;
+		hazard_motion.pos0.data[n] = hazard_motion.pos.data[n] = p->pos;
+		hazard_motion.move0.data[n] = hazard_motion.move.data[n] = p->move;
+		++n;
+	}
+
+	hazard_motion.num_projs = n;
+	hazard_motion.cursor = 0;
+
+	// Every element is independent of the others, so splitting this up doesn't change the result.
+	taskmgr_global_parallel_for(n, MOTION_BATCH_GRAIN, hazard_motion_update_range, NULL);
+}
+
+static void hazard_motion_apply(Projectile *p) {
+	// Projectiles are always appended, so the list is sorted by spawn_id.
+	// Entries for projectiles that were removed in the meantime are simply skipped.
+
+	uint n = hazard_motion.num_projs;
+	uint i = hazard_motion.cursor;
+
+	while(i < n && hazard_motion.spawn_ids.data[i] < p->ent.spawn_id) {
+		++i;
+	}
+
+	hazard_motion.cursor = i;
+
+	if(i == n || hazard_motion.spawn_ids.data[i] != p->ent.spawn_id) {
+		return;
+	}
+
+	hazard_motion.cursor = i + 1;
+
+	if(
+		!proj_uses_batched_motion(p) ||
+		memcmp(&p->pos, hazard_motion.pos0.data + i, sizeof(p->pos)) ||
+		memcmp(&p->move, hazard_motion.move0.data + i, sizeof(p->move))
+	) {
+		return;
+	}
+
+	// Same as the rule-less branch of proj_call_rule()
+	p->pos = hazard_motion.pos.data[i];
+	p->move = hazard_motion.move.data[i];
+	proj_update_auto_angle(p);
+	p->flags |= PFLAG_INTERNAL_PREMOVED;
+}
+
+static inline bool proj_uses_collision_batch(Projectile *p) {
+	return
+		p->type == PROJ_ENEMY &&
+		p->rule == NULL &&
+		!(p->flags & (PFLAG_NOCOLLISION | PFLAG_INTERNAL_DEAD)) &&
+		!proj_timed_out(p, global.frames - p->birthtime);
+}
+
+static void collision_batch_reserve(uint capacity) {
+	dynarray_ensure_capacity(&collision_batch.spawn_ids, capacity);
+	dynarray_ensure_capacity(&collision_batch.pos, capacity);
+	dynarray_ensure_capacity(&collision_batch.prevpos, capacity);
+	dynarray_ensure_capacity(&collision_batch.size, capacity);
+	dynarray_ensure_capacity(&collision_batch.collision_size, capacity);
+	dynarray_ensure_capacity(&collision_batch.ax, capacity);
+	dynarray_ensure_capacity(&collision_batch.ay, capacity);
+	dynarray_ensure_capacity(&collision_batch.bx, capacity);
+	dynarray_ensure_capacity(&collision_batch.by, capacity);
+	dynarray_ensure_capacity(&collision_batch.radius, capacity);
+	dynarray_ensure_capacity(&collision_batch.miss, capacity);
+}
+
+static inline LineSegment player_swept_segment(void) {
+	return (LineSegment) {
+		.a = global.plr.pos - global.plr.velocity,
+		.b = global.plr.pos,
+	};
+}
+
+static void collision_batch_prepare(ProjectileList *projlist) {
+	uint n = 0;
+	uint m = 0;
+
+	// Must run after hazard_motion_prepare(). Both walk the same list in order.
+	for(Projectile *p = projlist->first; p; p = p->next) {
+		bool batched = (
+			m < hazard_motion.num_projs &&
+			hazard_motion.spawn_ids.data[m] == p->ent.spawn_id
+		);
+
+		uint motion_index = m;
+		m += batched;
+
+		if(!proj_uses_collision_batch(p)) {
+			continue;
+		}
+
+		if(n == collision_batch.spawn_ids.capacity) {
+			collision_batch_reserve(imax(64, n * 2));
+		}
+
+		collision_batch.spawn_ids.data[n] = p->ent.spawn_id;
+		collision_batch.pos.data[n] = batched ? hazard_motion.pos.data[motion_index] : p->pos;
+		collision_batch.prevpos.data[n] = p->pos;
+		collision_batch.size.data[n] = p->size;
+		collision_batch.collision_size.data[n] = p->collision_size;
+
+		++n;
+	}
+
+	collision_batch.num_projs = n;
+	collision_batch.cursor = 0;
+
+	if(n == 0) {
+		return;
+	}
+
+	LineSegment seg = player_swept_segment();
+	collision_batch.plr_seg = seg;
+
+	for(uint i = 0; i < n; ++i) {
+		cmplx a = seg.a - collision_batch.prevpos.data[i];
+		cmplx b = seg.b - collision_batch.pos.data[i];
+		cmplx cs = collision_batch.collision_size.data[i];
+		cmplx gs = collision_batch.size.data[i] * 420;  // see projectile_graze_size()
+
+		collision_batch.ax.data[i] = creal(a);
+		collision_batch.ay.data[i] = cimag(a);
+		collision_batch.bx.data[i] = creal(b);
+		collision_batch.by.data[i] = cimag(b);
+
+		// Upper bound of both the hitbox and the graze ellipse, padded to absorb any rounding.
+		collision_batch.radius.data[i] = 1 + 0.5 * fmax(
+			fmax(creal(cs), cimag(cs)),
+			fmax(sqrt(creal(gs)), sqrt(cimag(gs)))
+		);
+	}
+
+	lineseg_ellipse_cull_batch(
+		n,
+		collision_batch.ax.data, collision_batch.ay.data,
+		collision_batch.bx.data, collision_batch.by.data,
+		collision_batch.radius.data,
+		collision_batch.miss.data
+	);
+}
+
+static bool collision_batch_known_miss(Projectile *p) {
+	// Projectiles are always appended, so the list is sorted by spawn_id.
+	// Entries for projectiles that were removed in the meantime are simply skipped.
+
+	uint n = collision_batch.num_projs;
+	uint i = collision_batch.cursor;
+
+	while(i < n && collision_batch.spawn_ids.data[i] < p->ent.spawn_id) {
+		++i;
+	}
+
+	collision_batch.cursor = i;
+
+	if(i == n || collision_batch.spawn_ids.data[i] != p->ent.spawn_id) {
+		return false;
+	}
+
+	collision_batch.cursor = i + 1;
+
+	if(!collision_batch.miss.data[i]) {
+		return false;
+	}
+
+	LineSegment seg = player_swept_segment();
+
+	return
+		seg.a == collision_batch.plr_seg.a &&
+		seg.b == collision_batch.plr_seg.b &&
+		p->pos == collision_batch.pos.data[i] &&
+		p->prevpos == collision_batch.prevpos.data[i] &&
+		p->size == collision_batch.size.data[i] &&
+		p->collision_size == collision_batch.collision_size.data[i];
+}
+
 void process_projectiles(ProjectileList *projlist, bool collision) {
 	ProjCollisionResult col = { 0 };
 
 	int action;
 	bool stage_cleared = stage_is_cleared();
 
+	if(!collision) {
+		// NOTE: Only done for lists that don't collide with anything (i.e. particles).
+		// Moving everything up-front changes the order of movement relative to the side
+		// effects of other projectiles' collisions (which can wake up tasks and touch
+		// other projectiles), and hazards must stay bit-exact for replays.
+		process_projectiles_batched_motion(projlist);
+	} else {
+		// Hazards are still moved in order, see hazard_motion.
+		hazard_motion_prepare(projlist);
+		collision_batch_prepare(projlist);
+	}
+
 	for(Projectile *proj = projlist->first, *next; proj; proj = next) {
 		next = proj->next;
-		proj->prevpos = proj->pos;
+
+		if(!(proj->flags & PFLAG_INTERNAL_PREMOVED)) {
+			proj->prevpos = proj->pos;
+		}
 
 		if(proj->flags & PFLAG_INTERNAL_DEAD) {
 			delete_projectile(projlist, proj);
@@ -566,6 +1088,10 @@ void process_projectiles(ProjectileList *projlist, bool collision) {
 			clear_projectile(proj, CLEAR_HAZARDS_BULLETS | CLEAR_HAZARDS_FORCE);
 		}
 
+		if(collision) {
+			hazard_motion_apply(proj);
+		}
+
 		action = proj_call_rule(proj, global.frames - proj->birthtime);
 
 		if(proj->graze_counter && proj->graze_counter_reset_timer - global.frames <= -90) {
@@ -581,7 +1107,7 @@ void process_projectiles(ProjectileList *projlist, bool collision) {
 			memset(&col, 0, sizeof(col));
 			col.fatal = true;
 		} else if(collision) {
-			calc_projectile_collision(proj, &col);
+			calc_projectile_collision_internal(proj, &col, collision_batch_known_miss(proj));
 
 			if(col.fatal && col.type != PCOL_VOID) {
 				spawn_projectile_collision_effect(proj);
@@ -1235,4 +1761,35 @@ void projectiles_preload(void) {
 
 void projectiles_free(void) {
 	ht_destroy(&shader_sublayer_map);
+	dynarray_free_data(&motion_batch.projs);
+	dynarray_free_data(&motion_batch.pos);
+	dynarray_free_data(&motion_batch.prevpos);
+	dynarray_free_data(&motion_batch.move);
+	dynarray_free_data(&motion_batch.flags);
+	dynarray_free_data(&motion_batch.angle);
+	dynarray_free_data(&motion_batch.angle_delta);
+
+	dynarray_free_data(&particle_batch.projs);
+	dynarray_free_data(&particle_batch.flags);
+	#define PARTICLE_BATCH_FREE(field) dynarray_free_data(&particle_batch.field);
+	PARTICLE_BATCH_FLOATS(PARTICLE_BATCH_FREE)
+	#undef PARTICLE_BATCH_FREE
+
+	dynarray_free_data(&hazard_motion.spawn_ids);
+	dynarray_free_data(&hazard_motion.pos0);
+	dynarray_free_data(&hazard_motion.move0);
+	dynarray_free_data(&hazard_motion.pos);
+	dynarray_free_data(&hazard_motion.move);
+
+	dynarray_free_data(&collision_batch.spawn_ids);
+	dynarray_free_data(&collision_batch.pos);
+	dynarray_free_data(&collision_batch.prevpos);
+	dynarray_free_data(&collision_batch.size);
+	dynarray_free_data(&collision_batch.collision_size);
+	dynarray_free_data(&collision_batch.ax);
+	dynarray_free_data(&collision_batch.ay);
+	dynarray_free_data(&collision_batch.bx);
+	dynarray_free_data(&collision_batch.by);
+	dynarray_free_data(&collision_batch.radius);
+	dynarray_free_data(&collision_batch.miss);
 }
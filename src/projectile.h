@@ -82,6 +82,7 @@ typedef enum ProjFlags {
 	PFLAG_MANUALANGLE = (1 << 14),          // [ALL] Don't automatically update the angle.
 	PFLAG_NOAUTOREMOVE = (1 << 15),         // [ALL] Don't automatically remove when outside viewport.
 	PFLAG_INDESTRUCTIBLE = (1 << 16),       // [PROJ_ENEMY, PROJ_PLAYER] Projectile doesn't get destroyed on collision.
+	PFLAG_INTERNAL_PREMOVED = (1 << 17),    // [ALL] Default motion was already applied by the batched pass. (internal flag, do not use)
 
 	PFLAG_NOSPAWNEFFECTS = PFLAG_NOSPAWNFADE | PFLAG_NOSPAWNFLARE,
 } ProjFlags;
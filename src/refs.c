@@ -11,12 +11,6 @@
 #include "global.h"
 #include "refs.h"
 
-/*
- * NOTE: if you're here to attempt fixing any of this braindeath, better just delete the file and start over
- */
-
-void *_FREEREF;
-
 #ifdef DEBUG
 	// #define DEBUG_REFS
 #endif
@@ -27,71 +21,133 @@ void *_FREEREF;
 	#define REFLOG(...)
 #endif
 
+#define REF_NO_SLOT (-1)
+
+static RefArray *refs_get(void) {
+	RefArray *refs = &global.refs;
+
+	if(UNLIKELY(!refs->initialized)) {
+		ht_create(&refs->slot_map);
+		refs->first_free = REF_NO_SLOT;
+		refs->initialized = true;
+	}
+
+	return refs;
+}
+
+static int ref_handle(RefArray *refs, int idx) {
+	Reference *r = dynarray_get_ptr(&refs->slots, idx);
+	return idx | (int)(r->generation << REF_INDEX_BITS);
+}
+
 int add_ref(void *ptr) {
-	int i, firstfree = -1;
-
-	for(i = 0; i < global.refs.count; i++) {
-		if(global.refs.ptrs[i].ptr == ptr) {
-			global.refs.ptrs[i].refs++;
-			REFLOG("increased refcount for %p (ref %i): %i", ptr, i, global.refs.ptrs[i].refs);
-			return i;
-		} else if(firstfree < 0 && global.refs.ptrs[i].ptr == FREEREF) {
-			firstfree = i;
-		}
+	RefArray *refs = refs_get();
+	int64_t idx;
+
+	if(ht_lookup(&refs->slot_map, ptr, &idx)) {
+		Reference *r = dynarray_get_ptr(&refs->slots, idx);
+		r->refs++;
+		REFLOG("increased refcount for %p (ref %i): %i", ptr, (int)idx, r->refs);
+		return ref_handle(refs, idx);
 	}
 
-	if(firstfree >= 0) {
-		global.refs.ptrs[firstfree].ptr = ptr;
-		global.refs.ptrs[firstfree].refs = 1;
-		REFLOG("found free ref for %p: %i", ptr, firstfree);
-		return firstfree;
+	Reference *r;
+
+	if(refs->first_free != REF_NO_SLOT) {
+		idx = refs->first_free;
+		r = dynarray_get_ptr(&refs->slots, idx);
+		refs->first_free = r->next_free;
+		REFLOG("found free ref for %p: %i", ptr, (int)idx);
+	} else {
+		idx = refs->slots.num_elements;
+
+		if(idx > REF_INDEX_MASK) {
+			log_fatal("Too many refs allocated");
+		}
+
+		r = dynarray_append(&refs->slots);
+		r->generation = 0;
+		REFLOG("new ref for %p: %i", ptr, (int)idx);
 	}
 
-	global.refs.ptrs = realloc(global.refs.ptrs, (++global.refs.count)*sizeof(Reference));
-	global.refs.ptrs[global.refs.count - 1].ptr = ptr;
-	global.refs.ptrs[global.refs.count - 1].refs = 1;
-	REFLOG("new ref for %p: %i", ptr, global.refs.count - 1);
+	r->ptr = ptr;
+	r->refs = 1;
+	r->next_free = REF_NO_SLOT;
+	ht_set(&refs->slot_map, ptr, idx);
 
-	return global.refs.count - 1;
+	return ref_handle(refs, idx);
 }
 
 void del_ref(void *ptr) {
-	int i;
+	RefArray *refs = &global.refs;
+	int64_t idx;
 
-	for(i = 0; i < global.refs.count; i++)
-		if(global.refs.ptrs[i].ptr == ptr)
-			global.refs.ptrs[i].ptr = NULL;
+	if(!refs->initialized || !ht_lookup(&refs->slot_map, ptr, &idx)) {
+		return;
+	}
+
+	// The slot stays allocated until the holders release it; the object's
+	// address may be reused by a new object in the meantime, though.
+	dynarray_get_ptr(&refs->slots, idx)->ptr = NULL;
+	ht_unset(&refs->slot_map, ptr);
 }
 
-void free_ref(int i) {
-	if(i < 0)
+void free_ref(int ref) {
+	if(ref < 0) {
+		return;
+	}
+
+	RefArray *refs = &global.refs;
+	int idx = ref & REF_INDEX_MASK;
+	assert(refs->initialized);
+	assert(idx < refs->slots.num_elements);
+
+	Reference *r = dynarray_get_ptr(&refs->slots, idx);
+
+	if(r->generation != ((uint)ref >> REF_INDEX_BITS) || r->refs <= 0) {
+		log_warn("Attempted to free stale ref %i", ref);
 		return;
+	}
+
+	r->refs--;
+	REFLOG("decreased refcount for %p (ref %i): %i", r->ptr, idx, r->refs);
 
-	global.refs.ptrs[i].refs--;
-	REFLOG("decreased refcount for %p (ref %i): %i", global.refs.ptrs[i].ptr, i, global.refs.ptrs[i].refs);
+	if(r->refs <= 0) {
+		if(r->ptr) {
+			ht_unset(&refs->slot_map, r->ptr);
+		}
 
-	if(global.refs.ptrs[i].refs <= 0) {
-		global.refs.ptrs[i].ptr = FREEREF;
-		global.refs.ptrs[i].refs = 0;
-		REFLOG("ref %i is now free", i);
+		r->ptr = NULL;
+		r->refs = 0;
+		r->generation = (r->generation + 1) & REF_GENERATION_MASK;
+		r->next_free = refs->first_free;
+		refs->first_free = idx;
+		REFLOG("ref %i is now free", idx);
 	}
 }
 
 void free_all_refs(void) {
+	RefArray *refs = &global.refs;
+
+	if(!refs->initialized) {
+		return;
+	}
+
 	int inuse = 0;
 	int inuse_unique = 0;
 
-	for(int i = 0; i < global.refs.count; i++) {
-		if(global.refs.ptrs[i].refs) {
-			inuse += global.refs.ptrs[i].refs;
+	dynarray_foreach_elem(&refs->slots, Reference *r, {
+		if(r->refs) {
+			inuse += r->refs;
 			inuse_unique += 1;
 		}
-	}
+	});
 
 	if(inuse) {
-		log_warn("%i refs were still in use (%i unique, %i total allocated)", inuse, inuse_unique, global.refs.count);
+		log_warn("%i refs were still in use (%i unique, %i total allocated)", inuse, inuse_unique, refs->slots.num_elements);
 	}
 
-	free(global.refs.ptrs);
-	memset(&global.refs, 0, sizeof(RefArray));
+	dynarray_free_data(&refs->slots);
+	ht_destroy(&refs->slot_map);
+	memset(refs, 0, sizeof(*refs));
 }
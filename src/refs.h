@@ -11,26 +11,60 @@
 
 #include "taisei.h"
 
+#include "dynarray.h"
+#include "hashtable.h"
+
 /*
- * NOTE: if you're here to attempt fixing any of this braindeath, better just delete the file and start over
+ * Refcounted handles to game objects, for code that stores them in numeric
+ * (cmplx) arguments.
+ *
+ * A handle is a slot index plus the generation of that slot. Slots are reused
+ * through a free list, and a pointer -> slot map lets add_ref find an existing
+ * reference to the same object, so every operation is constant time. Once the
+ * last reference to a slot is released, its generation is bumped, and any stale
+ * handles to it resolve to NULL instead of whatever object takes the slot next.
+ *
+ * del_ref is called when an object dies: its handles resolve to NULL from then
+ * on, but stay allocated until they are released with free_ref.
  */
 
+#define REF_INDEX_BITS 20
+#define REF_GENERATION_BITS 10
+#define REF_INDEX_MASK ((1 << REF_INDEX_BITS) - 1)
+#define REF_GENERATION_MASK ((1 << REF_GENERATION_BITS) - 1)
+
 typedef struct {
 	void *ptr;
 	int refs;
+	uint generation;
+	int next_free;
 } Reference;
 
 typedef struct {
-	Reference *ptrs;
-	int count;
+	DYNAMIC_ARRAY(Reference) slots;
+	ht_ptr2int_t slot_map;  // live object -> slot index
+	int first_free;
+	bool initialized;
 } RefArray;
 
-extern void *_FREEREF;
-#define FREEREF &_FREEREF
-#define REF(p) (global.refs.ptrs[(int)(p)].ptr)
+INLINE void *_ref_get(RefArray *refs, int ref) {
+	uint idx = ref & REF_INDEX_MASK;
+	assert(ref >= 0);
+	assert(idx < refs->slots.num_elements);
+
+	Reference *r = dynarray_get_ptr(&refs->slots, idx);
+
+	if(UNLIKELY(r->generation != ((uint)ref >> REF_INDEX_BITS))) {
+		return NULL;
+	}
+
+	return r->ptr;
+}
+
+#define REF(p) _ref_get(&global.refs, (int)(p))
 int add_ref(void *ptr);
 void del_ref(void *ptr);
-void free_ref(int i);
+void free_ref(int ref);
 void free_all_refs(void);
 
 #define UPDATE_REF(ref, ptr) ((ptr) = REF(ref))
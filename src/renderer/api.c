@@ -205,6 +205,7 @@ static VertexAttribTypeInfo va_type_info[] = {
 	[VA_USHORT] = VATYPE(uint16_t),
 	[VA_INT]    = VATYPE(int32_t),
 	[VA_UINT]   = VATYPE(uint32_t),
+	[VA_HALF]   = VATYPE(uint16_t),
 };
 
 const VertexAttribTypeInfo* r_vertex_attrib_type_info(VertexAttribType type) {
@@ -354,6 +355,7 @@ ShaderProgram* r_shader_program_link(uint num_objects, ShaderObject *shobjs[num_
 }
 
 void r_shader_program_destroy(ShaderProgram *prog) {
+	_r_sprite_batch_shader_deleted(prog);
 	B.shader_program_destroy(prog);
 }
 
@@ -509,6 +511,10 @@ IntExtent r_framebuffer_get_size(Framebuffer *fb) {
 	return B.framebuffer_get_size(fb);
 }
 
+void r_framebuffer_read_async(Framebuffer *fb, FramebufferAttachment attachment, IntRect region, void *userdata, FramebufferReadAsyncCallback callback) {
+	B.framebuffer_read_async(fb, attachment, region, userdata, callback);
+}
+
 Framebuffer * r_framebuffer_current(void) {
 	return B.framebuffer_current();
 }
@@ -537,6 +543,14 @@ SDL_RWops* r_vertex_buffer_get_stream(VertexBuffer *vbuf) {
 	return B.vertex_buffer_get_stream(vbuf);
 }
 
+void* r_vertex_buffer_reserve(VertexBuffer *vbuf, size_t min_size, size_t *out_available) {
+	return B.vertex_buffer_reserve(vbuf, min_size, out_available);
+}
+
+void r_vertex_buffer_commit(VertexBuffer *vbuf, size_t size) {
+	B.vertex_buffer_commit(vbuf, size);
+}
+
 IndexBuffer* r_index_buffer_create(size_t max_elements) {
 	return B.index_buffer_create(max_elements);
 }
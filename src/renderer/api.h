@@ -170,6 +170,7 @@ typedef enum VertexAttribType {
 	VA_USHORT,
 	VA_INT,
 	VA_UINT,
+	VA_HALF,
 } VertexAttribType;
 
 typedef struct VertexAttribTypeInfo {
@@ -260,8 +261,8 @@ typedef enum BlendModeComponent {
 
 typedef enum BlendOp {
 	BLENDOP_ADD     = 0x1, // dst + src
-	BLENDOP_SUB     = 0x2, // dst - src
-	BLENDOP_REV_SUB = 0x3, // src - dst
+	BLENDOP_SUB     = 0x2, // src - dst
+	BLENDOP_REV_SUB = 0x3, // dst - src
 	BLENDOP_MIN     = 0x4, // min(dst, src)
 	BLENDOP_MAX     = 0x5, // max(dst, src)
 } BlendOp;
@@ -353,6 +354,8 @@ typedef union ShaderCustomParams {
 	Color color;
 } ShaderCustomParams;
 
+typedef void (*FramebufferReadAsyncCallback)(Pixmap *pixmap, void *userdata);
+
 typedef struct SpriteStateParams {
 	Texture *primary_texture;
 	Texture *aux_textures[R_NUM_SPRITE_AUX_TEXTURES];
@@ -682,6 +685,19 @@ void r_framebuffer_destroy(Framebuffer *fb) attr_nonnull(1);
 void r_framebuffer_clear(Framebuffer *fb, ClearBufferFlags flags, const Color *colorval, float depthval);
 IntExtent r_framebuffer_get_size(Framebuffer *fb);
 
+/*
+ * Reads back a region of a framebuffer's color attachment without stalling
+ * the pipeline. Pass NULL as `fb` for the default framebuffer; `attachment`
+ * is ignored in that case. The region uses the same coordinate system as
+ * r_framebuffer_viewport: pixels, with the origin at the bottom-left corner.
+ *
+ * The callback is invoked from a later r_swap, once the GPU has finished
+ * writing the data, or right away on backends that can't read asynchronously.
+ * It receives a RGBA8 pixmap and takes ownership of its data, or NULL if the
+ * read has failed. Reads still pending on shutdown are completed synchronously.
+ */
+void r_framebuffer_read_async(Framebuffer *fb, FramebufferAttachment attachment, IntRect region, void *userdata, FramebufferReadAsyncCallback callback) attr_nonnull(5);
+
 void r_framebuffer(Framebuffer *fb);
 Framebuffer* r_framebuffer_current(void);
 
@@ -692,6 +708,21 @@ void r_vertex_buffer_destroy(VertexBuffer *vbuf) attr_nonnull(1);
 void r_vertex_buffer_invalidate(VertexBuffer *vbuf) attr_nonnull(1);
 SDL_RWops* r_vertex_buffer_get_stream(VertexBuffer *vbuf) attr_nonnull(1);
 
+/*
+ * Direct write access to the vertex buffer's stream, bypassing SDL_RWops.
+ *
+ * r_vertex_buffer_reserve returns a pointer to the current stream position, and stores the
+ * number of bytes that may be written there in *out_available (at least min_size).
+ * Returns NULL if less than min_size bytes remain; the buffer needs to be invalidated then.
+ *
+ * Nothing is considered written until r_vertex_buffer_commit is called, which marks the first
+ * size bytes of the reserved region as written and advances the stream position past them.
+ * Pending data must be committed before the buffer is used for drawing, and before the stream
+ * is accessed in any other way.
+ */
+void* r_vertex_buffer_reserve(VertexBuffer *vbuf, size_t min_size, size_t *out_available) attr_nonnull(1, 3);
+void r_vertex_buffer_commit(VertexBuffer *vbuf, size_t size) attr_nonnull(1);
+
 IndexBuffer* r_index_buffer_create(size_t max_elements);
 size_t r_index_buffer_get_capacity(IndexBuffer *ibuf) attr_nonnull(1);
 const char* r_index_buffer_get_debug_label(IndexBuffer *ibuf) attr_nonnull(1);
@@ -726,6 +757,8 @@ void r_mat_mv_push_identity(void);
 void r_mat_mv_pop(void);
 void r_mat_mv(mat4 mat);
 void r_mat_mv_current(mat4 out_mat);
+// NOTE: the *_current_ptr functions assume the matrix will be modified through the returned pointer.
+// Use the *_current functions if you only need to read it.
 mat4 *r_mat_mv_current_ptr(void);
 void r_mat_mv_identity(void);
 void r_mat_mv_translate_v(vec3 v);
@@ -778,6 +811,30 @@ void r_draw_sprite(const SpriteParams *params) attr_nonnull(1);
 void r_sprite_batch_prepare_state(const SpriteStateParams *stp);
 void r_sprite_batch_add_instance(const SpriteInstanceAttribs *attribs);
 
+/*
+ * Begins a segment of sprite draws whose relative order doesn't matter.
+ * Until the matching r_sprite_batch_end_unordered, sprites submitted with
+ * r_draw_sprite are recorded instead of batched, then sorted by `order_key`
+ * first, and by blend mode, shader and textures after that, to minimize flushes.
+ * Only runs of consecutive sprites with commutative (additive or subtractive)
+ * blend modes are actually reordered; other sprites keep their place. Sprites
+ * recorded under different framebuffers, capabilities or projections are never
+ * reordered across those changes, and anything else that draws ends the
+ * reorderable run early. Segments can't be nested.
+ */
+void r_sprite_batch_begin_unordered(uint32_t order_key);
+void r_sprite_batch_end_unordered(void);
+
+/*
+ * Registers a variant of a sprite shader that reads the compact instance layout
+ * (see SPRITE_COMPACT in the sprite shader interface). Sprites drawn with `prog`
+ * that have a 2D affine transform, an identity texture matrix and a texture
+ * region within [0, 1] are then uploaded in the compact layout and drawn with
+ * `compact_prog` instead. Both programs must accept the same uniforms.
+ * Pass NULL as `compact_prog` to remove the association.
+ */
+void r_sprite_batch_set_compact_shader(ShaderProgram *prog, ShaderProgram *compact_prog) attr_nonnull(1);
+
 void r_flush_sprites(void);
 
 BlendMode r_blend_compose(
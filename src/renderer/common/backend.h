@@ -84,6 +84,7 @@ typedef struct RendererFuncs {
 	uint (*framebuffer_get_attachment_mipmap)(Framebuffer *framebuffer, FramebufferAttachment attachment);
 	void (*framebuffer_clear)(Framebuffer *framebuffer, ClearBufferFlags flags, const Color *colorval, float depthval);
 	IntExtent (*framebuffer_get_size)(Framebuffer *framebuffer);
+	void (*framebuffer_read_async)(Framebuffer *framebuffer, FramebufferAttachment attachment, IntRect region, void *userdata, FramebufferReadAsyncCallback callback);
 
 	void (*framebuffer)(Framebuffer *framebuffer);
 	Framebuffer* (*framebuffer_current)(void);
@@ -94,6 +95,8 @@ typedef struct RendererFuncs {
 	void (*vertex_buffer_destroy)(VertexBuffer *vbuf);
 	void (*vertex_buffer_invalidate)(VertexBuffer *vbuf);
 	SDL_RWops* (*vertex_buffer_get_stream)(VertexBuffer *vbuf);
+	void* (*vertex_buffer_reserve)(VertexBuffer *vbuf, size_t min_size, size_t *out_available);
+	void (*vertex_buffer_commit)(VertexBuffer *vbuf, size_t size);
 
 	IndexBuffer* (*index_buffer_create)(size_t max_elements);
 	size_t (*index_buffer_get_capacity)(IndexBuffer *ibuf);
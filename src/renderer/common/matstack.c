@@ -13,9 +13,14 @@
 #include "util/glm.h"
 #include "state.h"
 
+mat4 *matstack_write(MatrixStack *ms) {
+	ms->versions[ms->head - ms->stack] = ++ms->version_counter;
+	return ms->head;
+}
+
 void matstack_reset(MatrixStack *ms) {
 	ms->head = ms->stack;
-	glm_mat4_identity(ms->stack[0]);
+	glm_mat4_identity(*matstack_write(ms));
 }
 
 static void matstack_push_raw(MatrixStack *ms) {
@@ -26,16 +31,18 @@ static void matstack_push_raw(MatrixStack *ms) {
 void matstack_push(MatrixStack *ms) {
 	matstack_push_raw(ms);
 	glm_mat4_copy(*(ms->head - 1), *ms->head);
+	// same contents, same version
+	ms->versions[ms->head - ms->stack] = ms->versions[ms->head - ms->stack - 1];
 }
 
 void matstack_push_premade(MatrixStack *ms, mat4 mat) {
 	matstack_push_raw(ms);
-	glm_mat4_copy(mat, *ms->head);
+	glm_mat4_copy(mat, *matstack_write(ms));
 }
 
 void matstack_push_identity(MatrixStack *ms) {
 	matstack_push_raw(ms);
-	glm_mat4_identity(*ms->head);
+	glm_mat4_identity(*matstack_write(ms));
 }
 
 void matstack_pop(MatrixStack *ms) {
@@ -64,7 +71,7 @@ void r_mat_mv_pop(void) {
 }
 
 void r_mat_mv(mat4 mat) {
-	glm_mat4_copy(mat, *_r_matrices.modelview.head);
+	glm_mat4_copy(mat, *matstack_write(&_r_matrices.modelview));
 }
 
 void r_mat_mv_current(mat4 out_mat) {
@@ -72,23 +79,23 @@ void r_mat_mv_current(mat4 out_mat) {
 }
 
 mat4 *r_mat_mv_current_ptr(void) {
-	return _r_matrices.modelview.head;
+	return matstack_write(&_r_matrices.modelview);
 }
 
 void r_mat_mv_identity(void) {
-	glm_mat4_identity(*_r_matrices.modelview.head);
+	glm_mat4_identity(*matstack_write(&_r_matrices.modelview));
 }
 
 void r_mat_mv_translate_v(vec3 v) {
-	glm_translate(*_r_matrices.modelview.head, v);
+	glm_translate(*matstack_write(&_r_matrices.modelview), v);
 }
 
 void r_mat_mv_rotate_v(float angle, vec3 v) {
-	glm_rotate(*_r_matrices.modelview.head, angle, v);
+	glm_rotate(*matstack_write(&_r_matrices.modelview), angle, v);
 }
 
 void r_mat_mv_scale_v(vec3 v) {
-	glm_scale(*_r_matrices.modelview.head, v);
+	glm_scale(*matstack_write(&_r_matrices.modelview), v);
 }
 
 // END modelview
@@ -126,7 +133,7 @@ void r_mat_proj_pop(void) {
 }
 
 void r_mat_proj(mat4 mat) {
-	glm_mat4_copy(mat, *_r_matrices.projection.head);
+	glm_mat4_copy(mat, *matstack_write(&_r_matrices.projection));
 }
 
 void r_mat_proj_current(mat4 out_mat) {
@@ -134,31 +141,31 @@ void r_mat_proj_current(mat4 out_mat) {
 }
 
 mat4 *r_mat_proj_current_ptr(void) {
-	return _r_matrices.projection.head;
+	return matstack_write(&_r_matrices.projection);
 }
 
 void r_mat_proj_identity(void) {
-	glm_mat4_identity(*_r_matrices.projection.head);
+	glm_mat4_identity(*matstack_write(&_r_matrices.projection));
 }
 
 void r_mat_proj_translate_v(vec3 v) {
-	glm_translate(*_r_matrices.projection.head, v);
+	glm_translate(*matstack_write(&_r_matrices.projection), v);
 }
 
 void r_mat_proj_rotate_v(float angle, vec3 v) {
-	glm_rotate(*_r_matrices.projection.head, angle, v);
+	glm_rotate(*matstack_write(&_r_matrices.projection), angle, v);
 }
 
 void r_mat_proj_scale_v(vec3 v) {
-	glm_scale(*_r_matrices.projection.head, v);
+	glm_scale(*matstack_write(&_r_matrices.projection), v);
 }
 
 void r_mat_proj_ortho(float left, float right, float bottom, float top, float near, float far) {
-	glm_ortho(left, right, bottom, top, near, far, *_r_matrices.projection.head);
+	glm_ortho(left, right, bottom, top, near, far, *matstack_write(&_r_matrices.projection));
 }
 
 void r_mat_proj_perspective(float angle, float aspect, float near, float far) {
-	glm_perspective(angle, aspect, near, far, *_r_matrices.projection.head);
+	glm_perspective(angle, aspect, near, far, *matstack_write(&_r_matrices.projection));
 }
 
 // END projection
@@ -182,7 +189,7 @@ void r_mat_tex_pop(void) {
 }
 
 void r_mat_tex(mat4 mat) {
-	glm_mat4_copy(mat, *_r_matrices.texture.head);
+	glm_mat4_copy(mat, *matstack_write(&_r_matrices.texture));
 }
 
 void r_mat_tex_current(mat4 out_mat) {
@@ -190,23 +197,23 @@ void r_mat_tex_current(mat4 out_mat) {
 }
 
 mat4 *r_mat_tex_current_ptr(void) {
-	return _r_matrices.texture.head;
+	return matstack_write(&_r_matrices.texture);
 }
 
 void r_mat_tex_identity(void) {
-	glm_mat4_identity(*_r_matrices.texture.head);
+	glm_mat4_identity(*matstack_write(&_r_matrices.texture));
 }
 
 void r_mat_tex_translate_v(vec3 v) {
-	glm_translate(*_r_matrices.texture.head, v);
+	glm_translate(*matstack_write(&_r_matrices.texture), v);
 }
 
 void r_mat_tex_rotate_v(float angle, vec3 v) {
-	glm_rotate(*_r_matrices.texture.head, angle, v);
+	glm_rotate(*matstack_write(&_r_matrices.texture), angle, v);
 }
 
 void r_mat_tex_scale_v(vec3 v) {
-	glm_scale(*_r_matrices.texture.head, v);
+	glm_scale(*matstack_write(&_r_matrices.texture), v);
 }
 
 // END texture
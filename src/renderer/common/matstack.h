@@ -20,6 +20,10 @@ enum {
 typedef struct MatrixStack {
 	mat4 *head;
 
+	// Version of each matrix in the stack; see matstack_version.
+	uint64_t versions[MATSTACK_LIMIT];
+	uint64_t version_counter;
+
 	// the alignment is required for the SSE codepath in CGLM
 	mat4 stack[MATSTACK_LIMIT] CGLM_ALIGN(32);
 } MatrixStack;
@@ -49,6 +53,18 @@ void matstack_push_identity(MatrixStack *ms)
 void matstack_pop(MatrixStack *ms)
 	attr_nonnull(1);
 
+// Returns [ms]->head for modification and gives it a new version.
+mat4 *matstack_write(MatrixStack *ms)
+	attr_nonnull(1) attr_returns_nonnull;
+
+// Returns the version of [ms]->head.
+// Versions are unique within [ms] and only change when the current matrix may have been
+// modified, so two equal versions are guaranteed to refer to identical matrices.
+// Note that the converse is not true.
+INLINE uint64_t matstack_version(const MatrixStack *ms) {
+	return ms->versions[ms->head - ms->stack];
+}
+
 typedef struct MatrixStates {
 	union {
 		struct {
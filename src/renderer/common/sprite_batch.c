@@ -9,10 +9,13 @@
 #include "taisei.h"
 
 #include "sprite_batch.h"
+#include "matstack.h"
 #include "../api.h"
 #include "util/glm.h"
 #include "resource/sprite.h"
 #include "resource/model.h"
+#include "profiler.h"
+#include "dynarray.h"
 
 #ifndef SPRITE_BATCH_STATS
 #ifdef DEBUG
@@ -24,20 +27,92 @@
 
 #define SIZEOF_SPRITE_ATTRIBS (offsetof(SpriteInstanceAttribs, end_of_fields))
 
-static struct SpriteBatchState {
-	// constants (set once on init and not expected to change)
+// Compact per-instance layout for sprites with a 2D affine transform.
+// Read by shaders compiled with SPRITE_COMPACT defined.
+typedef struct SpriteInstanceAttribsCompact {
+	// 2x2 linear part (column-major), followed by the translation
+	float transform[6];
+	FloatExtent sprite_size;
+	ShaderCustomParams custom;
+	// texture region corners (x0, y0, x1, y1), normalized to 16 bits
+	uint16_t texrect[4];
+	// color as half-floats
+	uint16_t rgba[4];
+} SpriteInstanceAttribsCompact;
+
+static_assert(sizeof(SpriteInstanceAttribsCompact) == 64, "Unexpected padding in SpriteInstanceAttribsCompact");
+
+typedef enum SpriteBatchFormat {
+	SPRITE_FORMAT_FULL,
+	SPRITE_FORMAT_COMPACT,
+	SPRITE_NUM_FORMATS,
+} SpriteBatchFormat;
+
+typedef struct SpriteBatchStream {
 	VertexArray *varr;
 	VertexBuffer *vbuf;
 	Model quad;
+	size_t attribs_size;
+	uint base_instance;
+
+	// region reserved with r_vertex_buffer_reserve; [write_begin, write_ptr) is not committed yet
+	char *write_begin;
+	char *write_ptr;
+	char *write_end;
+} SpriteBatchStream;
+
+typedef struct CompactShaderPair {
+	ShaderProgram *prog;
+	ShaderProgram *compact_prog;
+} CompactShaderPair;
+
+// Render state a recorded sprite depends on, besides its SpriteStateParams.
+// Shared by consecutive commands recorded under the same state.
+typedef struct SpriteBatchEnv {
+	mat4 projection;
+	uint64_t projection_version;
+	Framebuffer *framebuffer;
+	r_capability_bits_t capbits;
+	DepthTestFunc depth_func;
+	CullFaceMode cull_mode;
+} SpriteBatchEnv;
+
+// A sprite recorded inside an order-independent segment; see r_sprite_batch_begin_unordered.
+typedef struct SpriteBatchCommand {
+	SpriteStateParams state;
+	SpriteInstanceAttribs attribs;
+	uint32_t order_key;
+	uint env;
+	uint run;
+	uint seq;
+} SpriteBatchCommand;
+
+static struct SpriteBatchState {
+	// constants (set once on init and not expected to change)
+	SpriteBatchStream streams[SPRITE_NUM_FORMATS];
 	r_feature_bits_t renderer_features;
 
+	// registered by r_sprite_batch_set_compact_shader
+	DYNAMIC_ARRAY(CompactShaderPair) compact_shaders;
+
+	// recorded by r_draw_sprite between r_sprite_batch_begin_unordered and r_sprite_batch_end_unordered
+	DYNAMIC_ARRAY(SpriteBatchCommand) commands;
+	DYNAMIC_ARRAY(SpriteBatchEnv) command_envs;
+	uint32_t order_key;
+	uint command_run;
+	bool command_run_commutative;
+	bool recording;
+	bool replaying;
+
 	// varying state
 	mat4 projection;
+	uint64_t projection_version;
 	Texture *primary_texture;
 	Texture *aux_textures[R_NUM_SPRITE_AUX_TEXTURES];
 	ShaderProgram *shader;
+	ShaderProgram *compact_shader;
 	Framebuffer *framebuffer;
-	uint base_instance;
+	SpriteBatchFormat format;
 	BlendMode blend;
 	CullFaceMode cull_mode;
 	DepthTestFunc depth_func;
@@ -48,12 +123,45 @@ static struct SpriteBatchState {
 	struct {
 		uint flushes;
 		uint sprites;
+		uint compact_sprites;
 		uint best_batch;
 		uint worst_batch;
+		uint reorder_flushes_before;
+		uint reorder_flushes_after;
 	} frame_stats;
 #endif
 } _r_sprite_batch;
 
+static void _r_sprite_batch_init_stream(
+	SpriteBatchStream *stream,
+	const char *label,
+	uint capacity,
+	size_t attribs_size,
+	uint num_attribs,
+	VertexAttribFormat fmt[num_attribs]
+) {
+	char buf[64];
+
+	stream->attribs_size = attribs_size;
+	stream->vbuf = r_vertex_buffer_create(attribs_size * capacity, NULL);
+	snprintf(buf, sizeof(buf), "%s vertex buffer", label);
+	r_vertex_buffer_set_debug_label(stream->vbuf, buf);
+	r_vertex_buffer_invalidate(stream->vbuf);
+
+	stream->varr = r_vertex_array_create();
+	snprintf(buf, sizeof(buf), "%s vertex array", label);
+	r_vertex_array_set_debug_label(stream->varr, buf);
+	r_vertex_array_layout(stream->varr, num_attribs, fmt);
+	r_vertex_array_attach_vertex_buffer(stream->varr, r_vertex_buffer_static_models(), 0);
+	r_vertex_array_attach_vertex_buffer(stream->varr, stream->vbuf, 1);
+
+	stream->quad.num_indices = 0;
+	stream->quad.num_vertices = 4;
+	stream->quad.offset = 0;
+	stream->quad.primitive = PRIM_TRIANGLE_STRIP;
+	stream->quad.vertex_array = stream->varr;
+}
+
 void _r_sprite_batch_init(void) {
 	#ifdef DEBUG
 	preload_resource(RES_FONT, "monotiny", RESF_PERMANENT);
@@ -61,9 +169,11 @@ void _r_sprite_batch_init(void) {
 
 	size_t sz_vert = sizeof(GenericModelVertex);
 	size_t sz_attr = SIZEOF_SPRITE_ATTRIBS;
+	size_t sz_cattr = sizeof(SpriteInstanceAttribsCompact);
 
 	#define VERTEX_OFS(attr)   offsetof(GenericModelVertex,  attr)
 	#define INSTANCE_OFS(attr) offsetof(SpriteInstanceAttribs, attr)
+	#define COMPACT_OFS(attr)  offsetof(SpriteInstanceAttribsCompact, attr)
 
 	VertexAttribFormat fmt[] = {
 		// Per-vertex attributes (for the static models buffer, bound at 0)
@@ -85,8 +195,23 @@ void _r_sprite_batch_init(void) {
 		{ { 4, VA_FLOAT, VA_CONVERT_FLOAT, 1 }, sz_attr, INSTANCE_OFS(custom),           1 },
 	};
 
+	VertexAttribFormat fmt_compact[] = {
+		// Per-vertex attributes (for the static models buffer, bound at 0)
+		{ { 2, VA_FLOAT,  VA_CONVERT_FLOAT,            0 }, sz_vert,  VERTEX_OFS(position),      0 },
+		{ { 2, VA_FLOAT,  VA_CONVERT_FLOAT,            0 }, sz_vert,  VERTEX_OFS(uv),            0 },
+
+		// Per-instance attributes (for our own compact sprites buffer, bound at 1)
+		{ { 4, VA_FLOAT,  VA_CONVERT_FLOAT,            1 }, sz_cattr, COMPACT_OFS(transform[0]), 1 },
+		{ { 2, VA_FLOAT,  VA_CONVERT_FLOAT,            1 }, sz_cattr, COMPACT_OFS(transform[4]), 1 },
+		{ { 4, VA_HALF,   VA_CONVERT_FLOAT,            1 }, sz_cattr, COMPACT_OFS(rgba),         1 },
+		{ { 4, VA_USHORT, VA_CONVERT_FLOAT_NORMALIZED, 1 }, sz_cattr, COMPACT_OFS(texrect),      1 },
+		{ { 2, VA_FLOAT,  VA_CONVERT_FLOAT,            1 }, sz_cattr, COMPACT_OFS(sprite_size),  1 },
+		{ { 4, VA_FLOAT,  VA_CONVERT_FLOAT,            1 }, sz_cattr, COMPACT_OFS(custom),       1 },
+	};
+
 	#undef VERTEX_OFS
 	#undef INSTANCE_OFS
+	#undef COMPACT_OFS
 
 	uint capacity;
 
@@ -96,35 +221,56 @@ void _r_sprite_batch_init(void) {
 		capacity = 1 << 11;
 	}
 
-	_r_sprite_batch.vbuf = r_vertex_buffer_create(sz_attr * capacity, NULL);
-	r_vertex_buffer_set_debug_label(_r_sprite_batch.vbuf, "Sprite batch vertex buffer");
-	r_vertex_buffer_invalidate(_r_sprite_batch.vbuf);
-
-	_r_sprite_batch.varr = r_vertex_array_create();
-	r_vertex_array_set_debug_label(_r_sprite_batch.varr, "Sprite batch vertex array");
-	r_vertex_array_layout(_r_sprite_batch.varr, sizeof(fmt)/sizeof(*fmt), fmt);
-	r_vertex_array_attach_vertex_buffer(_r_sprite_batch.varr, r_vertex_buffer_static_models(), 0);
-	r_vertex_array_attach_vertex_buffer(_r_sprite_batch.varr, _r_sprite_batch.vbuf, 1);
+	_r_sprite_batch_init_stream(
+		_r_sprite_batch.streams + SPRITE_FORMAT_FULL, "Sprite batch",
+		capacity, sz_attr, ARRAY_SIZE(fmt), fmt
+	);
 
-	_r_sprite_batch.quad.num_indices = 0;
-	_r_sprite_batch.quad.num_vertices = 4;
-	_r_sprite_batch.quad.offset = 0;
-	_r_sprite_batch.quad.primitive = PRIM_TRIANGLE_STRIP;
-	_r_sprite_batch.quad.vertex_array = _r_sprite_batch.varr;
+	_r_sprite_batch_init_stream(
+		_r_sprite_batch.streams + SPRITE_FORMAT_COMPACT, "Sprite batch (compact)",
+		capacity, sz_cattr, ARRAY_SIZE(fmt_compact), fmt_compact
+	);
 
 	_r_sprite_batch.renderer_features = r_features();
 }
 
+static void _r_sprite_batch_stream_commit(SpriteBatchStream *stream) {
+	if(stream->write_ptr != stream->write_begin) {
+		r_vertex_buffer_commit(stream->vbuf, stream->write_ptr - stream->write_begin);
+		stream->write_begin = stream->write_ptr;
+	}
+}
+
+static void _r_sprite_batch_stream_invalidate(SpriteBatchStream *stream) {
+	r_vertex_buffer_invalidate(stream->vbuf);
+	stream->base_instance = 0;
+	stream->write_begin = stream->write_ptr = stream->write_end = NULL;
+}
+
 void _r_sprite_batch_shutdown(void) {
-	r_vertex_array_destroy(_r_sprite_batch.varr);
-	r_vertex_buffer_destroy(_r_sprite_batch.vbuf);
+	for(uint i = 0; i < SPRITE_NUM_FORMATS; ++i) {
+		r_vertex_array_destroy(_r_sprite_batch.streams[i].varr);
+		r_vertex_buffer_destroy(_r_sprite_batch.streams[i].vbuf);
+	}
+
+	dynarray_free_data(&_r_sprite_batch.compact_shaders);
+	dynarray_free_data(&_r_sprite_batch.commands);
+	dynarray_free_data(&_r_sprite_batch.command_envs);
 }
 
+static void _r_sprite_batch_submit_commands(void);
+
 void r_flush_sprites(void) {
+	if(_r_sprite_batch.commands.num_elements > 0 && !_r_sprite_batch.replaying) {
+		// something else is about to be drawn; anything recorded so far must come before it
+		_r_sprite_batch_submit_commands();
+	}
+
 	if(_r_sprite_batch.num_pending == 0) {
 		return;
 	}
 
+	PROFILE_ZONE_BEGIN(z, "r_flush_sprites");
 	uint pending = _r_sprite_batch.num_pending;
 
 	// needs to be done early to thwart recursive calls
@@ -146,10 +292,18 @@ void r_flush_sprites(void) {
 	_r_sprite_batch.frame_stats.flushes++;
 #endif
 
+	SpriteBatchStream *stream = _r_sprite_batch.streams + _r_sprite_batch.format;
+	ShaderProgram *shader = _r_sprite_batch.shader;
+
+	if(_r_sprite_batch.format == SPRITE_FORMAT_COMPACT) {
+		assert(_r_sprite_batch.compact_shader != NULL);
+		shader = _r_sprite_batch.compact_shader;
+	}
+
 	r_state_push();
 	r_mat_proj_push_premade(_r_sprite_batch.projection);
 
-	r_shader_ptr(_r_sprite_batch.shader);
+	r_shader_ptr(shader);
 	r_uniform_sampler("tex", _r_sprite_batch.primary_texture);
 	r_uniform_sampler_array("tex_aux[0]", 0, R_NUM_SPRITE_AUX_TEXTURES, _r_sprite_batch.aux_textures);
 	r_framebuffer(_r_sprite_batch.framebuffer);
@@ -164,25 +318,27 @@ void r_flush_sprites(void) {
 		r_cull(_r_sprite_batch.cull_mode);
 	}
 
+	_r_sprite_batch_stream_commit(stream);
+
 	if(_r_sprite_batch.renderer_features & r_feature_bit(RFEAT_DRAW_INSTANCED_BASE_INSTANCE)) {
-		r_draw_model_ptr(&_r_sprite_batch.quad, pending, _r_sprite_batch.base_instance);
-		_r_sprite_batch.base_instance += pending;
+		r_draw_model_ptr(&stream->quad, pending, stream->base_instance);
+		stream->base_instance += pending;
 
-		SDL_RWops *stream = r_vertex_buffer_get_stream(_r_sprite_batch.vbuf);
-		size_t remaining = SDL_RWsize(stream) - SDL_RWtell(stream);
+		// the reserved region always extends to the end of the buffer
+		size_t remaining = stream->write_end - stream->write_ptr;
 
-		if(remaining < SIZEOF_SPRITE_ATTRIBS) {
-			// log_debug("Invalidating after %u sprites", _r_sprite_batch.base_instance);
-			r_vertex_buffer_invalidate(_r_sprite_batch.vbuf);
-			_r_sprite_batch.base_instance = 0;
+		if(remaining < stream->attribs_size) {
+			// log_debug("Invalidating after %u sprites", stream->base_instance);
+			_r_sprite_batch_stream_invalidate(stream);
 		}
 	} else {
-		r_draw_model_ptr(&_r_sprite_batch.quad, pending, 0);
-		r_vertex_buffer_invalidate(_r_sprite_batch.vbuf);
+		r_draw_model_ptr(&stream->quad, pending, 0);
+		_r_sprite_batch_stream_invalidate(stream);
 	}
 
 	r_mat_proj_pop();
 	r_state_pop();
+	PROFILE_ZONE_END(z);
 }
 
 static void _r_sprite_batch_compute_attribs(
@@ -288,7 +444,40 @@ INLINE void _r_sprite_batch_process_params(
 	}
 }
 
-void r_sprite_batch_prepare_state(const SpriteStateParams *stp) {
+static ShaderProgram *_r_sprite_batch_find_compact_shader(ShaderProgram *prog) {
+	dynarray_foreach_elem(&_r_sprite_batch.compact_shaders, CompactShaderPair *pair, {
+		if(pair->prog == prog) {
+			return pair->compact_prog;
+		}
+	});
+
+	return NULL;
+}
+
+static bool _r_sprite_batch_pair_not_for_prog(const void *pelem, void *userdata) {
+	const CompactShaderPair *pair = pelem;
+	return pair->prog != userdata;
+}
+
+static bool _r_sprite_batch_pair_not_using_prog(const void *pelem, void *userdata) {
+	const CompactShaderPair *pair = pelem;
+	return pair->prog != userdata && pair->compact_prog != userdata;
+}
+
+void r_sprite_batch_set_compact_shader(ShaderProgram *prog, ShaderProgram *compact_prog) {
+	if(prog == _r_sprite_batch.shader) {
+		r_flush_sprites();
+		_r_sprite_batch.compact_shader = compact_prog;
+	}
+
+	dynarray_filter(&_r_sprite_batch.compact_shaders, _r_sprite_batch_pair_not_for_prog, prog);
+
+	if(compact_prog) {
+		*dynarray_append(&_r_sprite_batch.compact_shaders) = (CompactShaderPair) { prog, compact_prog };
+	}
+}
+
+static void _r_sprite_batch_apply_state(const SpriteStateParams *stp) {
 	if(stp->primary_texture != _r_sprite_batch.primary_texture) {
 		r_flush_sprites();
 		_r_sprite_batch.primary_texture = stp->primary_texture;
@@ -306,6 +495,7 @@ void r_sprite_batch_prepare_state(const SpriteStateParams *stp) {
 	if(stp->shader != _r_sprite_batch.shader) {
 		r_flush_sprites();
 		_r_sprite_batch.shader = stp->shader;
+		_r_sprite_batch.compact_shader = _r_sprite_batch_find_compact_shader(stp->shader);
 	}
 
 	BlendMode blend = stp->blend;
@@ -314,18 +504,21 @@ void r_sprite_batch_prepare_state(const SpriteStateParams *stp) {
 		r_flush_sprites();
 		_r_sprite_batch.blend = blend;
 	}
+}
 
-	Framebuffer *fb = r_framebuffer_current();
-
+static void _r_sprite_batch_apply_env(
+	Framebuffer *fb,
+	r_capability_bits_t caps,
+	DepthTestFunc depth_func,
+	CullFaceMode cull_mode,
+	mat4 *projection,
+	uint64_t projection_version
+) {
 	if(fb != _r_sprite_batch.framebuffer) {
 		r_flush_sprites();
 		_r_sprite_batch.framebuffer = fb;
 	}
 
-	r_capability_bits_t caps = r_capabilities_current();
-	DepthTestFunc depth_func = r_depth_func_current();
-	CullFaceMode cull_mode = r_cull_current();
-
 	if(_r_sprite_batch.capbits != caps) {
 		r_flush_sprites();
 		_r_sprite_batch.capbits = caps;
@@ -341,34 +534,147 @@ void r_sprite_batch_prepare_state(const SpriteStateParams *stp) {
 		_r_sprite_batch.cull_mode = cull_mode;
 	}
 
-	mat4 *current_projection = r_mat_proj_current_ptr();
+	if(projection_version != _r_sprite_batch.projection_version) {
+		if(memcmp(*projection, _r_sprite_batch.projection, sizeof(mat4))) {
+			r_flush_sprites();
+			glm_mat4_copy(*projection, _r_sprite_batch.projection);
+		}
 
-	if(memcmp(*current_projection, _r_sprite_batch.projection, sizeof(mat4))) {
-		r_flush_sprites();
-		glm_mat4_copy(*current_projection, _r_sprite_batch.projection);
+		_r_sprite_batch.projection_version = projection_version;
 	}
 }
 
-static SDL_RWops *_r_sprite_batch_prepare_buffer(void) {
-	SDL_RWops *stream = r_vertex_buffer_get_stream(_r_sprite_batch.vbuf);
-	size_t remaining = SDL_RWsize(stream) - SDL_RWtell(stream);
+void r_sprite_batch_prepare_state(const SpriteStateParams *stp) {
+	if(_r_sprite_batch.commands.num_elements > 0 && !_r_sprite_batch.replaying) {
+		// not going through r_draw_sprite, so this can't be recorded; keep it in order
+		_r_sprite_batch_submit_commands();
+	}
 
-	if(remaining < SIZEOF_SPRITE_ATTRIBS) {
+	_r_sprite_batch_apply_state(stp);
+	_r_sprite_batch_apply_env(
+		r_framebuffer_current(),
+		r_capabilities_current(),
+		r_depth_func_current(),
+		r_cull_current(),
+		_r_matrices.projection.head,
+		matstack_version(&_r_matrices.projection)
+	);
+}
+
+static void _r_sprite_batch_stream_reserve(SpriteBatchStream *stream) {
+	size_t available = 0;
+	char *p = NULL;
+
+	if(stream->write_ptr == NULL) {
+		p = r_vertex_buffer_reserve(stream->vbuf, stream->attribs_size, &available);
+	}
+
+	if(p == NULL) {
 		// TODO: maybe it is better to grow the buffer instead?
 
 		if(!r_supports(RFEAT_DRAW_INSTANCED_BASE_INSTANCE)) {
-			log_warn("Vertex buffer exhausted (%zu needed for next sprite, %zu remaining), flush forced", SIZEOF_SPRITE_ATTRIBS, remaining);
+			log_warn("Vertex buffer exhausted (%zu needed for next sprite), flush forced", stream->attribs_size);
+		}
+
+		r_flush_sprites();
+
+		if(stream->write_ptr != NULL) {
+			// nothing was pending, so the flush didn't get to it
+			_r_sprite_batch_stream_invalidate(stream);
 		}
 
+		p = NOT_NULL(r_vertex_buffer_reserve(stream->vbuf, stream->attribs_size, &available));
+	}
+
+	stream->write_begin = stream->write_ptr = p;
+	stream->write_end = p + available;
+}
+
+static inline void *_r_sprite_batch_alloc_instance(SpriteBatchFormat format) {
+	if(format != _r_sprite_batch.format) {
 		r_flush_sprites();
+		_r_sprite_batch.format = format;
 	}
 
-	return stream;
+	SpriteBatchStream *stream = _r_sprite_batch.streams + format;
+
+	if(UNLIKELY((size_t)(stream->write_end - stream->write_ptr) < stream->attribs_size)) {
+		_r_sprite_batch_stream_reserve(stream);
+	}
+
+	void *p = stream->write_ptr;
+	stream->write_ptr += stream->attribs_size;
+	return p;
+}
+
+static inline bool _r_sprite_batch_texcoord_compactable(float a, float b) {
+	return a >= 0 && a <= 1 && b >= 0 && b <= 1;
+}
+
+static bool _r_sprite_batch_compact_attribs(
+	const SpriteInstanceAttribs *restrict attribs,
+	SpriteInstanceAttribsCompact *restrict out
+) {
+	const vec4 *mv = attribs->mv_transform;
+
+	// Must be a 2D affine transform; the third column is irrelevant, since sprite vertices have z = 0
+	if(
+		mv[0][2] != 0 || mv[0][3] != 0 ||
+		mv[1][2] != 0 || mv[1][3] != 0 ||
+		mv[3][2] != 0 || mv[3][3] != 1
+	) {
+		return false;
+	}
+
+	static const mat4 identity = GLM_MAT4_IDENTITY_INIT;
+
+	if(memcmp(attribs->tex_transform, identity, sizeof(mat4))) {
+		return false;
+	}
+
+	const FloatRect *tr = &attribs->texrect;
+	float x0 = tr->x, y0 = tr->y;
+	float x1 = tr->x + tr->w, y1 = tr->y + tr->h;
+
+	if(!_r_sprite_batch_texcoord_compactable(x0, x1) || !_r_sprite_batch_texcoord_compactable(y0, y1)) {
+		return false;
+	}
+
+	out->transform[0] = mv[0][0];
+	out->transform[1] = mv[0][1];
+	out->transform[2] = mv[1][0];
+	out->transform[3] = mv[1][1];
+	out->transform[4] = mv[3][0];
+	out->transform[5] = mv[3][1];
+
+	out->texrect[0] = (uint16_t)(x0 * UINT16_MAX + 0.5f);
+	out->texrect[1] = (uint16_t)(y0 * UINT16_MAX + 0.5f);
+	out->texrect[2] = (uint16_t)(x1 * UINT16_MAX + 0.5f);
+	out->texrect[3] = (uint16_t)(y1 * UINT16_MAX + 0.5f);
+
+	out->rgba[0] = float_to_half(attribs->rgba.r);
+	out->rgba[1] = float_to_half(attribs->rgba.g);
+	out->rgba[2] = float_to_half(attribs->rgba.b);
+	out->rgba[3] = float_to_half(attribs->rgba.a);
+
+	out->sprite_size = attribs->sprite_size;
+	out->custom = attribs->custom;
+
+	return true;
 }
 
 void r_sprite_batch_add_instance(const SpriteInstanceAttribs *attribs) {
-	SDL_RWops *stream = _r_sprite_batch_prepare_buffer();
-	SDL_RWwrite(stream, attribs, SIZEOF_SPRITE_ATTRIBS, 1);
+	SpriteInstanceAttribsCompact compact;
+
+	if(_r_sprite_batch.compact_shader && _r_sprite_batch_compact_attribs(attribs, &compact)) {
+		memcpy(_r_sprite_batch_alloc_instance(SPRITE_FORMAT_COMPACT), &compact, sizeof(compact));
+
+#if SPRITE_BATCH_STATS
+		_r_sprite_batch.frame_stats.compact_sprites++;
+#endif
+	} else {
+		memcpy(_r_sprite_batch_alloc_instance(SPRITE_FORMAT_FULL), attribs, SIZEOF_SPRITE_ATTRIBS);
+	}
 
 	_r_sprite_batch.num_pending++;
 
@@ -377,12 +683,194 @@ void r_sprite_batch_add_instance(const SpriteInstanceAttribs *attribs) {
 #endif
 }
 
+static uint _r_sprite_batch_record_env(void) {
+	Framebuffer *fb = r_framebuffer_current();
+	r_capability_bits_t caps = r_capabilities_current();
+	DepthTestFunc depth_func = r_depth_func_current();
+	CullFaceMode cull_mode = r_cull_current();
+	uint64_t projection_version = matstack_version(&_r_matrices.projection);
+	uint num_envs = _r_sprite_batch.command_envs.num_elements;
+
+	if(num_envs > 0) {
+		SpriteBatchEnv *env = dynarray_get_ptr(&_r_sprite_batch.command_envs, num_envs - 1);
+
+		if(
+			env->framebuffer == fb &&
+			env->capbits == caps &&
+			env->depth_func == depth_func &&
+			env->cull_mode == cull_mode &&
+			env->projection_version == projection_version
+		) {
+			return num_envs - 1;
+		}
+	}
+
+	SpriteBatchEnv *env = dynarray_append(&_r_sprite_batch.command_envs);
+	env->framebuffer = fb;
+	env->capbits = caps;
+	env->depth_func = depth_func;
+	env->cull_mode = cull_mode;
+	env->projection_version = projection_version;
+	glm_mat4_copy(*_r_matrices.projection.head, env->projection);
+
+	return num_envs;
+}
+
+static bool _r_sprite_batch_blend_part_commutative(BlendOp op, BlendFactor src, BlendFactor dst) {
+	// dst + src * f(src) and dst - src * f(src) give the same result regardless of the order
+	// sprites are drawn in. BLENDOP_SUB computes src * f(src) - dst, which doesn't.
+	return
+		(op == BLENDOP_ADD || op == BLENDOP_REV_SUB) &&
+		dst == BLENDFACTOR_ONE &&
+		src != BLENDFACTOR_DST_COLOR &&
+		src != BLENDFACTOR_INV_DST_COLOR &&
+		src != BLENDFACTOR_DST_ALPHA &&
+		src != BLENDFACTOR_INV_DST_ALPHA;
+}
+
+static bool _r_sprite_batch_blend_commutative(BlendMode blend) {
+	UnpackedBlendMode u;
+	r_blend_unpack(blend, &u);
+	return
+		_r_sprite_batch_blend_part_commutative(u.color.op, u.color.src, u.color.dst) &&
+		_r_sprite_batch_blend_part_commutative(u.alpha.op, u.alpha.src, u.alpha.dst);
+}
+
+static uint _r_sprite_batch_record_run(BlendMode blend) {
+	// Only consecutive sprites with commutative blend modes may be reordered; every other
+	// sprite gets a run of its own, which pins it in place.
+	bool commutative = _r_sprite_batch_blend_commutative(blend);
+
+	if(
+		_r_sprite_batch.commands.num_elements > 1 &&
+		!(commutative && _r_sprite_batch.command_run_commutative)
+	) {
+		++_r_sprite_batch.command_run;
+	}
+
+	_r_sprite_batch.command_run_commutative = commutative;
+	return _r_sprite_batch.command_run;
+}
+
+static int _r_sprite_batch_compare_commands(const void *pa, const void *pb) {
+	const SpriteBatchCommand *a = pa;
+	const SpriteBatchCommand *b = pb;
+
+	// Commands from different segments, recorded under different render states, or separated by
+	// a non-commutative blend are never reordered relative to each other.
+	// Within a run, group by everything that forces a flush, most expensive first.
+	#define CMP(x, y) do { if((x) != (y)) return (x) < (y) ? -1 : 1; } while(0)
+	CMP(a->order_key, b->order_key);
+	CMP(a->env, b->env);
+	CMP(a->run, b->run);
+	CMP(a->state.blend, b->state.blend);
+	CMP((uintptr_t)a->state.shader, (uintptr_t)b->state.shader);
+	CMP((uintptr_t)a->state.primary_texture, (uintptr_t)b->state.primary_texture);
+
+	for(uint i = 0; i < R_NUM_SPRITE_AUX_TEXTURES; ++i) {
+		CMP((uintptr_t)a->state.aux_textures[i], (uintptr_t)b->state.aux_textures[i]);
+	}
+
+	// keep the recorded order otherwise; qsort isn't stable
+	CMP(a->seq, b->seq);
+	#undef CMP
+
+	return 0;
+}
+
+#if SPRITE_BATCH_STATS
+static uint _r_sprite_batch_count_command_flushes(void) {
+	uint flushes = 0;
+	SpriteBatchCommand *prev = NULL;
+
+	dynarray_foreach_elem(&_r_sprite_batch.commands, SpriteBatchCommand *cmd, {
+		if(
+			prev == NULL ||
+			prev->order_key != cmd->order_key ||
+			prev->env != cmd->env ||
+			prev->state.blend != cmd->state.blend ||
+			prev->state.shader != cmd->state.shader ||
+			prev->state.primary_texture != cmd->state.primary_texture ||
+			memcmp(prev->state.aux_textures, cmd->state.aux_textures, sizeof(cmd->state.aux_textures))
+		) {
+			++flushes;
+		}
+
+		prev = cmd;
+	});
+
+	return flushes;
+}
+#endif
+
+static void _r_sprite_batch_submit_commands(void) {
+	assert(!_r_sprite_batch.replaying);
+
+#if SPRITE_BATCH_STATS
+	_r_sprite_batch.frame_stats.reorder_flushes_before += _r_sprite_batch_count_command_flushes();
+#endif
+
+	dynarray_qsort(&_r_sprite_batch.commands, _r_sprite_batch_compare_commands);
+
+#if SPRITE_BATCH_STATS
+	_r_sprite_batch.frame_stats.reorder_flushes_after += _r_sprite_batch_count_command_flushes();
+#endif
+
+	_r_sprite_batch.replaying = true;
+
+	dynarray_foreach_elem(&_r_sprite_batch.commands, SpriteBatchCommand *cmd, {
+		SpriteBatchEnv *env = dynarray_get_ptr(&_r_sprite_batch.command_envs, cmd->env);
+		_r_sprite_batch_apply_state(&cmd->state);
+		_r_sprite_batch_apply_env(
+			env->framebuffer,
+			env->capbits,
+			env->depth_func,
+			env->cull_mode,
+			&env->projection,
+			env->projection_version
+		);
+		r_sprite_batch_add_instance(&cmd->attribs);
+	});
+
+	_r_sprite_batch.replaying = false;
+	_r_sprite_batch.commands.num_elements = 0;
+	_r_sprite_batch.command_envs.num_elements = 0;
+	_r_sprite_batch.command_run = 0;
+}
+
+void r_sprite_batch_begin_unordered(uint32_t order_key) {
+	assert(!_r_sprite_batch.recording);
+	_r_sprite_batch.recording = true;
+	_r_sprite_batch.order_key = order_key;
+}
+
+void r_sprite_batch_end_unordered(void) {
+	assert(_r_sprite_batch.recording);
+	_r_sprite_batch.recording = false;
+
+	if(_r_sprite_batch.commands.num_elements > 0) {
+		_r_sprite_batch_submit_commands();
+	}
+}
+
 void r_draw_sprite(const SpriteParams *params) {
 	SpriteStateParams state_params;
 	SpriteInstanceAttribs attribs;
 	Sprite *spr;
 
 	_r_sprite_batch_process_params(params, &state_params, &spr);
+
+	if(_r_sprite_batch.recording) {
+		SpriteBatchCommand *cmd = dynarray_append(&_r_sprite_batch.commands);
+		cmd->state = state_params;
+		cmd->order_key = _r_sprite_batch.order_key;
+		cmd->env = _r_sprite_batch_record_env();
+		cmd->run = _r_sprite_batch_record_run(state_params.blend);
+		cmd->seq = _r_sprite_batch.commands.num_elements - 1;
+		_r_sprite_batch_compute_attribs(spr, params, &cmd->attribs);
+		return;
+	}
+
 	r_sprite_batch_prepare_state(&state_params);
 	_r_sprite_batch_compute_attribs(spr, params, &attribs);
 	r_sprite_batch_add_instance(&attribs);
@@ -402,9 +890,12 @@ void _r_sprite_batch_end_frame(void) {
 	}
 
 	static char buf[512];
-	snprintf(buf, sizeof(buf), "%6i sprites %6i flushes %9.02f spr/flush %6i best %6i worst %12.02f fps",
+	snprintf(buf, sizeof(buf), "%6i sprites (%6i compact) %6i flushes (%6i -> %6i reordered) %9.02f spr/flush %6i best %6i worst %12.02f fps",
 		_r_sprite_batch.frame_stats.sprites,
+		_r_sprite_batch.frame_stats.compact_sprites,
 		_r_sprite_batch.frame_stats.flushes,
+		_r_sprite_batch.frame_stats.reorder_flushes_before,
+		_r_sprite_batch.frame_stats.reorder_flushes_after,
 		_r_sprite_batch.frame_stats.sprites / (double)_r_sprite_batch.frame_stats.flushes,
 		_r_sprite_batch.frame_stats.best_batch,
 		_r_sprite_batch.frame_stats.worst_batch,
@@ -424,6 +915,11 @@ void _r_sprite_batch_end_frame(void) {
 }
 
 void _r_sprite_batch_texture_deleted(Texture *tex) {
+	if(_r_sprite_batch.commands.num_elements > 0) {
+		// may be referenced by a recorded command
+		r_flush_sprites();
+	}
+
 	if(_r_sprite_batch.primary_texture == tex) {
 		_r_sprite_batch.primary_texture = NULL;
 	}
@@ -434,3 +930,19 @@ void _r_sprite_batch_texture_deleted(Texture *tex) {
 		}
 	}
 }
+
+void _r_sprite_batch_shader_deleted(ShaderProgram *prog) {
+	if(_r_sprite_batch.commands.num_elements > 0) {
+		// may be referenced by a recorded command
+		r_flush_sprites();
+	}
+
+	if(_r_sprite_batch.shader == prog || _r_sprite_batch.compact_shader == prog) {
+		// still valid at this point; get rid of anything that references it
+		r_flush_sprites();
+		_r_sprite_batch.shader = NULL;
+		_r_sprite_batch.compact_shader = NULL;
+	}
+
+	dynarray_filter(&_r_sprite_batch.compact_shaders, _r_sprite_batch_pair_not_using_prog, prog);
+}
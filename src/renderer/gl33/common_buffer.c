@@ -10,6 +10,7 @@
 
 #include "common_buffer.h"
 #include "gl33.h"
+#include "../glcommon/debug.h"
 
 #define STREAM_CBUF(rw) ((CommonBuffer*)rw)
 
@@ -41,6 +42,29 @@ static int64_t gl33_buffer_stream_size(SDL_RWops *rw) {
 	return STREAM_CBUF(rw)->size;
 }
 
+void* gl33_buffer_reserve(CommonBuffer *cbuf, size_t min_size, size_t *out_available) {
+	assert(cbuf->offset <= cbuf->size);
+	size_t available = cbuf->size - cbuf->offset;
+
+	if(available < min_size) {
+		*out_available = 0;
+		return NULL;
+	}
+
+	*out_available = available;
+	return cbuf->cache.buffer + cbuf->offset;
+}
+
+void gl33_buffer_commit(CommonBuffer *cbuf, size_t size) {
+	assert(cbuf->offset + size <= cbuf->size);
+
+	if(size > 0) {
+		cbuf->cache.update_begin = umin(cbuf->offset, cbuf->cache.update_begin);
+		cbuf->cache.update_end = umax(cbuf->offset + size, cbuf->cache.update_end);
+		cbuf->offset += size;
+	}
+}
+
 static size_t gl33_buffer_stream_write(SDL_RWops *rw, const void *data, size_t size, size_t num) {
 	CommonBuffer *cbuf = STREAM_CBUF(rw);
 	size_t total_size = size * num;
@@ -48,9 +72,7 @@ static size_t gl33_buffer_stream_write(SDL_RWops *rw, const void *data, size_t s
 
 	if(total_size > 0) {
 		memcpy(cbuf->cache.buffer + cbuf->offset, data, total_size);
-		cbuf->cache.update_begin = umin(cbuf->offset, cbuf->cache.update_begin);
-		cbuf->cache.update_end = umax(cbuf->offset + total_size, cbuf->cache.update_end);
-		cbuf->offset += total_size;
+		gl33_buffer_commit(cbuf, total_size);
 	}
 
 	return num;
@@ -104,13 +126,148 @@ void gl33_buffer_init(CommonBuffer *cbuf, size_t capacity, void *data, GLenum us
 }
 
 void gl33_buffer_destroy(CommonBuffer *cbuf) {
-	free(cbuf->cache.buffer);
+	if(cbuf->ring.mapping != NULL) {
+		// the mapping goes away together with the buffer
+		for(uint i = 0; i < GL33_BUFFER_RING_SEGMENTS; ++i) {
+			if(cbuf->ring.fences[i] != NULL) {
+				glDeleteSync(cbuf->ring.fences[i]);
+			}
+		}
+	} else {
+		free(cbuf->cache.buffer);
+	}
+
 	gl33_buffer_deleted(cbuf);
 	glDeleteBuffers(1, &cbuf->gl_handle);
 	free(cbuf);
 }
 
+#ifndef STATIC_GLES3
+static bool gl33_buffer_init_ring(CommonBuffer *cbuf) {
+	// Replaces the buffer's storage with a persistently mapped, coherent one, large enough for
+	// GL33_BUFFER_RING_SEGMENTS copies of the buffer. This is done on a fresh GL object, because
+	// immutable storage can't be undone if mapping fails.
+
+	GLenum target = gl33_bindidx_to_glenum(cbuf->bindidx);
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	GLsizeiptr storage_size = cbuf->size * GL33_BUFFER_RING_SEGMENTS;
+	GLuint saved = gl33_buffer_current(cbuf->bindidx);
+	GLuint handle;
+
+	glGenBuffers(1, &handle);
+	gl33_bind_buffer(cbuf->bindidx, handle);
+	gl33_sync_buffer(cbuf->bindidx);
+	glBufferStorage(target, storage_size, NULL, flags);
+	char *mapping = glMapBufferRange(target, 0, storage_size, flags);
+
+	if(mapping == NULL) {
+		log_warn("%s: couldn't map persistent storage; using the fallback path", cbuf->debug_label);
+		gl33_bind_buffer(cbuf->bindidx, 0);
+		gl33_sync_buffer(cbuf->bindidx);
+		glDeleteBuffers(1, &handle);
+		gl33_bind_buffer(cbuf->bindidx, saved);
+		return false;
+	}
+
+	GLuint old_handle = cbuf->gl_handle;
+	gl33_buffer_deleted(cbuf);
+	glDeleteBuffers(1, &old_handle);
+	cbuf->gl_handle = handle;
+	gl33_bind_buffer(cbuf->bindidx, saved == old_handle ? handle : saved);
+	glcommon_set_debug_label_gl(GL_BUFFER, handle, cbuf->debug_label);
+
+	// invalidation discards the contents anyway, so the shadow copy is no longer needed
+	free(cbuf->cache.buffer);
+	cbuf->cache.buffer = mapping;
+	cbuf->cache.update_begin = cbuf->size;
+	cbuf->cache.update_end = 0;
+	cbuf->offset = 0;
+
+	cbuf->ring.mapping = mapping;
+	cbuf->ring.base_offset = 0;
+
+	log_debug("%s: using %zukb of persistently mapped storage", cbuf->debug_label, (size_t)storage_size / 1024);
+	return true;
+}
+
+static uint gl33_buffer_ring_segments_mask(CommonBuffer *cbuf, size_t begin) {
+	uint first = begin / cbuf->size;
+	uint last = (begin + cbuf->size - 1) / cbuf->size;
+	assert(last < GL33_BUFFER_RING_SEGMENTS);
+	return ((2u << last) - 1) & ~((1u << first) - 1);
+}
+
+static void gl33_buffer_ring_advance(CommonBuffer *cbuf) {
+	// The write window is always cbuf->size bytes long and starts where the previous one's
+	// writes ended, so that buffers invalidated after every draw don't burn through the ring.
+	// A segment is fenced once the window moves past it, and waited on before it's re-entered.
+
+	size_t ring_size = cbuf->size * GL33_BUFFER_RING_SEGMENTS;
+	size_t old_base = cbuf->ring.base_offset;
+	size_t new_base = old_base + ((cbuf->offset + GL33_BUFFER_RING_ALIGNMENT - 1) & ~(size_t)(GL33_BUFFER_RING_ALIGNMENT - 1));
+
+	if(new_base + cbuf->size > ring_size) {
+		new_base = 0;
+	}
+
+	uint old_segments = gl33_buffer_ring_segments_mask(cbuf, old_base);
+	uint new_segments = gl33_buffer_ring_segments_mask(cbuf, new_base);
+
+	for(uint i = 0; i < GL33_BUFFER_RING_SEGMENTS; ++i) {
+		if((old_segments & ~new_segments) & (1u << i)) {
+			// everything that may read from this segment has been submitted by now
+			assert(cbuf->ring.fences[i] == NULL);
+			cbuf->ring.fences[i] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		}
+	}
+
+	for(uint i = 0; i < GL33_BUFFER_RING_SEGMENTS; ++i) {
+		GLsync fence = cbuf->ring.fences[i];
+
+		if(!((new_segments & ~old_segments) & (1u << i)) || fence == NULL) {
+			continue;
+		}
+
+		GLenum result;
+
+		do {
+			result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+		} while(result == GL_TIMEOUT_EXPIRED);
+
+		if(result == GL_WAIT_FAILED) {
+			log_warn("%s: glClientWaitSync() failed", cbuf->debug_label);
+		}
+
+		glDeleteSync(fence);
+		cbuf->ring.fences[i] = NULL;
+	}
+
+	cbuf->ring.base_offset = new_base;
+	cbuf->cache.buffer = cbuf->ring.mapping + new_base;
+}
+#endif
+
 void gl33_buffer_invalidate(CommonBuffer *cbuf) {
+#ifndef STATIC_GLES3
+	if(cbuf->ring.mapping != NULL) {
+		if(cbuf->offset > 0) {
+			gl33_buffer_ring_advance(cbuf);
+			cbuf->offset = 0;
+		}
+
+		return;
+	}
+
+	// Buffers that get invalidated are used for streaming; move them to persistent storage if possible.
+	if(!cbuf->ring.unavailable) {
+		if(glext.buffer_storage && gl33_buffer_init_ring(cbuf)) {
+			return;
+		}
+
+		cbuf->ring.unavailable = true;
+	}
+#endif
+
 	GL33_BUFFER_TEMP_BIND(cbuf, {
 		glBufferData(gl33_bindidx_to_glenum(cbuf->bindidx), cbuf->size, NULL, GL_DYNAMIC_DRAW);
 	});
@@ -118,6 +275,13 @@ void gl33_buffer_invalidate(CommonBuffer *cbuf) {
 }
 
 void gl33_buffer_flush(CommonBuffer *cbuf) {
+	if(cbuf->ring.mapping != NULL) {
+		// coherent mapping: writes are visible to subsequent GL commands without an upload
+		cbuf->cache.update_begin = cbuf->size;
+		cbuf->cache.update_end = 0;
+		return;
+	}
+
 	if(cbuf->cache.update_begin >= cbuf->cache.update_end) {
 		return;
 	}
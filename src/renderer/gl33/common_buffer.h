@@ -16,6 +16,10 @@
 
 typedef struct CommonBuffer CommonBuffer;
 
+// Persistently mapped streaming buffers; see gl33_buffer_invalidate.
+#define GL33_BUFFER_RING_SEGMENTS 3
+#define GL33_BUFFER_RING_ALIGNMENT 256
+
 struct CommonBuffer {
 	union {
 		SDL_RWops stream;
@@ -28,6 +32,16 @@ struct CommonBuffer {
 				size_t update_end;
 			} cache;
 
+			// Persistently mapped storage of GL33_BUFFER_RING_SEGMENTS * size bytes.
+			// Only the size bytes starting at base_offset are in use at any given time.
+			// If mapping is NULL, the buffer is a regular buffer and base_offset is 0.
+			struct {
+				char *mapping;
+				GLsync fences[GL33_BUFFER_RING_SEGMENTS];
+				size_t base_offset;
+				bool unavailable;
+			} ring;
+
 			size_t offset;
 			size_t size;
 			GLuint gl_handle;
@@ -50,6 +64,8 @@ void gl33_buffer_init(CommonBuffer *cbuf, size_t capacity, void *data, GLenum us
 void gl33_buffer_destroy(CommonBuffer *cbuf);
 void gl33_buffer_invalidate(CommonBuffer *cbuf);
 SDL_RWops* gl33_buffer_get_stream(CommonBuffer *cbuf);
+void* gl33_buffer_reserve(CommonBuffer *cbuf, size_t min_size, size_t *out_available);
+void gl33_buffer_commit(CommonBuffer *cbuf, size_t size);
 void gl33_buffer_flush(CommonBuffer *cbuf);
 
 #define GL33_BUFFER_TEMP_BIND(cbuf, code) do { \
@@ -11,6 +11,17 @@
 #include "framebuffer.h"
 #include "gl33.h"
 #include "../glcommon/debug.h"
+#include "dynarray.h"
+
+typedef struct FramebufferAsyncRead {
+	Pixmap pixmap;  // no data until the read completes
+	FramebufferReadAsyncCallback callback;
+	void *userdata;
+	GLuint pbo;
+	GLsync fence;
+} FramebufferAsyncRead;
+
+static DYNAMIC_ARRAY(FramebufferAsyncRead) async_reads;
 
 static GLuint r_attachment_to_gl_attachment[] = {
 	[FRAMEBUFFER_ATTACH_DEPTH] = GL_DEPTH_ATTACHMENT,
@@ -184,3 +195,148 @@ IntExtent gl33_framebuffer_get_effective_size(Framebuffer *framebuffer) {
 
 	return fb_size;
 }
+
+static bool gl33_framebuffer_can_read_async(void) {
+	return
+		glext.pixel_buffer_object &&
+		HAVE_GL_FUNC(glFenceSync) &&
+		HAVE_GL_FUNC(glClientWaitSync) &&
+		HAVE_GL_FUNC(glMapBufferRange);
+}
+
+void gl33_framebuffer_read_async(Framebuffer *framebuffer, FramebufferAttachment attachment, IntRect region, void *userdata, FramebufferReadAsyncCallback callback) {
+	if(framebuffer != NULL && glext.version.is_es && !GLES_ATLEAST(3, 0)) {
+		log_error("Reading from framebuffer objects is not supported in this context");
+		callback(NULL, userdata);
+		return;
+	}
+
+	r_flush_sprites();
+
+	Pixmap pixmap = {
+		.width = region.w,
+		.height = region.h,
+		.format = PIXMAP_FORMAT_RGBA8,
+		.origin = PIXMAP_ORIGIN_BOTTOMLEFT,
+	};
+
+	if(framebuffer != NULL) {
+		assert(attachment >= FRAMEBUFFER_ATTACH_COLOR0 && attachment < FRAMEBUFFER_MAX_ATTACHMENTS);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer->gl_fbo);
+
+		if(HAVE_GL_FUNC(glReadBuffer)) {
+			glReadBuffer(r_attachment_to_gl_attachment[attachment]);
+		}
+	}
+
+	if(gl33_framebuffer_can_read_async()) {
+		FramebufferAsyncRead *read = dynarray_append(&async_reads);
+		read->pixmap = pixmap;
+		read->callback = callback;
+		read->userdata = userdata;
+
+		GLuint prev_pbo = gl33_buffer_current(GL33_BUFFER_BINDING_PIXEL_PACK);
+		glGenBuffers(1, &read->pbo);
+		gl33_bind_buffer(GL33_BUFFER_BINDING_PIXEL_PACK, read->pbo);
+		gl33_sync_buffer(GL33_BUFFER_BINDING_PIXEL_PACK);
+		glBufferData(GL_PIXEL_PACK_BUFFER, pixmap_data_size(&pixmap), NULL, GL_STREAM_READ);
+		glReadPixels(region.x, region.y, region.w, region.h, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		read->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		gl33_bind_buffer(GL33_BUFFER_BINDING_PIXEL_PACK, prev_pbo);
+		gl33_sync_buffer(GL33_BUFFER_BINDING_PIXEL_PACK);
+	} else {
+		pixmap.data.untyped = pixmap_alloc_buffer_for_copy(&pixmap);
+		glReadPixels(region.x, region.y, region.w, region.h, GL_RGBA, GL_UNSIGNED_BYTE, pixmap.data.untyped);
+	}
+
+	if(framebuffer != NULL) {
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	}
+
+	if(pixmap.data.untyped != NULL) {
+		callback(&pixmap, userdata);
+	}
+}
+
+static bool gl33_framebuffer_complete_async_read(FramebufferAsyncRead *read, bool wait) {
+	GLenum status;
+
+	if(wait) {
+		do {
+			status = glClientWaitSync(read->fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000ull);
+		} while(status == GL_TIMEOUT_EXPIRED);
+	} else {
+		status = glClientWaitSync(read->fence, 0, 0);
+
+		if(status == GL_TIMEOUT_EXPIRED) {
+			return false;
+		}
+	}
+
+	glDeleteSync(read->fence);
+	read->fence = NULL;
+
+	if(status == GL_WAIT_FAILED) {
+		log_error("glClientWaitSync() failed");
+	} else {
+		size_t size = pixmap_data_size(&read->pixmap);
+		GLuint prev_pbo = gl33_buffer_current(GL33_BUFFER_BINDING_PIXEL_PACK);
+		gl33_bind_buffer(GL33_BUFFER_BINDING_PIXEL_PACK, read->pbo);
+		gl33_sync_buffer(GL33_BUFFER_BINDING_PIXEL_PACK);
+
+		void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+
+		if(mapped != NULL) {
+			read->pixmap.data.untyped = pixmap_alloc_buffer_for_copy(&read->pixmap);
+			memcpy(read->pixmap.data.untyped, mapped, size);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		} else {
+			log_error("glMapBufferRange() failed");
+		}
+
+		gl33_bind_buffer(GL33_BUFFER_BINDING_PIXEL_PACK, prev_pbo);
+		gl33_sync_buffer(GL33_BUFFER_BINDING_PIXEL_PACK);
+	}
+
+	glDeleteBuffers(1, &read->pbo);
+	read->pbo = 0;
+
+	return true;
+}
+
+void gl33_framebuffer_finish_async_reads(bool wait) {
+	uint num_reads = async_reads.num_elements;
+
+	if(num_reads == 0) {
+		if(wait) {
+			dynarray_free_data(&async_reads);
+		}
+
+		return;
+	}
+
+	// Callbacks may start new reads, so only run them once the array is consistent again
+	FramebufferAsyncRead completed[num_reads];
+	uint num_completed = 0;
+	uint num_pending = 0;
+
+	dynarray_foreach_elem(&async_reads, FramebufferAsyncRead *read, {
+		if(gl33_framebuffer_complete_async_read(read, wait)) {
+			completed[num_completed++] = *read;
+		} else {
+			async_reads.data[num_pending++] = *read;
+		}
+	});
+
+	async_reads.num_elements = num_pending;
+
+	for(uint i = 0; i < num_completed; ++i) {
+		FramebufferAsyncRead *read = completed + i;
+		read->callback(read->pixmap.data.untyped ? &read->pixmap : NULL, read->userdata);
+	}
+
+	if(wait) {
+		assert(async_reads.num_elements == 0);
+		dynarray_free_data(&async_reads);
+	}
+}
@@ -36,5 +36,7 @@ void gl33_framebuffer_clear(Framebuffer *framebuffer, ClearBufferFlags flags, co
 IntExtent gl33_framebuffer_get_effective_size(Framebuffer *framebuffer);
 void gl33_framebuffer_set_debug_label(Framebuffer *fb, const char *label);
 const char* gl33_framebuffer_get_debug_label(Framebuffer* fb);
+void gl33_framebuffer_read_async(Framebuffer *framebuffer, FramebufferAttachment attachment, IntRect region, void *userdata, FramebufferReadAsyncCallback callback);
+void gl33_framebuffer_finish_async_reads(bool wait);
 
 #endif // IGUARD_renderer_gl33_framebuffer_h
@@ -23,6 +23,7 @@ typedef enum BufferBindingIndex {
 	GL33_BUFFER_BINDING_ARRAY,
 	GL33_BUFFER_BINDING_COPY_WRITE,
 	GL33_BUFFER_BINDING_PIXEL_UNPACK,
+	GL33_BUFFER_BINDING_PIXEL_PACK,
 
 	GL33_NUM_BUFFER_BINDINGS,
 
@@ -22,6 +22,7 @@ static GLenum va_type_to_gl_type[] = {
 	[VA_USHORT] = GL_UNSIGNED_SHORT,
 	[VA_INT]    = GL_INT,
 	[VA_UINT]   = GL_UNSIGNED_INT,
+	[VA_HALF]   = GL_HALF_FLOAT,
 };
 
 VertexArray* gl33_vertex_array_create(void) {
@@ -41,6 +42,7 @@ void gl33_vertex_array_destroy(VertexArray *varr) {
 	gl33_vertex_array_deleted(varr);
 	glDeleteVertexArrays(1, &varr->gl_handle);
 	free(varr->attachments);
+	free(varr->attachment_states);
 	free(varr->attribute_layout);
 	free(varr);
 }
@@ -92,7 +94,7 @@ static void gl33_vertex_array_update_layout(VertexArray *varr) {
 					va_type_to_gl_type[a->spec.type],
 					a->spec.coversion == VA_CONVERT_FLOAT_NORMALIZED,
 					a->stride,
-					(void*)a->offset
+					(void*)(a->offset + vbuf->cbuf.ring.base_offset)
 				);
 
 				break;
@@ -103,7 +105,7 @@ static void gl33_vertex_array_update_layout(VertexArray *varr) {
 					a->spec.elements,
 					va_type_to_gl_type[a->spec.type],
 					a->stride,
-					(void*)a->offset
+					(void*)(a->offset + vbuf->cbuf.ring.base_offset)
 				);
 
 				break;
@@ -135,8 +137,13 @@ void gl33_vertex_array_attach_vertex_buffer(VertexArray *varr, VertexBuffer *vbu
 
 	// TODO: more efficient way of handling this?
 	if(attachment >= varr->num_attachments) {
-		varr->attachments = realloc(varr->attachments, (attachment + 1) * sizeof(VertexBuffer*));
-		varr->num_attachments = attachment + 1;
+		uint old_num = varr->num_attachments;
+		uint new_num = attachment + 1;
+		varr->attachments = realloc(varr->attachments, new_num * sizeof(*varr->attachments));
+		varr->attachment_states = realloc(varr->attachment_states, new_num * sizeof(*varr->attachment_states));
+		memset(varr->attachments + old_num, 0, (new_num - old_num) * sizeof(*varr->attachments));
+		memset(varr->attachment_states + old_num, 0, (new_num - old_num) * sizeof(*varr->attachment_states));
+		varr->num_attachments = new_num;
 	}
 
 	varr->attachments[attachment] = vbuf;
@@ -178,7 +185,35 @@ void gl33_vertex_array_set_debug_label(VertexArray *varr, const char *label) {
 	glcommon_set_debug_label(varr->debug_label, "VAO", GL_VERTEX_ARRAY, varr->gl_handle, label);
 }
 
+static void gl33_vertex_array_check_attachments(VertexArray *varr) {
+	for(uint i = 0; i < varr->num_attachments; ++i) {
+		VertexBuffer *vbuf = varr->attachments[i];
+		VertexArrayAttachmentState *state = varr->attachment_states + i;
+
+		if(
+			vbuf == NULL || (
+				state->gl_handle == vbuf->cbuf.gl_handle &&
+				state->base_offset == vbuf->cbuf.ring.base_offset
+			)
+		) {
+			continue;
+		}
+
+		// the buffer has moved to a new GL object or ring segment; re-point its attributes
+		for(uint a = 0; a < varr->num_attributes; ++a) {
+			if(varr->attribute_layout[a].attachment == i) {
+				varr->layout_dirty_bits |= (1u << a);
+			}
+		}
+
+		state->gl_handle = vbuf->cbuf.gl_handle;
+		state->base_offset = vbuf->cbuf.ring.base_offset;
+	}
+}
+
 void gl33_vertex_array_flush_buffers(VertexArray *varr) {
+	gl33_vertex_array_check_attachments(varr);
+
 	if(varr->layout_dirty_bits) {
 		gl33_vertex_array_update_layout(varr);
 	}
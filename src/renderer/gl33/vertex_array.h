@@ -17,8 +17,16 @@
 #define VAO_MAX_BUFFERS 31
 #define VAO_INDEX_BIT (1u << VAO_MAX_BUFFERS)
 
+// What the VAO's attribute pointers were last set up against, per attachment.
+// Streaming buffers may change both over their lifetime (see gl33_buffer_invalidate).
+typedef struct VertexArrayAttachmentState {
+	GLuint gl_handle;
+	size_t base_offset;
+} VertexArrayAttachmentState;
+
 struct VertexArray {
 	VertexBuffer **attachments;
+	VertexArrayAttachmentState *attachment_states;
 	VertexAttribFormat *attribute_layout;
 	IndexBuffer *index_attachment;
 	GLuint gl_handle;
@@ -45,3 +45,11 @@ void gl33_vertex_buffer_flush(VertexBuffer *vbuf) {
 SDL_RWops* gl33_vertex_buffer_get_stream(VertexBuffer *vbuf) {
 	return gl33_buffer_get_stream(&vbuf->cbuf);
 }
+
+void* gl33_vertex_buffer_reserve(VertexBuffer *vbuf, size_t min_size, size_t *out_available) {
+	return gl33_buffer_reserve(&vbuf->cbuf, min_size, out_available);
+}
+
+void gl33_vertex_buffer_commit(VertexBuffer *vbuf, size_t size) {
+	gl33_buffer_commit(&vbuf->cbuf, size);
+}
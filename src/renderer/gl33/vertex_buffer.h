@@ -23,6 +23,8 @@ void gl33_vertex_buffer_set_debug_label(VertexBuffer *vbuf, const char *label);
 void gl33_vertex_buffer_destroy(VertexBuffer *vbuf);
 void gl33_vertex_buffer_invalidate(VertexBuffer *vbuf);
 SDL_RWops* gl33_vertex_buffer_get_stream(VertexBuffer *vbuf);
+void* gl33_vertex_buffer_reserve(VertexBuffer *vbuf, size_t min_size, size_t *out_available);
+void gl33_vertex_buffer_commit(VertexBuffer *vbuf, size_t size);
 void gl33_vertex_buffer_flush(VertexBuffer *vbuf);
 
 #endif // IGUARD_renderer_gl33_vertex_buffer_h
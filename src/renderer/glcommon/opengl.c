@@ -25,6 +25,9 @@ typedef void (*glad_glproc_ptr)(void);
 typedef void (APIENTRY *PFNGLDRAWELEMENTSINSTANCEDBASEVERTEXBASEINSTANCEANGLEPROC)(GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei instancecount, GLint basevertex, GLuint baseinstance);
 static PFNGLDRAWELEMENTSINSTANCEDBASEVERTEXBASEINSTANCEANGLEPROC glad_glDrawElementsInstancedBaseVertexBaseInstanceANGLE;
 
+// See opengl.h
+PFNGLBUFFERSTORAGEPROC glad_glBufferStorage;
+
 //
 // shims
 //
@@ -236,6 +239,26 @@ static void glcommon_ext_base_instance(void) {
 	EXT_MISSING();
 }
 
+static void glcommon_ext_buffer_storage(void) {
+	EXT_FLAG(buffer_storage);
+
+#ifndef STATIC_GLES3
+	if(
+		HAVE_GL_FUNC(glBufferStorage) &&
+		HAVE_GL_FUNC(glMapBufferRange) &&
+		HAVE_GL_FUNC(glFenceSync) &&
+		HAVE_GL_FUNC(glClientWaitSync) &&
+		HAVE_GL_FUNC(glDeleteSync)
+	) {
+		CHECK_CORE(GL_ATLEAST(4, 4));
+		CHECK_EXT(GL_ARB_buffer_storage);
+		CHECK_EXT(GL_EXT_buffer_storage);
+	}
+#endif
+
+	EXT_MISSING();
+}
+
 static void glcommon_ext_pixel_buffer_object(void) {
 	EXT_FLAG(pixel_buffer_object);
 
@@ -646,6 +669,7 @@ void glcommon_check_capabilities(void) {
 	}
 
 	glcommon_ext_base_instance();
+	glcommon_ext_buffer_storage();
 	glcommon_ext_clear_texture();
 	glcommon_ext_color_buffer_float();
 	glcommon_ext_debug_output();
@@ -729,6 +753,12 @@ void glcommon_load_functions(void) {
 		glDrawElementsInstancedBaseInstance = shim_glDrawElementsInstancedBaseInstanceANGLE;
 	}
 
+	glBufferStorage = (PFNGLBUFFERSTORAGEPROC)load_gl_func("glBufferStorage");
+
+	if(!HAVE_GL_FUNC(glBufferStorage)) {
+		glBufferStorage = (PFNGLBUFFERSTORAGEPROC)load_gl_func("glBufferStorageEXT");
+	}
+
 	// GLES has only glClearDepthf
 	// Core has only glClearDepth until GL 4.1
 
@@ -56,6 +56,20 @@
 	#ifndef APIENTRY
 		#define APIENTRY GLAD_API_PTR
 	#endif
+
+	//
+	// GL_ARB_buffer_storage / GL_EXT_buffer_storage are not in our glad build, so they are loaded manually.
+	//
+	#ifndef GL_MAP_PERSISTENT_BIT
+		#define GL_MAP_PERSISTENT_BIT 0x0040
+		#define GL_MAP_COHERENT_BIT 0x0080
+		#define GL_DYNAMIC_STORAGE_BIT 0x0100
+		#define GL_CLIENT_STORAGE_BIT 0x0200
+	#endif
+
+	typedef void (APIENTRY *PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+	extern PFNGLBUFFERSTORAGEPROC glad_glBufferStorage;
+	#define glBufferStorage glad_glBufferStorage
 #endif
 
 #include "assert.h"
@@ -125,6 +139,7 @@ struct glext_s {
 	} issues;
 
 	ext_flag_t base_instance;
+	ext_flag_t buffer_storage;
 	ext_flag_t clear_texture;
 	ext_flag_t color_buffer_float;
 	ext_flag_t debug_output;
@@ -107,6 +107,7 @@ static void null_framebuffer(Framebuffer *framebuffer) { }
 static Framebuffer* null_framebuffer_current(void) { return (void*)&placeholder; }
 static void null_framebuffer_clear(Framebuffer *framebuffer, ClearBufferFlags flags, const Color *colorval, float depthval) { }
 static IntExtent null_framebuffer_get_size(Framebuffer *framebuffer) { return (IntExtent) { 64, 64 }; }
+static void null_framebuffer_read_async(Framebuffer *framebuffer, FramebufferAttachment attachment, IntRect region, void *userdata, FramebufferReadAsyncCallback callback) { callback(NULL, userdata); }
 
 static int64_t null_vertex_buffer_stream_seek(SDL_RWops *rw, int64_t offset, int whence) { return 0; }
 static int64_t null_vertex_buffer_stream_size(SDL_RWops *rw) { return (1 << 16); }
@@ -136,6 +137,20 @@ static const char* null_vertex_buffer_get_debug_label(VertexBuffer *vbuf) { retu
 static void null_vertex_buffer_destroy(VertexBuffer *vbuf) { }
 static void null_vertex_buffer_invalidate(VertexBuffer *vbuf) { }
 
+static void* null_vertex_buffer_reserve(VertexBuffer *vbuf, size_t min_size, size_t *out_available) {
+	static char scratch[1 << 16];
+
+	if(min_size > sizeof(scratch)) {
+		*out_available = 0;
+		return NULL;
+	}
+
+	*out_available = sizeof(scratch);
+	return scratch;
+}
+
+static void null_vertex_buffer_commit(VertexBuffer *vbuf, size_t size) { }
+
 static IndexBuffer* null_index_buffer_create(size_t max_elements) { return (void*)&placeholder; }
 static size_t null_index_buffer_get_capacity(IndexBuffer *ibuf) { return UINT32_MAX; }
 static const char* null_index_buffer_get_debug_label(IndexBuffer *ibuf) { return "null index buffer"; }
@@ -222,12 +237,15 @@ RendererBackend _r_backend_null = {
 		.framebuffer_current = null_framebuffer_current,
 		.framebuffer_clear = null_framebuffer_clear,
 		.framebuffer_get_size = null_framebuffer_get_size,
+		.framebuffer_read_async = null_framebuffer_read_async,
 		.vertex_buffer_create = null_vertex_buffer_create,
 		.vertex_buffer_get_debug_label = null_vertex_buffer_get_debug_label,
 		.vertex_buffer_set_debug_label = null_vertex_buffer_set_debug_label,
 		.vertex_buffer_destroy = null_vertex_buffer_destroy,
 		.vertex_buffer_invalidate = null_vertex_buffer_invalidate,
 		.vertex_buffer_get_stream = null_vertex_buffer_get_stream,
+		.vertex_buffer_reserve = null_vertex_buffer_reserve,
+		.vertex_buffer_commit = null_vertex_buffer_commit,
 		.index_buffer_create = null_index_buffer_create,
 		.index_buffer_get_capacity = null_index_buffer_get_capacity,
 		.index_buffer_get_debug_label = null_index_buffer_get_debug_label,
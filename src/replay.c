@@ -13,6 +13,7 @@
 #include <time.h>
 
 #include "global.h"
+#include "replayverify.h"
 
 static uint8_t replay_magic_header[] = REPLAY_MAGIC_HEADER;
 
@@ -803,7 +804,9 @@ void replay_stage_check_desync(ReplayStage *stg, int time, uint16_t check, Repla
 			log_warn("Frame %d: replay desync detected! 0x%04x != 0x%04x", time, stg->desync_check, check);
 			stg->desynced = true;
 
-			if(global.is_replay_verification) {
+			if(replayverify_active()) {
+				replayverify_desync(stg, time, stg->desync_check, check);
+			} else if(global.is_replay_verification) {
 				// log_fatal("Replay verification failed");
 				exit(1);
 			}
@@ -913,7 +916,11 @@ static void replay_do_cleanup(CallChainResult ccr) {
 	global.replaymode = REPLAY_RECORD;
 	replay_destroy(&global.replay);
 	global.replay_stage = NULL;
-	free_resources(false);
+
+	if(!replayverify_active()) {
+		// keep everything loaded for the next replay in the batch
+		free_resources(false);
+	}
 
 	CallChain cc = ctx->cc;
 	free(ctx);
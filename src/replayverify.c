@@ -0,0 +1,496 @@
+/*
+ * This software is licensed under the terms of the MIT License.
+ * See COPYING for further information.
+ * ---
+ * Copyright (c) 2011-2019, Lukas Weber <laochailan@web.de>.
+ * Copyright (c) 2012-2019, Andrei Alexeyev <akari@taisei-project.org>.
+ */
+
+#include "taisei.h"
+
+#include "replayverify.h"
+#include "global.h"
+#include "hirestime.h"
+#include "dynarray.h"
+#include "util/io.h"
+#include "stage.h"
+#include "taskmanager.h"
+
+#ifdef TAISEI_BUILDCONF_HAVE_POSIX
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#endif
+
+#define RV_MOUNTPOINT "/replay-verify"
+
+typedef enum ReplayVerifyStatus {
+	RV_STATUS_OK,
+	RV_STATUS_DESYNC,
+	RV_STATUS_ERROR,
+	RV_STATUS_CRASH,
+} ReplayVerifyStatus;
+
+typedef struct ReplayVerifyResult {
+	ReplayVerifyStatus status;
+	uint16_t stage;
+	int frame;
+	uint16_t expected;
+	uint16_t actual;
+	hrtime_t start_time;
+} ReplayVerifyResult;
+
+static struct {
+	char *source;
+	char *report_path;
+	SDL_RWops *report;
+	DYNAMIC_ARRAY(char*) files;
+	uint current;
+	uint next_index;
+	uint num_failed;
+	int jobs;
+	ReplayVerifyResult result;
+	CallChain next;
+	bool active;
+
+#ifdef TAISEI_BUILDCONF_HAVE_POSIX
+	// Set in forked workers only
+	struct {
+		SDL_atomic_t *next_index;  // in shared memory, owned by the supervisor
+		int result_fd;
+	} worker;
+#endif
+} rv;
+
+static const char *status_names[] = {
+	[RV_STATUS_OK] = "ok",
+	[RV_STATUS_DESYNC] = "desync",
+	[RV_STATUS_ERROR] = "error",
+	[RV_STATUS_CRASH] = "crash",
+};
+
+void replayverify_init(const char *source, const char *report, int jobs) {
+	stralloc(&rv.source, source);
+	stralloc(&rv.report_path, report);
+	rv.jobs = jobs;
+}
+
+void replayverify_shutdown(void) {
+	dynarray_foreach_elem(&rv.files, char **f, {
+		free(*f);
+	});
+
+	dynarray_free_data(&rv.files);
+	free(rv.source);
+	free(rv.report_path);
+	memset(&rv, 0, sizeof(rv));
+}
+
+bool replayverify_active(void) {
+	return rv.active;
+}
+
+static void rv_add_file(char *path) {
+	*dynarray_append(&rv.files) = path;
+}
+
+static bool rv_is_replay_file(const char *name) {
+	return strendswith(name, "." REPLAY_EXTENSION);
+}
+
+static void rv_collect_list(SDL_RWops *list) {
+	size_t bufsize = 256;
+	char *buf = malloc(bufsize);
+
+	while(SDL_RWgets_realloc(list, &buf, &bufsize)) {
+		char *line = buf;
+		char *end = strchr(line, 0);
+
+		while(*line && isspace(*line)) {
+			++line;
+		}
+
+		while(end > line && isspace(end[-1])) {
+			*--end = 0;
+		}
+
+		if(*line && *line != '#') {
+			rv_add_file(strdup(line));
+		}
+	}
+
+	free(buf);
+}
+
+static void rv_collect_files(void) {
+	if(rv_is_replay_file(rv.source)) {
+		rv_add_file(strdup(rv.source));
+		return;
+	}
+
+	if(!vfs_mount_syspath(RV_MOUNTPOINT, rv.source, VFS_SYSPATH_MOUNT_READONLY)) {
+		log_error("Can't access %s: %s", rv.source, vfs_get_error());
+		return;
+	}
+
+	VFSInfo i = vfs_query(RV_MOUNTPOINT);
+
+	if(!i.exists) {
+		log_error("%s does not exist", rv.source);
+	} else if(i.is_dir) {
+		size_t numfiles;
+		char **files = vfs_dir_list_sorted(RV_MOUNTPOINT, &numfiles, vfs_dir_list_order_ascending, rv_is_replay_file);
+
+		if(files) {
+			for(size_t f = 0; f < numfiles; ++f) {
+				rv_add_file(strfmt("%s%c%s", rv.source, vfs_get_syspath_separator(), files[f]));
+			}
+
+			vfs_dir_list_free(files, numfiles);
+		} else {
+			log_error("Can't list %s: %s", rv.source, vfs_get_error());
+		}
+	} else {
+		SDL_RWops *list = vfs_open(RV_MOUNTPOINT, VFS_MODE_READ);
+
+		if(list) {
+			rv_collect_list(list);
+			SDL_RWclose(list);
+		} else {
+			log_error("Can't open %s: %s", rv.source, vfs_get_error());
+		}
+	}
+
+	vfs_unmount(RV_MOUNTPOINT);
+}
+
+static void rv_open_report(void) {
+	if(rv.report_path) {
+		rv.report = SDL_RWFromFile(rv.report_path, "w");
+
+		if(!rv.report) {
+			log_error("Can't open %s for writing: %s", rv.report_path, SDL_GetError());
+		}
+	}
+
+	if(!rv.report) {
+		rv.report = SDL_RWFromFP(stdout, false);
+	}
+
+	SDL_RWprintf(rv.report, "# file\tstatus\tstage\tframe\texpected\tactual\ttime_ms\n");
+}
+
+static char *rv_format_result(const char *path, ReplayVerifyResult *r) {
+	double ms = (time_get() - r->start_time) / (double)(HRTIME_RESOLUTION / 1000);
+
+	if(r->status == RV_STATUS_DESYNC) {
+		return strfmt("%s\t%s\t%X\t%d\t0x%04x\t0x%04x\t%.1f",
+			path, status_names[r->status], r->stage, r->frame, r->expected, r->actual, ms
+		);
+	}
+
+	return strfmt("%s\t%s\t-\t-\t-\t-\t%.1f", path, status_names[r->status], ms);
+}
+
+#ifdef TAISEI_BUILDCONF_HAVE_POSIX
+static void rv_worker_send_result(const char *line, bool failed) {
+	// Lines shorter than PIPE_BUF are written atomically, so workers don't
+	// need to coordinate access to the shared pipe.
+	char *msg = strfmt("%u\t%d\t%s\n", rv.current, failed, line);
+	size_t len = strlen(msg);
+
+	for(ssize_t w; len > 0; len -= w) {
+		if((w = write(rv.worker.result_fd, msg + strlen(msg) - len, len)) < 0) {
+			log_error("write() failed: %s", strerror(errno));
+			break;
+		}
+	}
+
+	free(msg);
+}
+#endif
+
+static void rv_write_result(const char *path) {
+	ReplayVerifyResult *r = &rv.result;
+	char *line = rv_format_result(path, r);
+	bool failed = r->status != RV_STATUS_OK;
+
+#ifdef TAISEI_BUILDCONF_HAVE_POSIX
+	if(rv.worker.next_index) {
+		rv_worker_send_result(line, failed);
+	} else
+#endif
+	{
+		SDL_RWprintf(rv.report, "%s\n", line);
+	}
+
+	if(failed) {
+		++rv.num_failed;
+	}
+
+	log_info("%s: %s", path, status_names[r->status]);
+	free(line);
+}
+
+static void rv_finish(void) {
+#ifdef TAISEI_BUILDCONF_HAVE_POSIX
+	if(rv.worker.next_index) {
+		// Skip the regular shutdown path; the supervisor owns the report.
+		close(rv.worker.result_fd);
+		fflush(NULL);
+		_exit(0);
+	}
+#endif
+
+	log_info("Verified %u replays, %u failed", rv.files.num_elements, rv.num_failed);
+
+	SDL_RWclose(rv.report);
+	rv.report = NULL;
+	rv.active = false;
+
+	int status = (rv.num_failed || !rv.files.num_elements) ? 1 : 0;
+	CallChain next = rv.next;
+	run_call_chain(&next, (void*)(intptr_t)status);
+}
+
+static void rv_play_next(void);
+
+static bool rv_claim_next(void) {
+#ifdef TAISEI_BUILDCONF_HAVE_POSIX
+	if(rv.worker.next_index) {
+		rv.current = SDL_AtomicAdd(rv.worker.next_index, 1);
+	} else
+#endif
+	{
+		rv.current = rv.next_index++;
+	}
+
+	return rv.current < rv.files.num_elements;
+}
+
+static void rv_replay_done(CallChainResult ccr) {
+	rv_write_result(dynarray_get(&rv.files, rv.current));
+	rv_play_next();
+}
+
+static void rv_play_next(void) {
+	while(!taisei_quit_requested() && rv_claim_next()) {
+		const char *path = dynarray_get(&rv.files, rv.current);
+		Replay rpy = { 0 };
+
+		memset(&rv.result, 0, sizeof(rv.result));
+		rv.result.start_time = time_get();
+
+		if(replay_load_syspath(&rpy, path, REPLAY_READ_ALL)) {
+			// replay_play makes a copy; the chain continues from rv_replay_done
+			replay_play(&rpy, 0, CALLCHAIN(rv_replay_done, NULL));
+			replay_destroy(&rpy);
+			return;
+		}
+
+		replay_destroy(&rpy);
+		rv.result.status = RV_STATUS_ERROR;
+		rv_write_result(path);
+	}
+
+	rv_finish();
+}
+
+#ifdef TAISEI_BUILDCONF_HAVE_POSIX
+/*
+ * Supervisor side of the multi-process mode.
+ *
+ * Everything is preloaded before forking, so the workers share the resource
+ * memory copy-on-write. Workers claim replays from an atomic counter in shared
+ * memory, which balances long and short replays automatically, and stream
+ * "index<TAB>failed<TAB>report line" records back through a single pipe. The
+ * supervisor only collects those, and writes the report in input order once
+ * all workers are gone. Replays that never got a record were being played by
+ * a worker that died, and are reported as crashed.
+ */
+
+static void rv_collect_results(int fd, char **lines) {
+	FILE *fp = fdopen(fd, "r");
+
+	if(!fp) {
+		log_error("fdopen() failed: %s", strerror(errno));
+		close(fd);
+		return;
+	}
+
+	SDL_RWops *rw = SDL_RWFromFP(fp, true);
+
+	if(!rw) {
+		log_error("SDL_RWFromFP() failed: %s", SDL_GetError());
+		fclose(fp);
+		return;
+	}
+
+	size_t bufsize = 256;
+	char *buf = malloc(bufsize);
+
+	while(SDL_RWgets_realloc(rw, &buf, &bufsize)) {
+		char *end, *line;
+		uint idx = strtoul(buf, &end, 10);
+
+		if(*end != '\t' || idx >= rv.files.num_elements || !(line = strchr(end + 1, '\t'))) {
+			log_error("Malformed result from worker: %s", buf);
+			continue;
+		}
+
+		if(strtol(end + 1, NULL, 10)) {
+			++rv.num_failed;
+		}
+
+		char *nl = strchr(++line, '\n');
+
+		if(nl) {
+			*nl = 0;
+		}
+
+		stralloc(lines + idx, line);
+	}
+
+	free(buf);
+	SDL_RWclose(rw);
+}
+
+// Returns true if the calling process should go on to play replays, i.e. it's
+// a worker, or no workers could be started.
+static bool rv_run_farm(void) {
+	uint numfiles = rv.files.num_elements;
+	int jobs = imin(rv.jobs, numfiles);
+	int result_pipe[2];
+
+	SDL_atomic_t *next_index = mmap(NULL, sizeof(*next_index), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+	if(next_index == MAP_FAILED) {
+		log_error("mmap() failed: %s", strerror(errno));
+		return true;
+	}
+
+	if(pipe(result_pipe) < 0) {
+		log_error("pipe() failed: %s", strerror(errno));
+		munmap(next_index, sizeof(*next_index));
+		return true;
+	}
+
+	SDL_AtomicSet(next_index, 0);
+
+	log_info("Preloading resources for %i workers", jobs);
+	stage_preload_all();
+
+	// Worker threads don't survive fork(). Resources are already loaded at
+	// this point, and the taskmgr_global_* API runs tasks inline without them.
+	taskmgr_global_shutdown();
+
+	fflush(NULL);
+
+	int numworkers = 0;
+	pid_t workers[jobs];
+
+	for(int i = 0; i < jobs; ++i) {
+		pid_t pid = fork();
+
+		if(pid == 0) {
+			close(result_pipe[0]);
+			rv.worker.next_index = next_index;
+			rv.worker.result_fd = result_pipe[1];
+			return true;
+		}
+
+		if(pid < 0) {
+			log_error("fork() failed: %s", strerror(errno));
+			break;
+		}
+
+		workers[numworkers++] = pid;
+	}
+
+	close(result_pipe[1]);
+
+	if(numworkers == 0) {
+		close(result_pipe[0]);
+		munmap(next_index, sizeof(*next_index));
+		return true;
+	}
+
+	char **lines = calloc(numfiles, sizeof(*lines));
+	rv_collect_results(result_pipe[0], lines);
+
+	for(int i = 0; i < numworkers; ++i) {
+		int wstatus;
+
+		if(waitpid(workers[i], &wstatus, 0) < 0) {
+			log_error("waitpid() failed: %s", strerror(errno));
+		} else if(WIFSIGNALED(wstatus)) {
+			log_error("Worker %i killed by signal %i", (int)workers[i], WTERMSIG(wstatus));
+		} else if(WEXITSTATUS(wstatus) != 0) {
+			log_error("Worker %i exited with status %i", (int)workers[i], WEXITSTATUS(wstatus));
+		}
+	}
+
+	for(uint i = 0; i < numfiles; ++i) {
+		if(lines[i]) {
+			SDL_RWprintf(rv.report, "%s\n", lines[i]);
+			free(lines[i]);
+		} else {
+			ReplayVerifyResult r = { .status = RV_STATUS_CRASH, .start_time = time_get() };
+			char *line = rv_format_result(dynarray_get(&rv.files, i), &r);
+			SDL_RWprintf(rv.report, "%s\n", line);
+			free(line);
+			++rv.num_failed;
+		}
+	}
+
+	free(lines);
+	munmap(next_index, sizeof(*next_index));
+	rv_finish();
+	return false;
+}
+#endif
+
+void replayverify_run(CallChain next) {
+	assert(rv.source != NULL);
+	assert(!rv.active);
+
+	rv.next = next;
+	rv.next_index = 0;
+	rv.num_failed = 0;
+	rv.active = true;
+
+	rv_collect_files();
+
+	if(!rv.files.num_elements) {
+		log_warn("No replays to verify in %s", rv.source);
+	}
+
+	rv_open_report();
+
+	if(rv.jobs > 1 && rv.files.num_elements > 1) {
+#ifdef TAISEI_BUILDCONF_HAVE_POSIX
+		if(!rv_run_farm()) {
+			return;
+		}
+#else
+		log_warn("Multi-process verification is not supported on this platform");
+#endif
+	}
+
+	rv_play_next();
+}
+
+void replayverify_desync(ReplayStage *stg, int frame, uint16_t expected, uint16_t actual) {
+	assert(rv.active);
+
+	if(rv.result.status == RV_STATUS_OK) {
+		rv.result.status = RV_STATUS_DESYNC;
+		rv.result.stage = stg->stage;
+		rv.result.frame = frame;
+		rv.result.expected = expected;
+		rv.result.actual = actual;
+	}
+
+	global.gameover = GAMEOVER_ABORT;
+}
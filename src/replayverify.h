@@ -0,0 +1,60 @@
+/*
+ * This software is licensed under the terms of the MIT License.
+ * See COPYING for further information.
+ * ---
+ * Copyright (c) 2011-2019, Lukas Weber <laochailan@web.de>.
+ * Copyright (c) 2012-2019, Andrei Alexeyev <akari@taisei-project.org>.
+ */
+
+#ifndef IGUARD_replayverify_h
+#define IGUARD_replayverify_h
+
+#include "taisei.h"
+
+#include "replay.h"
+#include "eventloop/eventloop.h"
+
+/*
+ * Batch replay verification (--verify-replays).
+ *
+ * Plays a set of replays back-to-back in a single process, so that resources
+ * are only loaded once. Each replay gets a full stage state reset, the same as
+ * when starting it from the replay menu. A desync does not terminate the
+ * process; instead the replay is aborted and the mismatch is recorded in a
+ * tab-separated report, one line per replay:
+ *
+ *     file  status  stage  frame  expected  actual  time_ms
+ *
+ * where status is one of "ok", "desync", "error" (failed to load) or "crash"
+ * (the worker process playing it died).
+ *
+ * With more than one job, the supervisor preloads all stage resources and
+ * forks that many worker processes, which share them copy-on-write. Replays
+ * are handed out dynamically; the report is still written in input order.
+ */
+
+// Must be called before vfs_setup. Copies both strings.
+// source is either a directory (all *.tsr files in it are verified, in
+// lexicographic order), a single .tsr file, or a text file listing one
+// replay path per line. report may be NULL to write the report to stdout.
+// jobs is the number of worker processes; 1 or less plays everything in the
+// calling process.
+void replayverify_init(const char *source, const char *report, int jobs)
+	attr_nonnull(1);
+
+void replayverify_shutdown(void);
+
+// Runs the whole batch. Must be called after the game is fully initialized.
+// The CallChainResult's result is an intptr_t exit status: 0 if every replay
+// passed, 1 if any of them failed or there was nothing to verify.
+void replayverify_run(CallChain next);
+
+// True while a batch is in progress.
+bool replayverify_active(void);
+
+// Called by replay_stage_check_desync on a mismatch while a batch is in
+// progress. Records the first desync of the current replay and aborts it.
+void replayverify_desync(ReplayStage *stg, int frame, uint16_t expected, uint16_t actual)
+	attr_nonnull(1);
+
+#endif // IGUARD_replayverify_h
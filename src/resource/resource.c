@@ -28,6 +28,7 @@
 #include "font.h"
 
 #include "renderer/common/backend.h"
+#include "profiler.h"
 
 ResourceHandler *_handlers[] = {
 	[RES_TEXTURE] = &texture_res_handler,
@@ -285,6 +286,7 @@ static ResourceStatus pump_or_wait_for_dependencies(InternalResLoadState *st, bo
 }
 
 static void *load_resource_async_task(void *vdata) {
+	PROFILE_ZONE_BEGIN(z, "load_resource_async");
 	InternalResLoadState *st = vdata;
 	InternalResource *ires = st->ires;
 	assume(st == ires->load);
@@ -348,6 +350,7 @@ retry:
 
 	assume(ires->load == st);
 	SDL_UnlockMutex(ires->mutex);
+	PROFILE_ZONE_END(z);
 	return st;
 }
 
@@ -434,8 +437,10 @@ static bool resource_asyncload_handler(SDL_Event *evt, void *arg) {
 	}
 
 	if(st) {
+		PROFILE_ZONE_BEGIN(z, "load_resource_finish");
 		load_resource_finish(ires->load);
 		res_gstate.loaded_this_frame = true;
+		PROFILE_ZONE_END(z);
 	}
 
 	SDL_UnlockMutex(ires->mutex);
@@ -513,6 +518,7 @@ static void load_resource(InternalResource *ires, const char *name, ResourceFlag
 	} else if(async) {
 		load_resource_async(&st);
 	} else {
+		PROFILE_ZONE_BEGIN(z, "load_resource");
 		st.status = LOAD_NONE;
 		handler->procs.load(&st.st);
 
@@ -530,6 +536,8 @@ static void load_resource(InternalResource *ires, const char *name, ResourceFlag
 				goto retry;
 			default: UNREACHABLE;
 		}
+
+		PROFILE_ZONE_END(z);
 	}
 }
 
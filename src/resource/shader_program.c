@@ -23,6 +23,7 @@ static bool check_shader_program_path(const char *path) {
 struct shprog_load_data {
 	int num_objects;
 	char *objlist;
+	char *compact_variant;
 };
 
 static void load_shader_program_stage1(ResourceLoadState *st);
@@ -35,15 +36,21 @@ static void load_shader_program_stage1(ResourceLoadState *st) {
 	char *strobjects = NULL;
 
 	if(!parse_keyvalue_file_with_spec(st->path, (KVSpec[]){
-		{ "glsl_objects", .out_str = &strobjects, KVSPEC_DEPRECATED("objects") },
-		{ "objects",      .out_str = &strobjects },
+		{ "glsl_objects",    .out_str = &strobjects, KVSPEC_DEPRECATED("objects") },
+		{ "objects",         .out_str = &strobjects },
+		{ "compact_variant", .out_str = &ldata.compact_variant },
 		{ NULL }
 	})) {
 		free(ldata.objlist);
+		free(ldata.compact_variant);
 		res_load_failed(st);
 		return;
 	}
 
+	if(ldata.compact_variant) {
+		res_load_dependency(st, RES_SHADER_PROGRAM, ldata.compact_variant);
+	}
+
 	if(strobjects) {
 		ldata.objlist = calloc(1, strlen(strobjects) + 1);
 		char *listptr = ldata.objlist;
@@ -66,6 +73,7 @@ static void load_shader_program_stage1(ResourceLoadState *st) {
 	} else {
 		log_error("%s: no shader objects to link", st->path);
 		free(ldata.objlist);
+		free(ldata.compact_variant);
 		res_load_failed(st);
 	}
 }
@@ -81,6 +89,7 @@ static void load_shader_program_stage2(ResourceLoadState *st) {
 		if(!(objs[i] = get_resource_data(RES_SHADER_OBJECT, objname, st->flags))) {
 			log_error("%s: couldn't load shader object '%s'", st->path, objname);
 			free(ldata.objlist);
+			free(ldata.compact_variant);
 			res_load_failed(st);
 			return;
 		}
@@ -93,11 +102,24 @@ static void load_shader_program_stage2(ResourceLoadState *st) {
 
 	if(prog) {
 		r_shader_program_set_debug_label(prog, st->name);
+
+		if(ldata.compact_variant) {
+			ShaderProgram *compact_prog = get_resource_data(RES_SHADER_PROGRAM, ldata.compact_variant, st->flags);
+
+			if(compact_prog) {
+				r_sprite_batch_set_compact_shader(prog, compact_prog);
+			} else {
+				log_warn("%s: couldn't load compact variant '%s'", st->path, ldata.compact_variant);
+			}
+		}
+
 		res_load_finished(st, prog);
 	} else {
 		log_error("%s: couldn't link shader program", st->path);
 		res_load_failed(st);
 	}
+
+	free(ldata.compact_variant);
 }
 
 static void unload_shader_program(void *vprog) {
@@ -26,6 +26,8 @@
 #include "eventloop/eventloop.h"
 #include "common_tasks.h"
 #include "stageinfo.h"
+#include "profiler.h"
+#include "benchmark.h"
 
 static void stage_start(StageInfo *stage) {
 	global.timer = 0;
@@ -308,12 +310,35 @@ static bool _stage_should_skip(void) {
 }
 
 static void stage_logic(void) {
+	PROFILE_ZONE_BEGIN(z_logic, "stage_logic");
+
+	ent_compact_registry();
+
+	PROFILE_ZONE_BEGIN(z_boss, "boss");
 	process_boss(&global.boss);
+	PROFILE_ZONE_END(z_boss);
+
+	PROFILE_ZONE_BEGIN(z_enemies, "enemies");
 	process_enemies(&global.enemies);
+	PROFILE_ZONE_END(z_enemies);
+
+	PROFILE_ZONE_BEGIN(z_projs, "projectiles");
+	ent_grid_begin();
 	process_projectiles(&global.projs, true);
+	ent_grid_end();
+	PROFILE_ZONE_END(z_projs);
+
+	PROFILE_ZONE_BEGIN(z_items, "items");
 	process_items();
+	PROFILE_ZONE_END(z_items);
+
+	PROFILE_ZONE_BEGIN(z_lasers, "lasers");
 	process_lasers();
+	PROFILE_ZONE_END(z_lasers);
+
+	PROFILE_ZONE_BEGIN(z_particles, "particles");
 	process_projectiles(&global.particles, false);
+	PROFILE_ZONE_END(z_particles);
 
 	if(global.dialog) {
 		dialog_update(global.dialog);
@@ -335,6 +360,13 @@ static void stage_logic(void) {
 
 	update_sounds();
 
+	if(global.frames % 60 == 0) {
+		// keep newly spawned objects close together in memory
+		PROFILE_ZONE_BEGIN(z_objpools, "objpools");
+		stage_objpools_sort_free_lists();
+		PROFILE_ZONE_END(z_objpools);
+	}
+
 	global.frames++;
 
 	if(!dialog_is_active(global.dialog) && (!global.boss || boss_is_fleeing(global.boss))) {
@@ -351,6 +383,8 @@ static void stage_logic(void) {
 	}
 
 	stagetext_update();
+
+	PROFILE_ZONE_END(z_logic);
 }
 
 void stage_clear_hazards_predicate(bool (*predicate)(EntityInterface *ent, void *arg), void *arg, ClearHazardsFlags flags) {
@@ -371,9 +405,8 @@ void stage_clear_hazards_predicate(bool (*predicate)(EntityInterface *ent, void
 	}
 
 	if(flags & CLEAR_HAZARDS_LASERS) {
-		for(Laser *l = global.lasers.first, *next; l; l = next) {
-			next = l->next;
-
+		// clear_laser() only flags the laser, so the visiting order doesn't matter
+		ENT_FOREACH(Laser, Laser *l, {
 			if(!force && !laser_is_clearable(l)) {
 				continue;
 			}
@@ -381,7 +414,7 @@ void stage_clear_hazards_predicate(bool (*predicate)(EntityInterface *ent, void
 			if(!predicate || predicate(&l->ent, arg)) {
 				clear_laser(l, flags);
 			}
-		}
+		});
 	}
 }
 
@@ -389,49 +422,114 @@ void stage_clear_hazards(ClearHazardsFlags flags) {
 	stage_clear_hazards_predicate(NULL, NULL, flags);
 }
 
-static bool proximity_predicate(EntityInterface *ent, void *varg) {
-	Circle *area = varg;
+/*
+ * Area clears (bombs, spell endings) run every frame for a while, so instead of
+ * going through stage_clear_hazards_predicate, projectiles are tested against
+ * the area in batches with points_in_*_batch. Clearing happens in list order,
+ * exactly as the plain walk would do it. Clearing a projectile can only affect
+ * anything else if it wakes a task waiting for the cleared event; if that
+ * happens, the rest of the batch is stale, so a new one is gathered starting
+ * right after the cleared projectile.
+ */
+
+#define CLEAR_BATCH_SIZE 64
+
+typedef struct ClearArea {
+	bool is_ellipse;
+	union {
+		Circle circle;
+		Ellipse ellipse;
+	};
+} ClearArea;
+
+static void clear_area_test_batch(const ClearArea *area, uint n, double x[n], double y[n], bool hit[n]) {
+	if(area->is_ellipse) {
+		points_in_ellipse_batch(n, x, y, area->ellipse, hit);
+	} else {
+		points_in_circle_batch(n, x, y, area->circle, hit);
+	}
+}
 
-	switch(ent->type) {
-		case ENT_TYPE_ID(Projectile): {
-			Projectile *p = ENT_CAST(ent, Projectile);
-			return cabs(p->pos - area->origin) < area->radius;
+static void clear_projectiles_in_area(const ClearArea *area, ClearHazardsFlags flags) {
+	bool force = flags & CLEAR_HAZARDS_FORCE;
+	Projectile *batch[CLEAR_BATCH_SIZE];
+	Projectile *batch_next[CLEAR_BATCH_SIZE];
+	double x[CLEAR_BATCH_SIZE];
+	double y[CLEAR_BATCH_SIZE];
+	bool hit[CLEAR_BATCH_SIZE];
+
+	for(Projectile *p = global.projs.first; p;) {
+		uint n = 0;
+
+		for(; p && n < CLEAR_BATCH_SIZE; p = p->next) {
+			if(force || projectile_is_clearable(p)) {
+				batch[n] = p;
+				batch_next[n] = p->next;
+				x[n] = creal(p->pos);
+				y[n] = cimag(p->pos);
+				++n;
+			}
 		}
 
-		case ENT_TYPE_ID(Laser): {
-			Laser *l = ENT_CAST(ent, Laser);
-			return laser_intersects_circle(l, *area);
+		if(n == 0) {
+			// Nothing clearable was left in the list.
+			break;
 		}
 
-		default: UNREACHABLE;
+		clear_area_test_batch(area, n, x, y, hit);
+
+		for(uint i = 0; i < n; ++i) {
+			if(!hit[i]) {
+				continue;
+			}
+
+			bool wakes_tasks = batch[i]->events.cleared.num_subscribers > 0;
+			clear_projectile(batch[i], flags);
+
+			if(wakes_tasks) {
+				p = batch_next[i];
+				break;
+			}
+		}
 	}
 }
 
-static bool ellipse_predicate(EntityInterface *ent, void *varg) {
-	Ellipse *e = varg;
+static void clear_lasers_in_area(const ClearArea *area, ClearHazardsFlags flags) {
+	bool force = flags & CLEAR_HAZARDS_FORCE;
 
-	switch(ent->type) {
-		case ENT_TYPE_ID(Projectile): {
-			Projectile *p = ENT_CAST(ent, Projectile);
-			return point_in_ellipse(p->pos, *e);
+	ENT_FOREACH(Laser, Laser *l, {
+		if(!force && !laser_is_clearable(l)) {
+			continue;
 		}
 
-		case ENT_TYPE_ID(Laser): {
-			Laser *l = ENT_CAST(ent, Laser);
-			return laser_intersects_ellipse(l, *e);
+		bool hit = area->is_ellipse
+			? laser_intersects_ellipse(l, area->ellipse)
+			: laser_intersects_circle(l, area->circle);
+
+		if(hit) {
+			clear_laser(l, flags);
 		}
+	});
+}
 
-		default: UNREACHABLE;
+static void stage_clear_hazards_in_area(const ClearArea *area, ClearHazardsFlags flags) {
+	if(flags & CLEAR_HAZARDS_BULLETS) {
+		clear_projectiles_in_area(area, flags);
+	}
+
+	if(flags & CLEAR_HAZARDS_LASERS) {
+		clear_lasers_in_area(area, flags);
 	}
 }
 
 void stage_clear_hazards_at(cmplx origin, double radius, ClearHazardsFlags flags) {
-	Circle area = { origin, radius };
-	stage_clear_hazards_predicate(proximity_predicate, &area, flags);
+	ClearArea area = { .circle = { origin, radius } };
+	stage_clear_hazards_in_area(&area, flags);
 }
 
 void stage_clear_hazards_in_ellipse(Ellipse e, ClearHazardsFlags flags) {
-	stage_clear_hazards_predicate(ellipse_predicate, &e, flags);
+	ClearArea area = { .is_ellipse = true, .ellipse = e };
+	stage_clear_hazards_in_area(&area, flags);
 }
 
 TASK(clear_dialog, NO_ARGS) {
@@ -526,6 +624,22 @@ static void stage_preload(void) {
 	global.stage->procs->preload();
 }
 
+void stage_preload_all(void) {
+	StageInfo *saved_stage = global.stage;
+	int n = stageinfo_get_num_stages();
+
+	for(int i = 0; i < n; ++i) {
+		global.stage = stageinfo_get_by_index(i);
+
+		// missing procs are only stubbed out in stage_enter
+		if(global.stage->procs->preload) {
+			stage_preload();
+		}
+	}
+
+	global.stage = saved_stage;
+}
+
 static void display_stage_title(StageInfo *info) {
 	stagetext_add(info->title,    VIEWPORT_W/2 + I * (VIEWPORT_H/2-40), ALIGN_CENTER, res_font("big"), RGB(1, 1, 1), 50, 85, 35, 35);
 	stagetext_add(info->subtitle, VIEWPORT_W/2 + I * (VIEWPORT_H/2),    ALIGN_CENTER, res_font("standard"), RGB(1, 1, 1), 60, 85, 35, 35);
@@ -831,6 +945,10 @@ void stage_enter(StageInfo *stage, CallChain next) {
 		display_stage_title(stage);
 	}
 
+	if(global.is_benchmark) {
+		benchmark_stage_begin(stage);
+	}
+
 	eventloop_enter(fstate, stage_logic_frame, stage_render_frame, stage_end_loop, FPS);
 }
 
@@ -847,11 +965,16 @@ void stage_end_loop(void* ctx) {
 		}
 	}
 
+	if(global.is_benchmark) {
+		benchmark_stage_end();
+	}
+
 	s->stage->procs->end();
 	stage_draw_shutdown();
 	stage_free();
 	player_free(&global.plr);
 	cosched_finish(&s->sched);
+	coroutines_accounting_stage_end(s->stage->title ? s->stage->title : "<untitled>");
 	rng_make_active(&global.rand_visual);
 	free_all_refs();
 	ent_shutdown();
@@ -73,6 +73,9 @@ typedef struct StageClearBonus {
 void stage_enter(StageInfo *stage, CallChain next);
 void stage_finish(int gameover);
 
+// Preload the resources of every stage, e.g. before forking replay verification workers.
+void stage_preload_all(void);
+
 void stage_pause(void);
 void stage_gameover(void);
 
@@ -48,3 +48,11 @@ void stage_objpools_free(void) {
 	OBJECT_POOLS
 	#undef OBJECT_POOL
 }
+
+void stage_objpools_sort_free_lists(void) {
+	#define OBJECT_POOL(type,field) \
+		objpool_sort_free_list(stage_object_pools.field);
+
+	OBJECT_POOLS
+	#undef OBJECT_POOL
+}
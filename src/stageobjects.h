@@ -31,5 +31,6 @@ extern StageObjectPools stage_object_pools;
 
 void stage_objpools_alloc(void);
 void stage_objpools_free(void);
+void stage_objpools_sort_free_lists(void);
 
 #endif // IGUARD_stageobjects_h
@@ -53,7 +53,17 @@ static void* stagetext_delete(List **dest, List *txt, void *arg) {
 }
 
 void stagetext_free(void) {
-	list_foreach(&textlist, stagetext_delete, NULL);
+	ListAnchor all = { 0 };
+	size_t num_texts = 0;
+
+	for(StageText *t = textlist; t; t = t->next) {
+		all.last = (List*)t;
+		++num_texts;
+	}
+
+	all.first = (List*)textlist;
+	objpool_release_list(stage_object_pools.stagetext, &all, num_texts);
+	textlist = NULL;
 }
 
 static inline float stagetext_alpha(StageText *txt) {
@@ -9,151 +9,526 @@
 #include "taisei.h"
 
 #include "taskmanager.h"
-#include "list.h"
+#include "dynarray.h"
 #include "util.h"
 
+/*
+ * Work-stealing scheduler.
+ *
+ * Every worker owns a Chase–Lev deque. The owner pushes and pops at the bottom
+ * (LIFO), other workers steal from the top (FIFO). Threads that aren't workers
+ * can't touch the deques, so they submit into a worker's inbox instead: a
+ * lock-free stack that is drained in bulk, either by its owner or by a thief.
+ *
+ * Tasks carry an atomic status and a reference count (one for the queue, one for
+ * the submitter), so neither submission nor completion needs a per-task lock.
+ * Blocking only happens when a worker has nothing to do, or when task_wait()
+ * has to wait for a task that's running on another thread. Both use a single
+ * mutex/cond pair per manager, which is only touched if somebody is asleep.
+ *
+ * All of the SDL atomic operations used here are sequentially consistent, which
+ * the deque and the sleep/wake handshakes below rely upon.
+ */
+
+enum {
+	TASKMGR_STARTING,
+	TASKMGR_RUNNING,
+	TASKMGR_FINISHING,
+	TASKMGR_ABORTING,
+};
+
+// Tasks kept around for reuse, at most.
+#define TASK_POOL_SIZE 256
+
+// Initial capacity of a worker's deque. Must be a power of two.
+#define TASK_DEQUE_INITIAL_SIZE 64
+
+// How many times task_wait() polls a running task before going to sleep.
+#define TASK_WAIT_SPIN_COUNT 128
+
+typedef struct TaskDequeBuffer TaskDequeBuffer;
+typedef struct TaskWorker TaskWorker;
+
+struct TaskDequeBuffer {
+	TaskDequeBuffer *prev;
+	int mask;
+	Task *tasks[];
+};
+
+typedef struct TaskDeque {
+	SDL_atomic_t top;
+	SDL_atomic_t bottom;
+	TaskDequeBuffer *buffer;
+} TaskDeque;
+
+struct TaskWorker {
+	TaskManager *mgr;
+	SDL_Thread *thread;
+	TaskDeque deque;
+	Task *inbox;
+	DYNAMIC_ARRAY(Task*) drain_buf;
+	uint32_t rng;
+	uint index;
+};
+
 struct TaskManager {
-	LIST_ANCHOR(Task) queue;
 	SDL_mutex *mutex;
 	SDL_cond *cond;
-	uint numthreads;
-	uint running : 1;
-	uint aborted : 1;
+	SDL_atomic_t state;
 	SDL_atomic_t numtasks;
+	SDL_atomic_t numqueued;
+	SDL_atomic_t numsleepers;
+	SDL_atomic_t numwaiters;
+	SDL_atomic_t next_inbox;
+	uint numthreads;
 	SDL_ThreadPriority thread_prio;
-	SDL_Thread *threads[];
+	TaskWorker workers[];
 };
 
 struct Task {
-	LIST_INTERFACE(Task);
+	Task *next;
+	TaskManager *mgr;
 	task_func_t callback;
 	task_free_func_t userdata_free_callback;
 	void *userdata;
-	int prio;
-	SDL_mutex *mutex;
-	SDL_cond *cond;
-	TaskStatus status;
 	void *result;
-	uint disowned : 1;
-	uint in_queue : 1;
+	int prio;
+	bool topmost;
+	SDL_atomic_t status;
+	SDL_atomic_t refs;
 };
 
 static TaskManager *g_taskmgr;
+static SDL_TLSID worker_tls;
 
-static void taskmgr_free(TaskManager *mgr) {
-	if(mgr->mutex != NULL) {
-		SDL_DestroyMutex(mgr->mutex);
+static struct {
+	SDL_SpinLock lock;
+	Task *free_list;
+	uint num_free;
+} task_pool;
+
+/*
+ * Task pool
+ */
+
+static Task *task_alloc(void) {
+	SDL_AtomicLock(&task_pool.lock);
+	Task *task = task_pool.free_list;
+
+	if(task != NULL) {
+		task_pool.free_list = task->next;
+		--task_pool.num_free;
 	}
 
-	if(mgr->cond != NULL) {
-		SDL_DestroyCond(mgr->cond);
+	SDL_AtomicUnlock(&task_pool.lock);
+
+	if(task == NULL) {
+		task = calloc(1, sizeof(*task));
+	} else {
+		memset(task, 0, sizeof(*task));
 	}
 
-	free(mgr);
+	return task;
 }
 
 static void task_free(Task *task) {
-	assert(!task->in_queue);
-	assert(task->disowned);
-
 	if(task->userdata_free_callback != NULL) {
 		task->userdata_free_callback(task->userdata);
 	}
 
-	if(task->mutex != NULL) {
-		SDL_DestroyMutex(task->mutex);
-	}
+	SDL_AtomicLock(&task_pool.lock);
 
-	if(task->cond != NULL) {
-		SDL_DestroyCond(task->cond);
+	if(task_pool.num_free < TASK_POOL_SIZE) {
+		task->next = task_pool.free_list;
+		task_pool.free_list = task;
+		++task_pool.num_free;
+		task = NULL;
 	}
 
+	SDL_AtomicUnlock(&task_pool.lock);
 	free(task);
 }
 
-static int taskmgr_thread(void *arg) {
-	TaskManager *mgr = arg;
-	attr_unused SDL_threadID tid = SDL_ThreadID();
+static void task_pool_trim(void) {
+	SDL_AtomicLock(&task_pool.lock);
+	Task *list = task_pool.free_list;
+	task_pool.free_list = NULL;
+	task_pool.num_free = 0;
+	SDL_AtomicUnlock(&task_pool.lock);
 
-	if(SDL_SetThreadPriority(mgr->thread_prio) < 0) {
-		log_sdl_error(LOG_WARN, "SDL_SetThreadPriority");
+	for(Task *next; list; list = next) {
+		next = list->next;
+		free(list);
+	}
+}
+
+static void task_unref(Task *task) {
+	if(SDL_AtomicDecRef(&task->refs)) {
+		task_free(task);
+	}
+}
+
+/*
+ * Chase–Lev deque
+ */
+
+static TaskDequeBuffer *deque_buffer_alloc(int size, TaskDequeBuffer *prev) {
+	assert((size & (size - 1)) == 0);
+	TaskDequeBuffer *buf = calloc(1, sizeof(*buf) + size * sizeof(*buf->tasks));
+	buf->mask = size - 1;
+	buf->prev = prev;
+	return buf;
+}
+
+static void deque_init(TaskDeque *dq) {
+	dq->buffer = deque_buffer_alloc(TASK_DEQUE_INITIAL_SIZE, NULL);
+}
+
+static void deque_free(TaskDeque *dq) {
+	for(TaskDequeBuffer *buf = dq->buffer, *prev; buf; buf = prev) {
+		prev = buf->prev;
+		free(buf);
+	}
+}
+
+static inline Task *deque_buffer_get(TaskDequeBuffer *buf, int i) {
+	return SDL_AtomicGetPtr((void**)&buf->tasks[i & buf->mask]);
+}
+
+static inline void deque_buffer_set(TaskDequeBuffer *buf, int i, Task *task) {
+	SDL_AtomicSetPtr((void**)&buf->tasks[i & buf->mask], task);
+}
+
+static TaskDequeBuffer *deque_grow(TaskDeque *dq, TaskDequeBuffer *buf, int top, int bottom) {
+	// NOTE: thieves may still be reading from the old buffer, so it's kept until deque_free()
+	TaskDequeBuffer *newbuf = deque_buffer_alloc((buf->mask + 1) * 2, buf);
+
+	for(int i = top; i < bottom; ++i) {
+		deque_buffer_set(newbuf, i, deque_buffer_get(buf, i));
+	}
+
+	SDL_AtomicSetPtr((void**)&dq->buffer, newbuf);
+	return newbuf;
+}
+
+// Owner only
+static void deque_push(TaskDeque *dq, Task *task) {
+	int bottom = SDL_AtomicGet(&dq->bottom);
+	int top = SDL_AtomicGet(&dq->top);
+	TaskDequeBuffer *buf = SDL_AtomicGetPtr((void**)&dq->buffer);
+
+	if(bottom - top > buf->mask) {
+		buf = deque_grow(dq, buf, top, bottom);
+	}
+
+	deque_buffer_set(buf, bottom, task);
+	SDL_AtomicSet(&dq->bottom, bottom + 1);
+}
+
+// Owner only
+static Task *deque_pop(TaskDeque *dq) {
+	int bottom = SDL_AtomicGet(&dq->bottom) - 1;
+	TaskDequeBuffer *buf = SDL_AtomicGetPtr((void**)&dq->buffer);
+	SDL_AtomicSet(&dq->bottom, bottom);
+	int top = SDL_AtomicGet(&dq->top);
+
+	if(top > bottom) {
+		// empty
+		SDL_AtomicSet(&dq->bottom, bottom + 1);
+		return NULL;
 	}
 
-	bool running;
-	bool aborted;
+	Task *task = deque_buffer_get(buf, bottom);
+
+	if(top == bottom) {
+		// last element; race against the thieves for it
+		if(!SDL_AtomicCAS(&dq->top, top, top + 1)) {
+			task = NULL;
+		}
+
+		SDL_AtomicSet(&dq->bottom, bottom + 1);
+	}
+
+	return task;
+}
+
+// Any thread
+static Task *deque_steal(TaskDeque *dq) {
+	int top = SDL_AtomicGet(&dq->top);
+	int bottom = SDL_AtomicGet(&dq->bottom);
+
+	if(top >= bottom) {
+		return NULL;
+	}
+
+	TaskDequeBuffer *buf = SDL_AtomicGetPtr((void**)&dq->buffer);
+	Task *task = deque_buffer_get(buf, top);
+
+	if(!SDL_AtomicCAS(&dq->top, top, top + 1)) {
+		// lost the race; the caller will just look elsewhere
+		return NULL;
+	}
+
+	return task;
+}
+
+/*
+ * Inboxes
+ */
+
+static void inbox_push(TaskWorker *worker, Task *task) {
+	Task *head;
 
 	do {
-		SDL_LockMutex(mgr->mutex);
+		head = SDL_AtomicGetPtr((void**)&worker->inbox);
+		task->next = head;
+	} while(!SDL_AtomicCASPtr((void**)&worker->inbox, head, task));
+}
+
+static inline bool task_runs_before(const Task *t1, const Task *t2) {
+	if(t1->prio != t2->prio) {
+		return t1->prio < t2->prio;
+	}
+
+	return t1->topmost && !t2->topmost;
+}
+
+// Moves everything from victim's inbox into the worker's own deque.
+static bool inbox_drain(TaskWorker *worker, TaskWorker *victim) {
+	Task *list = SDL_AtomicSetPtr((void**)&victim->inbox, NULL);
+
+	if(list == NULL) {
+		return false;
+	}
+
+	// The inbox holds the newest task first; sort it into execution order.
+	// Within the same priority, topmost tasks go first (newest first), then the rest
+	// in submission order. That's the same order the old priority queue used.
+	// Insertion sort, since the list is almost always already in order.
+
+	worker->drain_buf.num_elements = 0;
+
+	for(Task *t = list; t; t = t->next) {
+		*dynarray_append_with_min_capacity(&worker->drain_buf, 64) = t;
+	}
+
+	Task **batch = worker->drain_buf.data;
+	uint num = worker->drain_buf.num_elements;
+
+	for(uint a = 0, b = num - 1; a < b; ++a, --b) {
+		Task *tmp = batch[a];
+		batch[a] = batch[b];
+		batch[b] = tmp;
+	}
 
-		running = mgr->running;
-		aborted = mgr->aborted;
+	for(uint i = 1; i < num; ++i) {
+		Task *t = batch[i];
+		uint j = i;
 
-		if(!running && !aborted) {
-			SDL_CondWait(mgr->cond, mgr->mutex);
+		for(; j > 0 && (
+			task_runs_before(t, batch[j - 1]) ||
+			(t->topmost && batch[j - 1]->topmost && t->prio == batch[j - 1]->prio)
+		); --j) {
+			batch[j] = batch[j - 1];
 		}
 
-		SDL_UnlockMutex(mgr->mutex);
-	} while(!running && !aborted);
+		batch[j] = t;
+	}
 
-	while(running && !aborted) {
-		SDL_LockMutex(mgr->mutex);
-		Task *task = alist_pop(&mgr->queue);
+	// The owner pops from the bottom, so push in reverse.
+	for(uint i = num; i > 0; --i) {
+		deque_push(&worker->deque, batch[i - 1]);
+	}
+
+	return true;
+}
+
+/*
+ * Workers
+ */
 
-		running = mgr->running;
-		aborted = mgr->aborted;
+static inline uint32_t worker_rand(TaskWorker *worker) {
+	// xorshift32
+	uint32_t x = worker->rng;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return worker->rng = x;
+}
+
+static Task *worker_find_task(TaskWorker *worker) {
+	TaskManager *mgr = worker->mgr;
+	Task *task;
 
-		if(running && task == NULL && !aborted) {
-			SDL_CondWait(mgr->cond, mgr->mutex);
+	if((task = deque_pop(&worker->deque))) {
+		return task;
+	}
+
+	if(inbox_drain(worker, worker) && (task = deque_pop(&worker->deque))) {
+		return task;
+	}
+
+	uint n = mgr->numthreads;
+	uint ofs = worker_rand(worker) % n;
+
+	for(uint i = 0; i < n; ++i) {
+		TaskWorker *victim = mgr->workers + (i + ofs) % n;
+
+		if(victim == worker) {
+			continue;
 		}
 
+		if((task = deque_steal(&victim->deque))) {
+			return task;
+		}
+
+		if(inbox_drain(worker, victim) && (task = deque_pop(&worker->deque))) {
+			return task;
+		}
+	}
+
+	return NULL;
+}
+
+static void task_notify_waiters(TaskManager *mgr) {
+	if(SDL_AtomicGet(&mgr->numwaiters) > 0) {
+		SDL_LockMutex(mgr->mutex);
+		SDL_CondBroadcast(mgr->cond);
 		SDL_UnlockMutex(mgr->mutex);
+	}
+}
 
-		if(task != NULL) {
-			SDL_LockMutex(task->mutex);
+static void task_execute(Task *task) {
+	// Status is TASK_RUNNING here; nobody else will touch the result until it's TASK_FINISHED.
+	task->result = task->callback(task->userdata);
+	SDL_AtomicSet(&task->status, TASK_FINISHED);
+
+	if(task->mgr != NULL) {
+		task_notify_waiters(task->mgr);
+	}
+}
 
-			bool task_disowned = task->disowned;
+static void worker_process_task(TaskWorker *worker, Task *task) {
+	TaskManager *mgr = worker->mgr;
 
-			if(aborted && task->status == TASK_PENDING) {
-				task->status = TASK_CANCELLED;
-			}
+	(void)SDL_AtomicAdd(&mgr->numqueued, -1);
 
-			if(task->status == TASK_PENDING) {
-				task->status = TASK_RUNNING;
-
-				SDL_UnlockMutex(task->mutex);
-				task->result = task->callback(task->userdata);
-				SDL_LockMutex(task->mutex);
-
-				assert(task->in_queue);
-				task->in_queue = false;
-				(void)SDL_AtomicDecRef(&mgr->numtasks);
-
-				if((task_disowned = task->disowned)) {
-					SDL_UnlockMutex(task->mutex);
-					task_free(task);
-				} else {
-					task->status = TASK_FINISHED;
-					SDL_CondBroadcast(task->cond);
-					SDL_UnlockMutex(task->mutex);
-				}
-			} else if(task->status == TASK_CANCELLED || task->status == TASK_RUNNING || task->status == TASK_FINISHED) {
-				assert(task->in_queue);
-				task->in_queue = false;
-				(void)SDL_AtomicDecRef(&mgr->numtasks);
-				SDL_UnlockMutex(task->mutex);
-
-				if(task_disowned) {
-					task_free(task);
-				}
-			} else {
-				UNREACHABLE;
-			}
+	if(SDL_AtomicGet(&mgr->state) == TASKMGR_ABORTING) {
+		(void)SDL_AtomicCAS(&task->status, TASK_PENDING, TASK_CANCELLED);
+	}
+
+	if(SDL_AtomicCAS(&task->status, TASK_PENDING, TASK_RUNNING)) {
+		task_execute(task);
+	}
+
+	// Otherwise it was cancelled, or task_wait() already ran it.
+
+	task_unref(task);
+
+	if(SDL_AtomicDecRef(&mgr->numtasks) && SDL_AtomicGet(&mgr->state) > TASKMGR_RUNNING) {
+		// Last one; let the sleeping workers know it's time to go.
+		SDL_LockMutex(mgr->mutex);
+		SDL_CondBroadcast(mgr->cond);
+		SDL_UnlockMutex(mgr->mutex);
+	}
+}
+
+static void worker_sleep(TaskWorker *worker) {
+	TaskManager *mgr = worker->mgr;
+
+	SDL_LockMutex(mgr->mutex);
+	SDL_AtomicIncRef(&mgr->numsleepers);
+
+	// Pairs with taskmgr_wake_worker(): the submitter increments numqueued before
+	// checking numsleepers, so either we see the new task, or it sees us.
+	// When shutting down, keep waiting while other workers still run tasks, since
+	// those may submit more.
+	if(
+		SDL_AtomicGet(&mgr->numqueued) == 0 && (
+			SDL_AtomicGet(&mgr->state) <= TASKMGR_RUNNING ||
+			SDL_AtomicGet(&mgr->numtasks) > 0
+		)
+	) {
+		SDL_CondWait(mgr->cond, mgr->mutex);
+	}
+
+	(void)SDL_AtomicDecRef(&mgr->numsleepers);
+	SDL_UnlockMutex(mgr->mutex);
+}
+
+static int taskmgr_thread(void *arg) {
+	TaskWorker *worker = arg;
+	TaskManager *mgr = worker->mgr;
+
+	if(SDL_SetThreadPriority(mgr->thread_prio) < 0) {
+		log_sdl_error(LOG_WARN, "SDL_SetThreadPriority");
+	}
+
+	SDL_TLSSet(worker_tls, worker, NULL);
+
+	SDL_LockMutex(mgr->mutex);
+
+	while(SDL_AtomicGet(&mgr->state) == TASKMGR_STARTING) {
+		SDL_CondWait(mgr->cond, mgr->mutex);
+	}
+
+	SDL_UnlockMutex(mgr->mutex);
+
+	for(;;) {
+		Task *task = worker_find_task(worker);
+
+		if(task != NULL) {
+			worker_process_task(worker, task);
+			continue;
 		}
+
+		if(SDL_AtomicGet(&mgr->state) > TASKMGR_RUNNING && SDL_AtomicGet(&mgr->numtasks) == 0) {
+			break;
+		}
+
+		worker_sleep(worker);
 	}
 
+	SDL_TLSSet(worker_tls, NULL, NULL);
 	return 0;
 }
 
+static TaskWorker *taskmgr_current_worker(TaskManager *mgr) {
+	TaskWorker *worker = SDL_TLSGet(worker_tls);
+
+	if(worker != NULL && worker->mgr == mgr) {
+		return worker;
+	}
+
+	return NULL;
+}
+
+static void taskmgr_wake_worker(TaskManager *mgr) {
+	if(SDL_AtomicGet(&mgr->numsleepers) > 0) {
+		// task_wait() callers sleep on the same cond; a signal could wake one of them instead of a worker
+		SDL_LockMutex(mgr->mutex);
+		SDL_CondBroadcast(mgr->cond);
+		SDL_UnlockMutex(mgr->mutex);
+	}
+}
+
+static void taskmgr_free(TaskManager *mgr) {
+	if(mgr->mutex != NULL) {
+		SDL_DestroyMutex(mgr->mutex);
+	}
+
+	if(mgr->cond != NULL) {
+		SDL_DestroyCond(mgr->cond);
+	}
+
+	for(uint i = 0; i < mgr->numthreads; ++i) {
+		deque_free(&mgr->workers[i].deque);
+		dynarray_free_data(&mgr->workers[i].drain_buf);
+	}
+
+	free(mgr);
+}
+
 TaskManager *taskmgr_create(uint numthreads, SDL_ThreadPriority prio, const char *name) {
 	int numcores = SDL_GetCPUCount();
 
@@ -171,7 +546,12 @@ TaskManager *taskmgr_create(uint numthreads, SDL_ThreadPriority prio, const char
 		numthreads = maxthreads;
 	}
 
-	TaskManager *mgr = calloc(1, sizeof(TaskManager) + numthreads * sizeof(SDL_Thread*));
+	if(worker_tls == 0 && !(worker_tls = SDL_TLSCreate())) {
+		log_sdl_error(LOG_WARN, "SDL_TLSCreate");
+		return NULL;
+	}
+
+	TaskManager *mgr = calloc(1, sizeof(TaskManager) + numthreads * sizeof(TaskWorker));
 
 	if(!(mgr->mutex = SDL_CreateMutex())) {
 		log_sdl_error(LOG_WARN, "SDL_CreateMutex");
@@ -185,6 +565,15 @@ TaskManager *taskmgr_create(uint numthreads, SDL_ThreadPriority prio, const char
 
 	mgr->numthreads = numthreads;
 	mgr->thread_prio = prio;
+	SDL_AtomicSet(&mgr->state, TASKMGR_STARTING);
+
+	for(uint i = 0; i < numthreads; ++i) {
+		TaskWorker *worker = mgr->workers + i;
+		worker->mgr = mgr;
+		worker->index = i;
+		worker->rng = 2654435761u * (i + 1);
+		deque_init(&worker->deque);
+	}
 
 	for(uint i = 0; i < numthreads; ++i) {
 		int digits = i ? log10(i) + 1 : 0;
@@ -192,24 +581,24 @@ TaskManager *taskmgr_create(uint numthreads, SDL_ThreadPriority prio, const char
 		char threadname[sizeof(prefix) + strlen(name) + digits + 2];
 		snprintf(threadname, sizeof(threadname), "%s:%s/%i", prefix, name, i);
 
-		if(!(mgr->threads[i] = SDL_CreateThread(taskmgr_thread, threadname, mgr))) {
+		if(!(mgr->workers[i].thread = SDL_CreateThread(taskmgr_thread, threadname, mgr->workers + i))) {
 			log_sdl_error(LOG_WARN, "SDL_CreateThread");
 
-			for(uint j = 0; j < i; ++j) {
-				SDL_DetachThread(mgr->threads[j]);
-				mgr->threads[j] = NULL;
-			}
-
 			SDL_LockMutex(mgr->mutex);
-			mgr->aborted = true;
+			SDL_AtomicSet(&mgr->state, TASKMGR_ABORTING);
 			SDL_CondBroadcast(mgr->cond);
 			SDL_UnlockMutex(mgr->mutex);
+
+			for(uint j = 0; j < i; ++j) {
+				SDL_WaitThread(mgr->workers[j].thread, NULL);
+			}
+
 			goto fail;
 		}
 	}
 
 	SDL_LockMutex(mgr->mutex);
-	mgr->running = true;
+	SDL_AtomicSet(&mgr->state, TASKMGR_RUNNING);
 	SDL_CondBroadcast(mgr->cond);
 	SDL_UnlockMutex(mgr->mutex);
 
@@ -228,48 +617,35 @@ fail:
 	return NULL;
 }
 
-static int task_prio_func(List *ltask) {
-	return ((Task*)ltask)->prio;
-}
-
 Task *taskmgr_submit(TaskManager *mgr, TaskParams params) {
 	assert(params.callback != NULL);
 
-	Task *task = calloc(1, sizeof(Task));
+	Task *task = task_alloc();
+	task->mgr = mgr;
 	task->callback = params.callback;
 	task->userdata_free_callback = params.userdata_free_callback;
 	task->userdata = params.userdata;
 	task->prio = params.prio;
-	task->status = TASK_PENDING;
+	task->topmost = params.topmost;
+	SDL_AtomicSet(&task->status, TASK_PENDING);
 
-	if(!(task->mutex = SDL_CreateMutex())) {
-		log_sdl_error(LOG_WARN, "SDL_CreateMutex");
-		goto fail;
-	}
+	// One reference for the queue, one for the caller.
+	SDL_AtomicSet(&task->refs, 2);
 
-	if(!(task->cond = SDL_CreateCond())) {
-		log_sdl_error(LOG_WARN, "SDL_CreateCond");
-		goto fail;
-	}
+	SDL_AtomicIncRef(&mgr->numtasks);
+	SDL_AtomicIncRef(&mgr->numqueued);
 
-	SDL_LockMutex(mgr->mutex);
+	TaskWorker *worker = taskmgr_current_worker(mgr);
 
-	if(params.topmost) {
-		alist_insert_at_priority_head(&mgr->queue, task, task->prio, task_prio_func);
+	if(worker != NULL) {
+		deque_push(&worker->deque, task);
 	} else {
-		alist_insert_at_priority_tail(&mgr->queue, task, task->prio, task_prio_func);
+		uint i = (uint)SDL_AtomicAdd(&mgr->next_inbox, 1) % mgr->numthreads;
+		inbox_push(mgr->workers + i, task);
 	}
 
-	task->in_queue = true;
-	SDL_AtomicIncRef(&mgr->numtasks);
-	SDL_CondSignal(mgr->cond);
-	SDL_UnlockMutex(mgr->mutex);
-
+	taskmgr_wake_worker(mgr);
 	return task;
-
-fail:
-	task_free(task);
-	return NULL;
 }
 
 uint taskmgr_remaining(TaskManager *mgr) {
@@ -285,19 +661,18 @@ static void taskmgr_finalize_and_wait(TaskManager *mgr, bool do_abort) {
 		do_abort
 	);
 
-	assert(mgr->running);
-	assert(!mgr->aborted);
+	assert(SDL_AtomicGet(&mgr->state) == TASKMGR_RUNNING);
 
 	SDL_LockMutex(mgr->mutex);
-	mgr->running = false;
-	mgr->aborted = do_abort;
+	SDL_AtomicSet(&mgr->state, do_abort ? TASKMGR_ABORTING : TASKMGR_FINISHING);
 	SDL_CondBroadcast(mgr->cond);
 	SDL_UnlockMutex(mgr->mutex);
 
 	for(uint i = 0; i < mgr->numthreads; ++i) {
-		SDL_WaitThread(mgr->threads[i], NULL);
+		SDL_WaitThread(mgr->workers[i].thread, NULL);
 	}
 
+	assert(SDL_AtomicGet(&mgr->numqueued) == 0);
 	taskmgr_free(mgr);
 }
 
@@ -309,107 +684,143 @@ void taskmgr_abort(TaskManager *mgr) {
 	taskmgr_finalize_and_wait(mgr, true);
 }
 
-TaskStatus task_status(Task *task) {
-	TaskStatus result = TASK_INVALID;
-
-	if(task != NULL) {
-		SDL_LockMutex(task->mutex);
-		result = task->status;
-		SDL_UnlockMutex(task->mutex);
+typedef struct ParallelForJob {
+	task_range_func_t func;
+	void *arg;
+	uint count;
+	uint grain;
+	uint num_chunks;
+	SDL_atomic_t next_chunk;
+} ParallelForJob;
+
+static void parallel_for_run_chunks(ParallelForJob *job) {
+	uint chunk;
+
+	while((chunk = SDL_AtomicAdd(&job->next_chunk, 1)) < job->num_chunks) {
+		uint begin = chunk * job->grain;
+		uint end = imin(begin + job->grain, job->count);
+		job->func(begin, end, job->arg);
 	}
-
-	return result;
 }
 
-static void *task_offload(Task *task) {
-	assert(task->status == TASK_PENDING);
-	task->status = TASK_RUNNING;
-	SDL_UnlockMutex(task->mutex);
-	void *result = task->callback(task->userdata);
-	SDL_LockMutex(task->mutex);
-	assert(!task->disowned);
-	task->status = TASK_FINISHED;
-	task->result = result;
-	SDL_CondBroadcast(task->cond);
-	return result;
+static void *parallel_for_task(void *arg) {
+	parallel_for_run_chunks(arg);
+	return NULL;
 }
 
-bool task_wait(Task *task, void **result) {
-	bool success = false;
+void taskmgr_parallel_for(TaskManager *mgr, uint count, uint grain, task_range_func_t func, void *arg) {
+	assert(grain > 0);
 
-	if(task == NULL) {
-		return success;
+	if(count <= grain) {
+		if(count > 0) {
+			func(0, count, arg);
+		}
+
+		return;
 	}
 
-	void *_result = NULL;
+	ParallelForJob job = {
+		.func = func,
+		.arg = arg,
+		.count = count,
+		.grain = grain,
+		.num_chunks = (count + grain - 1) / grain,
+	};
+
+	// One chunk is left for the calling thread, at least.
+	uint num_helpers = imin(mgr->numthreads, job.num_chunks - 1);
+	Task *helpers[num_helpers];
+
+	for(uint i = 0; i < num_helpers; ++i) {
+		helpers[i] = taskmgr_submit(mgr, (TaskParams) {
+			.callback = parallel_for_task,
+			.userdata = &job,
+			.prio = INT_MIN,
+			.topmost = true,
+		});
+	}
 
-	SDL_LockMutex(task->mutex);
+	parallel_for_run_chunks(&job);
 
-	if(task->status == TASK_CANCELLED) {
-		success = false;
-	} else if(task->status == TASK_FINISHED) {
-		success = true;
-		_result = task->result;
-	} else if(task->status == TASK_RUNNING) {
-		SDL_CondWait(task->cond, task->mutex);
-		_result = task->result;
-		success = (task->status == TASK_FINISHED);
-	} else if(task->status == TASK_PENDING) {
-		// fine, i'll do it myself
-		_result = task_offload(task);
-		success = true;
-	} else {
-		UNREACHABLE;
+	// Helpers that haven't started yet run inline here, find nothing left to do, and return.
+	// The ones that did start must be waited for, since they are still using the job.
+	for(uint i = 0; i < num_helpers; ++i) {
+		task_finish(helpers[i], NULL);
 	}
+}
 
-	SDL_UnlockMutex(task->mutex);
-
-	if(success && result != NULL) {
-		*result = _result;
+TaskStatus task_status(Task *task) {
+	if(task == NULL) {
+		return TASK_INVALID;
 	}
 
-	return success;
+	return SDL_AtomicGet(&task->status);
 }
 
-bool task_cancel(Task *task) {
-	bool success = false;
+static void task_wait_running(Task *task) {
+	for(int i = 0; i < TASK_WAIT_SPIN_COUNT; ++i) {
+		if(SDL_AtomicGet(&task->status) != TASK_RUNNING) {
+			return;
+		}
+	}
 
-	if(task == NULL) {
-		return success;
+	TaskManager *mgr = task->mgr;
+	assert(mgr != NULL);
+
+	SDL_LockMutex(mgr->mutex);
+	SDL_AtomicIncRef(&mgr->numwaiters);
+
+	// Pairs with task_notify_waiters(): the status is set before numwaiters is checked.
+	while(SDL_AtomicGet(&task->status) == TASK_RUNNING) {
+		SDL_CondWait(mgr->cond, mgr->mutex);
 	}
 
-	SDL_LockMutex(task->mutex);
+	(void)SDL_AtomicDecRef(&mgr->numwaiters);
+	SDL_UnlockMutex(mgr->mutex);
+}
 
-	if(task->status == TASK_PENDING) {
-		task->status = TASK_CANCELLED;
-		success = true;
+bool task_wait(Task *task, void **result) {
+	if(task == NULL) {
+		return false;
 	}
 
-	SDL_UnlockMutex(task->mutex);
+	if(SDL_AtomicCAS(&task->status, TASK_PENDING, TASK_RUNNING)) {
+		// fine, i'll do it myself
+		// The worker that eventually dequeues it will see that it's no longer pending.
+		task_execute(task);
+	} else if(SDL_AtomicGet(&task->status) == TASK_RUNNING) {
+		task_wait_running(task);
+	}
 
-	return success;
-}
+	TaskStatus status = SDL_AtomicGet(&task->status);
 
-bool task_detach(Task *task) {
-	bool success = false;
-	bool task_in_queue;
+	if(status == TASK_FINISHED) {
+		if(result != NULL) {
+			*result = task->result;
+		}
 
+		return true;
+	}
+
+	assert(status == TASK_CANCELLED);
+	return false;
+}
+
+bool task_cancel(Task *task) {
 	if(task == NULL) {
-		return success;
+		return false;
 	}
 
-	SDL_LockMutex(task->mutex);
-	assert(!task->disowned);
-	task->disowned = true;
-	task_in_queue = task->in_queue;
-	success = true;
-	SDL_UnlockMutex(task->mutex);
+	return SDL_AtomicCAS(&task->status, TASK_PENDING, TASK_CANCELLED);
+}
 
-	if(!task_in_queue) {
-		task_free(task);
+bool task_detach(Task *task) {
+	if(task == NULL) {
+		return false;
 	}
 
-	return success;
+	task_unref(task);
+	return true;
 }
 
 bool task_finish(Task *task, void **result) {
@@ -434,17 +845,33 @@ void taskmgr_global_shutdown(void) {
 		taskmgr_finish(g_taskmgr);
 		g_taskmgr = NULL;
 	}
+
+	task_pool_trim();
 }
 
 Task *taskmgr_global_submit(TaskParams params) {
 	if(g_taskmgr == NULL) {
-		Task *t = calloc(1, sizeof(Task));
+		Task *t = task_alloc();
 		t->callback = params.callback;
 		t->userdata = params.userdata;
 		t->userdata_free_callback = params.userdata_free_callback;
 		t->result = params.callback(params.userdata);
+		SDL_AtomicSet(&t->status, TASK_FINISHED);
+		SDL_AtomicSet(&t->refs, 1);
 		return t;
 	}
 
 	return taskmgr_submit(g_taskmgr, params);
 }
+
+void taskmgr_global_parallel_for(uint count, uint grain, task_range_func_t func, void *arg) {
+	if(g_taskmgr == NULL) {
+		if(count > 0) {
+			func(0, count, arg);
+		}
+
+		return;
+	}
+
+	taskmgr_parallel_for(g_taskmgr, count, grain, func, arg);
+}
@@ -26,6 +26,7 @@ typedef enum TaskStatus {
 
 typedef void *(*task_func_t)(void *userdata);
 typedef void (*task_free_func_t)(void *userdata);
+typedef void (*task_range_func_t)(uint begin, uint end, void *arg);
 
 /**
  * Parameters for `taskmgr_submit`. See its documentation below.
@@ -52,16 +53,20 @@ typedef struct TaskParams {
 	task_free_func_t userdata_free_callback;
 
 	/**
-	 * Priority of the task. Lower values mean higher priority. Higher priority tasks are added
-	 * to the queue ahead of the lower priority ones, and thus will start execute sooner. Note
-	 * that this affects only the pending tasks. A task that already began executing cannot be
-	 * interrupted, regardless of its priority.
+	 * Priority of the task. Lower values mean higher priority. Higher priority tasks are queued
+	 * ahead of the lower priority ones, and thus will start execute sooner. Note that this
+	 * affects only the pending tasks. A task that already began executing cannot be interrupted,
+	 * regardless of its priority.
+	 *
+	 * Every worker thread has its own queue, and idle workers steal from the others, so this is
+	 * only a hint: it orders tasks that were submitted around the same time and landed in the
+	 * same queue.
 	 */
 	int prio;
 
 	/**
-	 * If true, this task will be inserted ahead of the others with the same priority, if any.
-	 * Otherwise, it'll be put behind them instead.
+	 * If true, this task will be queued ahead of the others with the same priority, if any.
+	 * Otherwise, it'll be put behind them instead. Subject to the same caveats as prio.
 	 */
 	bool topmost;
 } TaskParams;
@@ -83,6 +88,10 @@ TaskManager *taskmgr_create(uint numthreads, SDL_ThreadPriority prio, const char
  * Submit a new task to [mgr] described by [params]. It is generally placed at the end of the
  * task manager's queue, but that can be influenced with [params.prio] and [params.topmost].
  *
+ * When called from one of [mgr]'s own worker threads (i.e. from inside a task), the new task is
+ * pushed onto that worker's queue, and will likely be executed by the same thread next, unless
+ * another worker steals it first.
+ *
  * See documentation for TaskParams above.
  *
  * However, you should not rely on the tasks being actually executed in any specific order, in
@@ -117,6 +126,20 @@ void taskmgr_finish(TaskManager *mgr)
 void taskmgr_abort(TaskManager *mgr)
 	attr_nonnull(1);
 
+/**
+ * Call [func] over the range [0, count) split into chunks of [grain] elements (the last one may be
+ * shorter), spread across [mgr]'s workers, and return when all of them are done. The calling thread
+ * works on the chunks too, so this is safe to call from inside a task as well.
+ *
+ * The chunk boundaries depend only on [count] and [grain]. Which thread processes which chunk is
+ * not specified, so [func] must not depend on the order in which the chunks are processed; if every
+ * element is computed independently, the result is the same as that of a plain loop.
+ *
+ * If [count] is not larger than [grain], [func] is simply called on the current thread.
+ */
+void taskmgr_parallel_for(TaskManager *mgr, uint count, uint grain, task_range_func_t func, void *arg)
+	attr_nonnull(1, 4);
+
 /**
  * Returns the current status of [task]. See TaskStatus documentation above.
  * Returns TASK_INVALID on failure.
@@ -179,4 +202,11 @@ void taskmgr_global_shutdown(void);
  */
 Task *taskmgr_global_submit(TaskParams params);
 
+/**
+ * Run a parallel for loop on the global task manager. See `taskmgr_parallel_for`.
+ * Falls back to a plain loop if the global task manager is not available.
+ */
+void taskmgr_global_parallel_for(uint count, uint grain, task_range_func_t func, void *arg)
+	attr_nonnull(3);
+
 #endif // IGUARD_taskmanager_h
@@ -16,22 +16,38 @@ static inline void ellipse_bbox(const Ellipse *e, Rect *r) {
 	r->bottom_right = e->origin + largest_radius + I * largest_radius;
 }
 
-bool point_in_ellipse(cmplx p, Ellipse e) {
-	double Xp = creal(p);
-	double Yp = cimag(p);
-	double Xe = creal(e.origin);
-	double Ye = cimag(e.origin);
-	double a = e.angle;
-
-	Rect e_bbox;
-	ellipse_bbox(&e, &e_bbox);
+// point_in_ellipse() with everything that only depends on the ellipse computed up front.
+typedef struct EllipseTest {
+	Rect bbox;
+	double Xe, Ye;
+	double cos_a, sin_a;
+	double a2, b2;
+} EllipseTest;
+
+static inline void ellipse_test_init(EllipseTest *t, const Ellipse *e) {
+	ellipse_bbox(e, &t->bbox);
+	t->Xe = creal(e->origin);
+	t->Ye = cimag(e->origin);
+	t->cos_a = cos(e->angle);
+	t->sin_a = sin(e->angle);
+	t->a2 = pow(creal(e->axes)/2, 2);
+	t->b2 = pow(cimag(e->axes)/2, 2);
+}
 
-	return point_in_rect(p, e_bbox) && (
-		pow(cos(a) * (Xp - Xe) + sin(a) * (Yp - Ye), 2) / pow(creal(e.axes)/2, 2) +
-		pow(sin(a) * (Xp - Xe) - cos(a) * (Yp - Ye), 2) / pow(cimag(e.axes)/2, 2)
+// Only valid for points inside of the bounding box.
+static inline bool ellipse_test_point(const EllipseTest *t, double Xp, double Yp) {
+	return (
+		pow(t->cos_a * (Xp - t->Xe) + t->sin_a * (Yp - t->Ye), 2) / t->a2 +
+		pow(t->sin_a * (Xp - t->Xe) - t->cos_a * (Yp - t->Ye), 2) / t->b2
 	) <= 1;
 }
 
+bool point_in_ellipse(cmplx p, Ellipse e) {
+	EllipseTest t;
+	ellipse_test_init(&t, &e);
+	return point_in_rect(p, t.bbox) && ellipse_test_point(&t, creal(p), cimag(p));
+}
+
 // If segment_ellipse_nonintersection_heuristic returns true, then the
 // segment and ellipse do not intersect. However, **the converse is not true**.
 // Used for quick returning false in real intersection functions.
@@ -108,6 +124,221 @@ bool lineseg_ellipse_intersect(LineSegment seg, Ellipse e) {
 	return lineseg_circle_intersect_fallback(seg, c) >= 0;
 }
 
+static inline bool lineseg_misses_box(double ax, double ay, double bx, double by, double r) {
+	return
+		(ay < -r && by < -r) ||
+		(ay >  r && by >  r) ||
+		(ax < -r && bx < -r) ||
+		(ax >  r && bx >  r);
+}
+
+#ifdef USE_GNU_EXTENSIONS
+
+// NOTE: Generic vectors, so that the compiler can pick whatever the target has (SSE2, AVX, NEON…)
+// Only comparisons are done in vector form, so there is no rounding that could differ from the scalar path.
+#define CULL_BATCH_WIDTH 4
+typedef double cull_vec_t __attribute__((vector_size(CULL_BATCH_WIDTH * sizeof(double))));
+typedef int64_t cull_mask_t __attribute__((vector_size(CULL_BATCH_WIDTH * sizeof(int64_t))));
+
+static uint lineseg_ellipse_cull_batch_vec(
+	uint count,
+	const double *restrict ax, const double *restrict ay,
+	const double *restrict bx, const double *restrict by,
+	const double *restrict radius,
+	bool *restrict out_miss
+) {
+	uint i = 0;
+
+	for(; i + CULL_BATCH_WIDTH <= count; i += CULL_BATCH_WIDTH) {
+		cull_vec_t vax, vay, vbx, vby, r;
+		memcpy(&vax, ax + i, sizeof(vax));
+		memcpy(&vay, ay + i, sizeof(vay));
+		memcpy(&vbx, bx + i, sizeof(vbx));
+		memcpy(&vby, by + i, sizeof(vby));
+		memcpy(&r, radius + i, sizeof(r));
+		cull_vec_t nr = -r;
+
+		cull_mask_t miss =
+			((vay < nr) & (vby < nr)) |
+			((vay >  r) & (vby >  r)) |
+			((vax < nr) & (vbx < nr)) |
+			((vax >  r) & (vbx >  r));
+
+		for(uint j = 0; j < CULL_BATCH_WIDTH; ++j) {
+			out_miss[i + j] = miss[j] != 0;
+		}
+	}
+
+	return i;
+}
+
+#endif
+
+void lineseg_ellipse_cull_batch(
+	uint count,
+	const double *restrict ax, const double *restrict ay,
+	const double *restrict bx, const double *restrict by,
+	const double *restrict radius,
+	bool *restrict out_miss
+) {
+	uint i = 0;
+
+#ifdef USE_GNU_EXTENSIONS
+	i = lineseg_ellipse_cull_batch_vec(count, ax, ay, bx, by, radius, out_miss);
+#endif
+
+	for(; i < count; ++i) {
+		out_miss[i] = lineseg_misses_box(ax[i], ay[i], bx[i], by[i], radius[i]);
+	}
+}
+
+/*
+ * The batched point tests first sort points into "certainly inside", "certainly
+ * outside" and "too close to tell" with cheap comparisons, and run the exact
+ * scalar test only on the last group. The bounds are a relative 1e-9 apart,
+ * far more than the rounding error of either formula.
+ */
+#define POINT_TEST_MARGIN 1e-9
+
+enum {
+	POINT_OUTSIDE,
+	POINT_INSIDE,
+	POINT_UNSURE,
+};
+
+static inline uint8_t point_circle_classify(double dx, double dy, double r2_lo, double r2_hi) {
+	double d2 = dx * dx + dy * dy;
+	return d2 < r2_lo ? POINT_INSIDE : (d2 > r2_hi ? POINT_OUTSIDE : POINT_UNSURE);
+}
+
+static inline bool point_outside_box(double x, double y, const Rect *r) {
+	return !(x >= rect_left(*r) && x <= rect_right(*r) && y >= rect_top(*r) && y <= rect_bottom(*r));
+}
+
+#ifdef USE_GNU_EXTENSIONS
+
+static uint points_in_circle_classify_vec(
+	uint count,
+	const double *restrict x, const double *restrict y,
+	double ox, double oy, double r2_lo, double r2_hi,
+	uint8_t *restrict out_class
+) {
+	uint i = 0;
+
+	for(; i + CULL_BATCH_WIDTH <= count; i += CULL_BATCH_WIDTH) {
+		cull_vec_t vx, vy;
+		memcpy(&vx, x + i, sizeof(vx));
+		memcpy(&vy, y + i, sizeof(vy));
+		vx -= ox;
+		vy -= oy;
+		cull_vec_t d2 = vx * vx + vy * vy;
+		cull_mask_t inside = d2 < r2_lo;
+		cull_mask_t outside = d2 > r2_hi;
+
+		for(uint j = 0; j < CULL_BATCH_WIDTH; ++j) {
+			out_class[i + j] = inside[j] ? POINT_INSIDE : (outside[j] ? POINT_OUTSIDE : POINT_UNSURE);
+		}
+	}
+
+	return i;
+}
+
+static uint points_outside_box_vec(
+	uint count,
+	const double *restrict x, const double *restrict y,
+	const Rect *box,
+	bool *restrict out_outside
+) {
+	uint i = 0;
+	double l = rect_left(*box), r = rect_right(*box), t = rect_top(*box), b = rect_bottom(*box);
+
+	for(; i + CULL_BATCH_WIDTH <= count; i += CULL_BATCH_WIDTH) {
+		cull_vec_t vx, vy;
+		memcpy(&vx, x + i, sizeof(vx));
+		memcpy(&vy, y + i, sizeof(vy));
+		cull_mask_t inside = (vx >= l) & (vx <= r) & (vy >= t) & (vy <= b);
+
+		for(uint j = 0; j < CULL_BATCH_WIDTH; ++j) {
+			out_outside[i + j] = inside[j] == 0;
+		}
+	}
+
+	return i;
+}
+
+#endif
+
+void points_in_circle_batch(
+	uint count,
+	const double *restrict x, const double *restrict y,
+	Circle c,
+	bool *restrict out_inside
+) {
+	if(count == 0) {
+		return;
+	}
+
+	if(!(c.radius > 0)) {
+		// cabs() is never negative
+		memset(out_inside, 0, sizeof(*out_inside) * count);
+		return;
+	}
+
+	double ox = creal(c.origin);
+	double oy = cimag(c.origin);
+	double r2 = c.radius * c.radius;
+	double r2_lo = r2 * (1 - POINT_TEST_MARGIN);
+	double r2_hi = r2 * (1 + POINT_TEST_MARGIN);
+	uint8_t cls[count];
+	uint i = 0;
+
+#ifdef USE_GNU_EXTENSIONS
+	i = points_in_circle_classify_vec(count, x, y, ox, oy, r2_lo, r2_hi, cls);
+#endif
+
+	for(; i < count; ++i) {
+		cls[i] = point_circle_classify(x[i] - ox, y[i] - oy, r2_lo, r2_hi);
+	}
+
+	for(i = 0; i < count; ++i) {
+		if(UNLIKELY(cls[i] == POINT_UNSURE)) {
+			out_inside[i] = cabs(CMPLX(x[i], y[i]) - c.origin) < c.radius;
+		} else {
+			out_inside[i] = cls[i] == POINT_INSIDE;
+		}
+	}
+}
+
+void points_in_ellipse_batch(
+	uint count,
+	const double *restrict x, const double *restrict y,
+	Ellipse e,
+	bool *restrict out_inside
+) {
+	if(count == 0) {
+		return;
+	}
+
+	EllipseTest t;
+	ellipse_test_init(&t, &e);
+
+	// The bounding box check is exact, the rest only runs for points inside of it.
+	bool outside[count];
+	uint i = 0;
+
+#ifdef USE_GNU_EXTENSIONS
+	i = points_outside_box_vec(count, x, y, &t.bbox, outside);
+#endif
+
+	for(; i < count; ++i) {
+		outside[i] = point_outside_box(x[i], y[i], &t.bbox);
+	}
+
+	for(i = 0; i < count; ++i) {
+		out_inside[i] = !outside[i] && ellipse_test_point(&t, x[i], y[i]);
+	}
+}
+
 double lineseg_circle_intersect(LineSegment seg, Circle c) {
 	Ellipse e = { .origin = c.origin, .axes = 2*c.radius + I*2*c.radius };
 	if(segment_ellipse_nonintersection_heuristic(seg, e)) {
@@ -83,6 +83,34 @@ bool point_in_ellipse(cmplx p, Ellipse e) attr_const;
 double lineseg_circle_intersect(LineSegment seg, Circle c) attr_const;
 bool lineseg_ellipse_intersect(LineSegment seg, Ellipse e) attr_const;
 
+// Batched broadphase for lineseg_ellipse_intersect().
+// Segment i goes from (ax[i], ay[i]) to (bx[i], by[i]), relative to the center of an ellipse whose
+// largest half-axis is at most radius[i]. Sets out_miss[i] if the segment can't possibly intersect it.
+// Vectorized where possible; the result is exactly the same as that of the scalar loop.
+void lineseg_ellipse_cull_batch(
+	uint count,
+	const double *restrict ax, const double *restrict ay,
+	const double *restrict bx, const double *restrict by,
+	const double *restrict radius,
+	bool *restrict out_miss
+);
+
+// Batched point-in-shape tests for many points against the same shape. Point i is (x[i], y[i]).
+// The results are exactly the same as those of cabs(p - c.origin) < c.radius and point_in_ellipse().
+void points_in_circle_batch(
+	uint count,
+	const double *restrict x, const double *restrict y,
+	Circle c,
+	bool *restrict out_inside
+);
+
+void points_in_ellipse_batch(
+	uint count,
+	const double *restrict x, const double *restrict y,
+	Ellipse e,
+	bool *restrict out_inside
+);
+
 INLINE attr_const
 double rect_x(Rect r) {
 	return creal(r.top_left);
@@ -276,6 +276,28 @@ float ftopow2(float x) {
 	return y;
 }
 
+uint16_t float_to_half(float x) {
+	union { float f; uint32_t u; } v = { .f = x };
+	uint32_t sign = (v.u >> 16) & 0x8000;
+	v.u &= 0x7fffffff;
+
+	if(v.u >= 0x47800000) {
+		// out of range: inf, or a quiet nan
+		return sign | (v.u > 0x7f800000 ? 0x7e00 : 0x7c00);
+	}
+
+	if(v.u < 0x38800000) {
+		// subnormal or zero: let the FPU do the rounding by aligning the mantissa
+		v.f += 0.5f;
+		return sign | (v.u - 0x3f000000);
+	}
+
+	// rebias the exponent and round to nearest even
+	uint32_t mant_odd = (v.u >> 13) & 1;
+	v.u += 0xc8000fff + mant_odd;
+	return sign | (v.u >> 13);
+}
+
 float smooth(float x) {
 	return 1.0 - (0.5 * cos(M_PI * x) + 0.5);
 }
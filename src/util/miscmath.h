@@ -68,6 +68,9 @@ uint digitcnt(uint64_t x) attr_const;
 float normpdf(float x, float sigma) attr_const;
 void gaussian_kernel_1d(size_t size, float sigma, float kernel[size]) attr_nonnull(3);
 
+// Convert to IEEE 754 binary16, rounding to nearest even.
+uint16_t float_to_half(float x) attr_const;
+
 // Compute (a*b)/c with 128-bit intermediate precision.
 // If the final result would not fit into 64 bits, the return value is undefined.
 uint64_t umuldiv64(uint64_t x, uint64_t multiplier, uint64_t divisor);
@@ -0,0 +1,134 @@
+/*
+ * This software is licensed under the terms of the MIT License.
+ * See COPYING for further information.
+ * ---
+ * Copyright (c) 2011-2019, Lukas Weber <laochailan@web.de>.
+ * Copyright (c) 2012-2019, Andrei Alexeyev <akari@taisei-project.org>.
+ */
+
+#include "taisei.h"
+
+#include "spatialgrid.h"
+#include "util.h"
+
+void spatialgrid_init(SpatialGrid *grid, Rect bounds, double cell_size) {
+	assert(cell_size > 0);
+	memset(grid, 0, sizeof(*grid));
+
+	grid->origin = bounds.top_left;
+	grid->inv_cell_size = 1.0 / cell_size;
+	grid->cells_x = imax(1, ceil(rect_width(bounds) / cell_size));
+	grid->cells_y = imax(1, ceil(rect_height(bounds) / cell_size));
+
+	dynarray_ensure_capacity(&grid->cell_offsets, grid->cells_x * grid->cells_y + 1);
+	grid->cell_offsets.num_elements = grid->cells_x * grid->cells_y + 1;
+	memset(grid->cell_offsets.data, 0, sizeof(*grid->cell_offsets.data) * grid->cell_offsets.num_elements);
+}
+
+void spatialgrid_free(SpatialGrid *grid) {
+	dynarray_free_data(&grid->staging);
+	dynarray_free_data(&grid->entries);
+	dynarray_free_data(&grid->cell_offsets);
+}
+
+void spatialgrid_reset(SpatialGrid *grid) {
+	grid->staging.num_elements = 0;
+	grid->entries.num_elements = 0;
+}
+
+static inline int cell_coord(double v, int num_cells) {
+	// NOTE: written this way so that NaN ends up in cell 0
+	if(!(v >= 0)) {
+		return 0;
+	}
+
+	if(v >= num_cells - 1) {
+		return num_cells - 1;
+	}
+
+	return (int)v;
+}
+
+static inline int cell_x(SpatialGrid *grid, double x) {
+	return cell_coord((x - creal(grid->origin)) * grid->inv_cell_size, grid->cells_x);
+}
+
+static inline int cell_y(SpatialGrid *grid, double y) {
+	return cell_coord((y - cimag(grid->origin)) * grid->inv_cell_size, grid->cells_y);
+}
+
+void spatialgrid_add(SpatialGrid *grid, void *object, cmplx pos) {
+	uint order = grid->staging.num_elements;
+	*dynarray_append_with_min_capacity(&grid->staging, 32) = (SpatialGridEntry) {
+		.object = object,
+		.pos = pos,
+		.order = order,
+		.cell = cell_y(grid, cimag(pos)) * grid->cells_x + cell_x(grid, creal(pos)),
+	};
+}
+
+void spatialgrid_build(SpatialGrid *grid) {
+	uint num_cells = grid->cells_x * grid->cells_y;
+	uint *offsets = grid->cell_offsets.data;
+	uint num_entries = grid->staging.num_elements;
+
+	memset(offsets, 0, sizeof(*offsets) * (num_cells + 1));
+
+	// Counting sort by cell, stable with respect to insertion order
+
+	for(uint i = 0; i < num_entries; ++i) {
+		++offsets[grid->staging.data[i].cell + 1];
+	}
+
+	for(uint i = 1; i <= num_cells; ++i) {
+		offsets[i] += offsets[i - 1];
+	}
+
+	dynarray_ensure_capacity(&grid->entries, num_entries);
+	grid->entries.num_elements = num_entries;
+
+	// Use the offsets as insertion cursors; afterwards each one points at the start of the next cell
+	for(uint i = 0; i < num_entries; ++i) {
+		SpatialGridEntry *e = grid->staging.data + i;
+		grid->entries.data[offsets[e->cell]++] = *e;
+	}
+
+	for(uint i = num_cells - 1; i > 0; --i) {
+		offsets[i] = offsets[i - 1];
+	}
+
+	offsets[0] = 0;
+}
+
+uint spatialgrid_query_rect(SpatialGrid *grid, Rect area, SpatialGridEntry **results) {
+	int x0 = cell_x(grid, rect_left(area));
+	int x1 = cell_x(grid, rect_right(area));
+	int y0 = cell_y(grid, rect_top(area));
+	int y1 = cell_y(grid, rect_bottom(area));
+	uint *offsets = grid->cell_offsets.data;
+	uint num_results = 0;
+
+	for(int y = y0; y <= y1; ++y) {
+		for(int x = x0; x <= x1; ++x) {
+			uint cell = y * grid->cells_x + x;
+
+			for(uint i = offsets[cell]; i < offsets[cell + 1]; ++i) {
+				results[num_results++] = grid->entries.data + i;
+			}
+		}
+	}
+
+	// Restore insertion order. The result sets are tiny, so insertion sort it is.
+	for(uint i = 1; i < num_results; ++i) {
+		SpatialGridEntry *e = results[i];
+		uint j = i;
+
+		for(; j > 0 && results[j - 1]->order > e->order; --j) {
+			results[j] = results[j - 1];
+		}
+
+		results[j] = e;
+	}
+
+	return num_results;
+}
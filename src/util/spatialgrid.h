@@ -0,0 +1,68 @@
+/*
+ * This software is licensed under the terms of the MIT License.
+ * See COPYING for further information.
+ * ---
+ * Copyright (c) 2011-2019, Lukas Weber <laochailan@web.de>.
+ * Copyright (c) 2012-2019, Andrei Alexeyev <akari@taisei-project.org>.
+ */
+
+#ifndef IGUARD_util_spatialgrid_h
+#define IGUARD_util_spatialgrid_h
+
+#include "taisei.h"
+
+#include "geometry.h"
+#include "dynarray.h"
+
+/*
+ * A uniform grid of point-like objects, used as a broadphase for proximity queries.
+ *
+ * Objects are added with spatialgrid_add() after a spatialgrid_reset(), then
+ * spatialgrid_build() sorts them into cells. Objects outside of the grid bounds
+ * are clamped into the border cells, so queries never miss anything.
+ *
+ * Query results are returned in the order the objects were added, so that code
+ * iterating over them behaves exactly like a linear scan over the source list.
+ */
+
+typedef struct SpatialGridEntry {
+	void *object;
+	cmplx pos;
+	uint order;
+	uint cell;
+} SpatialGridEntry;
+
+typedef struct SpatialGrid {
+	DYNAMIC_ARRAY(SpatialGridEntry) staging;
+	DYNAMIC_ARRAY(SpatialGridEntry) entries;
+	DYNAMIC_ARRAY(uint) cell_offsets;
+	cmplx origin;
+	double inv_cell_size;
+	int cells_x;
+	int cells_y;
+} SpatialGrid;
+
+void spatialgrid_init(SpatialGrid *grid, Rect bounds, double cell_size)
+	attr_nonnull(1);
+
+void spatialgrid_free(SpatialGrid *grid)
+	attr_nonnull(1);
+
+void spatialgrid_reset(SpatialGrid *grid)
+	attr_nonnull(1);
+
+void spatialgrid_add(SpatialGrid *grid, void *object, cmplx pos)
+	attr_nonnull(1);
+
+void spatialgrid_build(SpatialGrid *grid)
+	attr_nonnull(1);
+
+// `results` must have room for at least spatialgrid_size(grid) pointers.
+uint spatialgrid_query_rect(SpatialGrid *grid, Rect area, SpatialGridEntry **results)
+	attr_nonnull(1, 3);
+
+INLINE uint spatialgrid_size(SpatialGrid *grid) {
+	return grid->entries.num_elements;
+}
+
+#endif // IGUARD_util_spatialgrid_h
@@ -540,12 +540,16 @@ void video_set_display(uint idx) {
 static void *video_screenshot_task(void *arg) {
 	ScreenshotTaskData *tdata = arg;
 
+	// The readback is RGBA8; the PNG is written as packed RGB
 	pixmap_convert_inplace_realloc(&tdata->image, PIXMAP_FORMAT_RGB8);
 	pixmap_flip_to_origin_inplace(&tdata->image, PIXMAP_ORIGIN_BOTTOMLEFT);
+	assert(tdata->image.format == PIXMAP_FORMAT_RGB8);
 
 	uint width = tdata->image.width;
 	uint height = tdata->image.height;
 	uint8_t *pixels = tdata->image.data.untyped;
+	size_t row_size = pixmap_data_size(&tdata->image) / height;
+	assert(row_size == width * sizeof(PixelRGB8));
 
 	SDL_RWops *output = vfs_open(tdata->dest_path, VFS_MODE_WRITE);
 
@@ -590,8 +594,8 @@ static void *video_screenshot_task(void *arg) {
 	);
 
 	for(int y = 0; y < height; y++) {
-		row_pointers[y] = png_malloc(png_ptr, width * 3);
-		memcpy(row_pointers[y], pixels + width * 3 * (height - 1 - y), width * 3);
+		row_pointers[y] = png_malloc(png_ptr, row_size);
+		memcpy(row_pointers[y], pixels + row_size * (height - 1 - y), row_size);
 	}
 
 	pngutil_init_rwops_write(png_ptr, output);
@@ -622,20 +626,22 @@ static void video_screenshot_free_task_data(void *arg) {
 	free(tdata);
 }
 
-void video_take_screenshot(void) {
-	ScreenshotTaskData tdata;
-	memset(&tdata, 0, sizeof(tdata));
+static void video_screenshot_read_done(Pixmap *pixmap, void *userdata) {
+	char *dest_path = userdata;
 
-	if(!r_screenshot(&tdata.image)) {
+	if(pixmap == NULL) {
 		log_error("Failed to take a screenshot");
+		free(dest_path);
 		return;
 	}
 
-	SystemTime systime;
-	char timestamp[FILENAME_TIMESTAMP_MIN_BUF_SIZE];
-	get_system_time(&systime);
-	filename_timestamp(timestamp, sizeof(timestamp), systime);
-	tdata.dest_path = strfmt("storage/screenshots/taisei_%s.png", timestamp);
+	assert(pixmap->format == PIXMAP_FORMAT_RGBA8);
+	assert(pixmap->width > 0 && pixmap->height > 0);
+
+	ScreenshotTaskData tdata;
+	memset(&tdata, 0, sizeof(tdata));
+	tdata.image = *pixmap;
+	tdata.dest_path = dest_path;
 
 	task_detach(taskmgr_global_submit((TaskParams) {
 		.callback = video_screenshot_task,
@@ -644,6 +650,20 @@ void video_take_screenshot(void) {
 	}));
 }
 
+void video_take_screenshot(void) {
+	SystemTime systime;
+	char timestamp[FILENAME_TIMESTAMP_MIN_BUF_SIZE];
+	get_system_time(&systime);
+	filename_timestamp(timestamp, sizeof(timestamp), systime);
+	char *dest_path = strfmt("storage/screenshots/taisei_%s.png", timestamp);
+
+	// The pixels arrive a frame or two later; this avoids stalling on the GPU here
+	FloatRect vp;
+	r_framebuffer_viewport_current(NULL, &vp);
+	IntRect region = { .x = vp.x, .y = vp.y, .w = vp.w, .h = vp.h };
+	r_framebuffer_read_async(NULL, FRAMEBUFFER_ATTACH_COLOR0, region, dest_path, video_screenshot_read_done);
+}
+
 bool video_is_resizable(void) {
 	return SDL_GetWindowFlags(video.window) & SDL_WINDOW_RESIZABLE;
 }